@@ -0,0 +1,95 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+/*
+ * Helpers for the benchmarks in this directory. They are built with
+ * "make bench" and linked with all objects of horst, where main() is renamed
+ * to horst_main(), so they can call any function and use the globals (conf,
+ * stats, ...) of horst directly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <uwifi/util.h>
+#include <uwifi/wlan_util.h>
+
+#include "../main.h"
+#include "../nodes.h"
+
+/* monotonic time in seconds */
+static inline double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* numeric argument i or the default */
+static inline long bench_arg(int argc, char** argv, int i, long def)
+{
+	return argc > i ? atol(argv[i]) : def;
+}
+
+/* set up the globals like main() does, without an interface or display,
+ * with the given channels */
+static inline void bench_init(const int* freqs, int num_freqs)
+{
+	cc_list_head_init(&essids);
+	cc_list_head_init(&conf.intf.wlan_nodes);
+	pool_init(&chan_node_pool, "chan_node", sizeof(struct chan_node), 256);
+	nodes_init();
+
+	conf.quiet = 1;
+	conf.filter_off = 1;
+	conf.node_timeout = 60;
+	conf.intf.channel_idx = -1;
+	for (int i = 0; i < num_freqs; i++)
+		uwifi_channel_list_add(&conf.intf.channels, freqs[i]);
+
+	clock_gettime(CLOCK_MONOTONIC, &time_mono);
+	clock_gettime(CLOCK_REALTIME, &time_real);
+}
+
+/* a QoS data frame from station 02:00:00:xx:xx:xx with the number id to the
+ * AP 02:ff:00:00:00:00 */
+static inline void bench_packet(struct uwifi_packet* p, unsigned int id, int freq)
+{
+	memset(p, 0, sizeof(*p));
+	p->pkt_types = PKT_TYPE_IP | PKT_TYPE_UDP;
+	p->wlan_type = WLAN_FRAME_QDATA;
+	p->phy_signal = -40 - id % 40;
+	p->phy_rate = 1300;
+	p->phy_freq = freq;
+	p->wlan_len = 1000;
+	p->wlan_ta[0] = 0x02;
+	p->wlan_ta[3] = id >> 16;
+	p->wlan_ta[4] = id >> 8;
+	p->wlan_ta[5] = id;
+	memcpy(p->wlan_ra, "\x02\xff\x00\x00\x00\x00", WLAN_MAC_LEN);
+	memcpy(p->wlan_bssid, p->wlan_ra, WLAN_MAC_LEN);
+}
+
+#endif
@@ -0,0 +1,141 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * CSV outfile formatting: lines per second of csvfile_format_record()
+ * compared to the localtime()/strftime()/fprintf() path it replaced.
+ *
+ * Usage: csv [lines]
+ *
+ * Both write to /dev/null thru a stdio buffer of the same size. The old path
+ * also did fflush() after every line, this is left out here, so only the
+ * formatting is compared.
+ */
+
+#include <string.h>
+
+#include <uwifi/util.h>
+#include <uwifi/wlan_util.h>
+
+#include "../csvfile.h"
+#include "../hutil.h"
+#include "bench.h"
+
+#define BUF_SIZE	(256 * 1024)
+
+static char out_buf[BUF_SIZE];
+
+/* the formatting of write_to_file() before the CSV writer thread */
+static void old_format(FILE* f, const struct csv_record* r)
+{
+	char buf[40];
+	int i;
+	struct tm* ltm = localtime(&r->ts.tv_sec);
+
+	i = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", ltm);
+	i += snprintf(buf + i, sizeof(buf) - i, ".%06ld", (long)(r->ts.tv_nsec / 1000));
+	i += strftime(buf + i, sizeof(buf) - i, " %z", ltm);
+	fprintf(f, "%s, ", buf);
+
+	fprintf(f, "%s, " MAC_FMT ", ",
+		wlan_get_packet_type_name(r->type), MAC_PAR(r->ta));
+	fprintf(f, MAC_FMT ", ", MAC_PAR(r->ra));
+	fprintf(f, MAC_FMT ", ", MAC_PAR(r->bssid));
+	fprintf(f, "%x, %d, %d, %d, %d, ",
+		r->pkt_types, r->signal, r->len, r->rate, r->freq);
+	fprintf(f, "%016llx, ", (unsigned long long)r->tsf);
+	fprintf(f, "%s, %d, %d, %d, %d, %d, ",
+		r->essid, r->mode, r->channel, r->wep, r->wpa, r->rsn);
+	fprintf(f, "%s, %s\n", ip_sprintf(r->ip_src), ip_sprintf(r->ip_dst));
+}
+
+static void new_format(FILE* f, const struct csv_record* r)
+{
+	char buf[CSVFILE_MAX_LINE];
+	size_t len = csvfile_format_record(buf, r);
+
+	fwrite(buf, 1, len, f);
+}
+
+/* one record every 100us, so the second changes every 10000 lines */
+static double run(const char* name, void (*format)(FILE*, const struct csv_record*),
+		  struct csv_record* r, long lines)
+{
+	FILE* f = fopen("/dev/null", "w");
+	double start, secs;
+	long i;
+
+	if (f == NULL) {
+		perror("/dev/null");
+		exit(1);
+	}
+	setvbuf(f, out_buf, _IOFBF, sizeof(out_buf));
+
+	r->ts.tv_sec = 1500000000;
+	r->ts.tv_nsec = 0;
+
+	start = bench_now();
+	for (i = 0; i < lines; i++) {
+		r->ts.tv_nsec += 100000;
+		if (r->ts.tv_nsec >= 1000000000) {
+			r->ts.tv_nsec = 0;
+			r->ts.tv_sec++;
+		}
+		r->tsf += 100;
+		r->ta[5] = i;
+		format(f, r);
+	}
+	fflush(f);
+	secs = bench_now() - start;
+	fclose(f);
+
+	printf("%-5s %10.0f lines/s  %6.1f ns/line\n", name, lines / secs,
+	       secs * 1e9 / lines);
+	return lines / secs;
+}
+
+int main(int argc, char** argv)
+{
+	long lines = bench_arg(argc, argv, 1, 2000000);
+	struct csv_record r;
+	double old, new;
+
+	memset(&r, 0, sizeof(r));
+	r.type = WLAN_FRAME_QDATA;
+	r.pkt_types = 0x3;
+	r.signal = -61;
+	r.len = 1536;
+	r.rate = 1300;
+	r.freq = 5180;
+	r.mode = WLAN_MODE_STA;
+	r.channel = 36;
+	r.rsn = 1;
+	r.ip_src = 0x0a01a8c0;	/* 192.168.1.10 */
+	r.ip_dst = 0xfe01a8c0;	/* 192.168.1.254 */
+	memcpy(r.ta, "\x00\x1b\x2c\x3d\x4e\x00", WLAN_MAC_LEN);
+	memcpy(r.ra, "\x00\x1b\x2c\x3d\x4e\xff", WLAN_MAC_LEN);
+	memcpy(r.bssid, r.ra, WLAN_MAC_LEN);
+	strcpy(r.essid, "example-network");
+
+	printf("%ld lines\n", lines);
+	old = run("old", old_format, &r, lines);
+	new = run("new", new_format, &r, lines);
+	printf("speedup %.1fx\n", new / old);
+	return 0;
+}
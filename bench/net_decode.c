@@ -0,0 +1,231 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Client side decoding of packet infos: records per second thru
+ * net_rx_receive(), from the socket to the packet callback, for version 4
+ * and compact version 5 packet infos.
+ *
+ * Usage: net_decode [records] [port]
+ *
+ * The stream is recorded once from a real server on the loopback interface
+ * (on the given port, 4440 by default) with 100000 packets of 1000 stations,
+ * then replayed thru a socket pair to a new receive state until the given
+ * number of records (5 million by default) was decoded. Configuration
+ * messages in the stream are passed to a callback which does nothing, like
+ * in the collector threads.
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <uwifi/wlan_parser.h>
+
+#include "../main.h"
+#include "../event.h"
+#include "../network.h"
+#include "bench.h"
+
+#define STREAM_PACKETS	100000
+#define STREAM_NODES	1000
+#define MAX_RECORD	256	/* more than any packet info */
+#define CHUNK		(32 * 1024)
+
+static unsigned long decoded;
+
+static void count_packet(__attribute__((unused)) struct uwifi_packet* p,
+			 __attribute__((unused)) void* ctx)
+{
+	decoded++;
+}
+
+static void ignore_message(__attribute__((unused)) unsigned char* buf,
+			   __attribute__((unused)) size_t len,
+			   __attribute__((unused)) void* ctx)
+{
+}
+
+static void make_packet(struct uwifi_packet* p, int i)
+{
+	int node = (i * 7919) % STREAM_NODES;
+
+	bench_packet(p, node, 5180);
+	p->phy_signal -= i % 7;
+	p->wlan_len = 100 + (i % 1400);
+	p->wlan_seqno = i / STREAM_NODES;
+	p->wlan_tsf = 1000000 + i * 100;
+	p->wlan_channel = 36;
+
+	/* every tenth packet is a beacon of the AP */
+	if (i % 10 == 0) {
+		p->pkt_types = 0;
+		p->wlan_type = WLAN_FRAME_BEACON;
+		memcpy(p->wlan_ta, p->wlan_ra, WLAN_MAC_LEN);
+		memset(p->wlan_ra, 0xff, WLAN_MAC_LEN);
+		p->wlan_mode = WLAN_MODE_AP;
+		p->wlan_bintval = 100;
+		strcpy(p->wlan_essid, "example-network");
+	}
+}
+
+static void event_once(void)
+{
+	event_dispatch(event_wait());
+}
+
+static size_t drain(int fd, unsigned char* buf, size_t len)
+{
+	ssize_t ret;
+	size_t got = 0;
+
+	while ((ret = recv(fd, buf + got, len - got, MSG_DONTWAIT)) > 0)
+		got += ret;
+	return got;
+}
+
+/* the stream which a client gets from the server, with a collector's
+ * hello if 'compact' */
+static size_t record_stream(int port, bool compact, unsigned char* buf, size_t size)
+{
+	struct sockaddr_in sin;
+	struct uwifi_packet p;
+	int clients = net_num_clients;
+	size_t len = 0;
+	int fd, i;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*)&sin, sizeof(sin)) < 0) {
+		perror("connect");
+		exit(1);
+	}
+	while (net_num_clients == clients)
+		event_once();
+
+	if (compact) {
+		net_send_collector_hello(fd);
+		event_once();
+	}
+
+	/* with server_flush 0 every packet is sent directly, so the socket
+	 * never fills up as long as we read it after every packet */
+	for (i = 0; i < STREAM_PACKETS; i++) {
+		make_packet(&p, i);
+		net_send_packet(&p);
+		len += drain(fd, buf + len, size - len);
+	}
+
+	close(fd);
+	while (net_num_clients != clients)
+		event_once();
+	return len;
+}
+
+static double run(const char* name, const unsigned char* stream, size_t len,
+		  unsigned long records)
+{
+	struct net_rx rx;
+	double start, secs;
+	unsigned long passes = 0;
+	int sv[2];
+	size_t pos;
+	ssize_t ret;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		exit(1);
+	}
+
+	/* net_rx takes the hello as the answer of a server in client mode */
+	strcpy(conf.serveraddr, "bench");
+	decoded = 0;
+
+	start = bench_now();
+	while (decoded < records) {
+		if (!net_rx_init(&rx))
+			exit(1);
+		rx.packet_cb = count_packet;
+		rx.message_cb = ignore_message;
+		rx.ctx = NULL;
+
+		for (pos = 0; pos < len; pos += ret) {
+			ret = send(sv[0], stream + pos, MIN(len - pos, CHUNK), 0);
+			if (ret < 0) {
+				perror("send");
+				exit(1);
+			}
+			net_rx_receive(sv[1], &rx);
+		}
+		net_rx_free(&rx);
+		passes++;
+	}
+	secs = bench_now() - start;
+
+	conf.serveraddr[0] = '\0';
+	close(sv[0]);
+	close(sv[1]);
+
+	if (decoded != passes * STREAM_PACKETS) {
+		fprintf(stderr, "%s: decoded %lu of %lu records\n", name, decoded,
+			passes * STREAM_PACKETS);
+		exit(1);
+	}
+
+	printf("%-3s %6.1f bytes/record %6.2f M records/s %6.1f ns/record\n", name,
+	       (double)len / STREAM_PACKETS, decoded / secs / 1e6, secs * 1e9 / decoded);
+	return decoded / secs;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned long records = bench_arg(argc, argv, 1, 5000000);
+	int port = bench_arg(argc, argv, 2, 4440);
+	size_t size = STREAM_PACKETS * MAX_RECORD;
+	unsigned char* v4 = malloc(size);
+	unsigned char* v5 = malloc(size);
+	size_t v4_len, v5_len;
+
+	if (v4 == NULL || v5 == NULL)
+		return 1;
+
+	bench_init(NULL, 0);
+	conf.server_flush = 0;
+	conf.server_batch = 16384;
+	conf.server_sample_max = 1;
+	event_init();
+	net_init_server_socket(port);
+
+	v4_len = record_stream(port, false, v4, size);
+	v5_len = record_stream(port, true, v5, size);
+	net_finish();
+
+	printf("%lu records\n", records);
+	run("v4", v4, v4_len, records);
+	run("v5", v5, v5_len, records);
+	return 0;
+}
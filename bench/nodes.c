@@ -0,0 +1,138 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Cost of nodes_timeout() once per second with many nodes, where the
+ * chan_nodes of nodes which time out are found in the timing wheel.
+ *
+ * Usage: nodes [seconds] [nodes...]
+ *
+ * For every number of nodes (50000 by default) every node sends a packet
+ * once per node_timeout (60s), on one of three channels, and from the
+ * second node_timeout on 100 of them stop every second and are replaced by
+ * new ones. From the third node_timeout the same number of nodes times out
+ * every second, so the cost per second should stay the same over time and
+ * not depend on the number of nodes. The seconds in which libuwifi walks
+ * its node list (once per node_timeout) are shown separately.
+ *
+ * Time runs 150 seconds by default, not in real time, and the packets are
+ * not measured. They take most of the run time, because libuwifi searches
+ * its node list for every packet.
+ */
+
+#include "bench.h"
+
+#define NODE_TIMEOUT	60
+#define CHURN		100	/* nodes replaced per second */
+
+static const int freqs[] = { 2412, 2437, 2462 };
+
+static void send_packet(unsigned int id)
+{
+	struct uwifi_packet p;
+
+	bench_packet(&p, id, freqs[id % 3]);
+	handle_packet(&p, NULL, 0, NULL);
+}
+
+static int cmp_double(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void run(int seconds, unsigned int nodes)
+{
+	unsigned int* live = malloc(nodes * sizeof(*live));
+	double* ticks = malloc(seconds * sizeof(*ticks));
+	unsigned int next_id = nodes, i, replaced;
+	int sec, num_ticks = 0, num_walks = 0;
+	double start, secs, walks = 0;
+	time_t last_walk;
+
+	if (live == NULL || ticks == NULL)
+		exit(1);
+
+	free_lists();
+	init_spectrum();
+	conf.intf.last_nodetimeout = time_mono.tv_sec;
+
+	for (i = 0; i < nodes; i++)
+		live[i] = i;
+
+	for (sec = 0; sec < seconds; sec++) {
+		time_mono.tv_sec++;
+
+		/* the nodes whose turn it is, some of them replaced */
+		replaced = 0;
+		for (i = sec % NODE_TIMEOUT; i < nodes; i += NODE_TIMEOUT) {
+			if (sec >= NODE_TIMEOUT && replaced < CHURN) {
+				live[i] = next_id++;
+				replaced++;
+			}
+			send_packet(live[i]);
+		}
+
+		last_walk = conf.intf.last_nodetimeout;
+		start = bench_now();
+		nodes_timeout();
+		secs = bench_now() - start;
+
+		if (conf.intf.last_nodetimeout != last_walk) {
+			walks += secs;
+			num_walks++;
+		} else if (sec >= 2 * NODE_TIMEOUT) /* nodes time out */
+			ticks[num_ticks++] = secs;
+	}
+
+	if (num_ticks == 0)
+		printf("%6u nodes: run for more than %d seconds\n", nodes, 2 * NODE_TIMEOUT);
+	else {
+		qsort(ticks, num_ticks, sizeof(*ticks), cmp_double);
+		printf("%6u nodes, %6u chan_nodes: median %6.1f us  max %6.1f us",
+		       nodes, chan_node_pool.used, ticks[num_ticks / 2] * 1e6,
+		       ticks[num_ticks - 1] * 1e6);
+		if (num_walks > 0)
+			printf("  with libuwifi walk %8.1f us", walks / num_walks * 1e6);
+		printf("\n");
+	}
+
+	free(live);
+	free(ticks);
+}
+
+int main(int argc, char** argv)
+{
+	int seconds = bench_arg(argc, argv, 1, 2 * NODE_TIMEOUT + 30);
+	int i;
+
+	bench_init(freqs, 3);
+	conf.node_timeout = NODE_TIMEOUT;
+	conf.node_max = 0;
+
+	printf("nodes_timeout() per second, %d seconds, %d nodes replaced per second\n",
+	       seconds, CHURN);
+	if (argc > 2) {
+		for (i = 2; i < argc; i++)
+			run(seconds, atoi(argv[i]));
+	} else
+		run(seconds, 50000);
+	return 0;
+}
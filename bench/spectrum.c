@@ -0,0 +1,89 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Per packet cost of handle_packet() with many nodes on one channel, where
+ * update_spectrum() has to find the chan_node of the packet's node.
+ *
+ * Usage: spectrum [packets] [nodes...]
+ *
+ * For every number of nodes (1000, 5000 and 20000 by default), all nodes
+ * are first seen on one channel and then on a second one in reverse order.
+ * Then the packets (5 million by default) come from the 64 nodes which
+ * were seen first, on the second channel. libuwifi finds these nodes at
+ * the start of its node list, but they are at the end of the channel's
+ * list, so this shows how the time to find the chan_node depends on the
+ * number of nodes on the channel. It should stay the same.
+ */
+
+#include "bench.h"
+
+#define FREQ_A		2412
+#define FREQ_B		2437
+#define HOT_NODES	64
+
+static void run(long packets, int nodes)
+{
+	struct uwifi_packet p;
+	double start, secs;
+	long i;
+	int n;
+
+	free_lists();
+	init_spectrum();
+
+	for (n = 0; n < nodes; n++) {
+		bench_packet(&p, n, FREQ_B);
+		handle_packet(&p, NULL, 0, NULL);
+	}
+	for (n = nodes - 1; n >= 0; n--) {
+		bench_packet(&p, n, FREQ_A);
+		handle_packet(&p, NULL, 0, NULL);
+	}
+
+	start = bench_now();
+	for (i = 0; i < packets; i++) {
+		bench_packet(&p, i % HOT_NODES, FREQ_A);
+		handle_packet(&p, NULL, 0, NULL);
+	}
+	secs = bench_now() - start;
+
+	printf("%6d nodes on the channel %7.1f ns/packet\n",
+	       spectrum[0].num_nodes, secs * 1e9 / packets);
+}
+
+int main(int argc, char** argv)
+{
+	static const int freqs[] = { FREQ_A, FREQ_B };
+	long packets = bench_arg(argc, argv, 1, 5000000);
+	int i;
+
+	bench_init(freqs, 2);
+
+	printf("%ld packets\n", packets);
+	if (argc > 2) {
+		for (i = 2; i < argc; i++)
+			run(packets, atoi(argv[i]));
+	} else {
+		run(packets, 1000);
+		run(packets, 5000);
+		run(packets, 20000);
+	}
+	return 0;
+}
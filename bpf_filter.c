@@ -0,0 +1,389 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <net/if_arp.h>
+#include <linux/filter.h>
+
+#include <uwifi/util.h>
+#include <uwifi/log.h>
+
+#include "main.h"
+#include "bpf_filter.h"
+
+/*
+ * Kernel socket filter
+ *
+ * We compile the parts of the filter configuration which can be checked by
+ * looking at fixed offsets of the 802.11 header (frame type and subtype,
+ * BSSID, transmitter MAC and bad FCS) into a classic BPF program, so that the
+ * kernel drops those frames before they are copied to us. The kernel filter
+ * must never drop a frame which filter_packet() would accept, so where it
+ * can not be sure it lets the frame pass. filter_packet() still runs on all
+ * frames and handles everything else (mode, higher level packet types).
+ */
+
+#define BPF_MAX_INSN		256
+#define BPF_MAX_LABEL		64
+#define BPF_ACCEPT_LEN		0x40000
+
+/* radiotap */
+#define RT_PRESENT_TSFT		0x01
+#define RT_PRESENT_FLAGS	0x02
+#define RT_PRESENT_EXT		0x80	/* in last byte of present word */
+#define RT_FLAG_BADFCS		0x40
+#define RT_MAX_PRESENT		4
+
+struct bpf_asm {
+	struct sock_filter	insn[BPF_MAX_INSN];
+	int			jt[BPF_MAX_INSN];	/* label ids */
+	int			jf[BPF_MAX_INSN];
+	int			label[BPF_MAX_LABEL];	/* label positions */
+	int			len;
+	int			labels;
+	bool			overflow;
+};
+
+static int filter_fd = -1;
+static bool filter_attached;
+
+/* label 0 is "next instruction" */
+static int bpf_label_new(struct bpf_asm* b)
+{
+	if (b->labels >= BPF_MAX_LABEL - 1) {
+		b->overflow = true;
+		return 0;
+	}
+	return ++b->labels;
+}
+
+static void bpf_label_set(struct bpf_asm* b, int l)
+{
+	b->label[l] = b->len;
+}
+
+static void bpf_jump(struct bpf_asm* b, uint16_t code, uint32_t k, int jt, int jf)
+{
+	if (b->len >= BPF_MAX_INSN) {
+		b->overflow = true;
+		return;
+	}
+	b->insn[b->len].code = code;
+	b->insn[b->len].k = k;
+	b->jt[b->len] = jt;
+	b->jf[b->len] = jf;
+	b->len++;
+}
+
+static void bpf_stmt(struct bpf_asm* b, uint16_t code, uint32_t k)
+{
+	bpf_jump(b, code, k, 0, 0);
+}
+
+/* unconditional jump to label */
+static void bpf_goto(struct bpf_asm* b, int l)
+{
+	bpf_jump(b, BPF_JMP | BPF_JA, 0, l, 0);
+}
+
+static bool bpf_resolve(struct bpf_asm* b)
+{
+	int i, jt, jf;
+
+	if (b->overflow)
+		return false;
+
+	for (i = 0; i < b->len; i++) {
+		if (BPF_CLASS(b->insn[i].code) != BPF_JMP)
+			continue;
+		jt = b->jt[i] ? b->label[b->jt[i]] - (i + 1) : 0;
+		jf = b->jf[i] ? b->label[b->jf[i]] - (i + 1) : 0;
+		if (jt < 0 || jf < 0)
+			return false;
+		if (BPF_OP(b->insn[i].code) == BPF_JA) {
+			b->insn[i].k = jt;
+			continue;
+		}
+		if (jt > 255 || jf > 255)
+			return false;
+		b->insn[i].jt = jt;
+		b->insn[i].jf = jf;
+	}
+	return true;
+}
+
+/* the first 4 bytes as big endian word and the last 2 as halfword,
+ * the way BPF loads them */
+static uint32_t mac_word(const unsigned char* mac)
+{
+	return (uint32_t)mac[0] << 24 | mac[1] << 16 | mac[2] << 8 | mac[3];
+}
+
+static uint32_t mac_half(const unsigned char* mac)
+{
+	return mac[4] << 8 | mac[5];
+}
+
+/*
+ * Find the radiotap flags field and check for bad FCS. The flags field
+ * follows the present words and the TSFT field (which is 8 byte aligned)
+ * if that is present. We check up to RT_MAX_PRESENT present words, if there
+ * are more we accept the frame and let userspace decide.
+ * Continues at label 'good' for frames which do not have a bad FCS.
+ */
+static void compile_badfcs(struct bpf_asm* b, int accept, int reject, int good)
+{
+	int present[RT_MAX_PRESENT], notsf[RT_MAX_PRESENT];
+	int fcs = bpf_label_new(b);
+	int i, data;
+
+	for (i = 0; i < RT_MAX_PRESENT; i++) {
+		present[i] = bpf_label_new(b);
+		notsf[i] = bpf_label_new(b);
+	}
+
+	bpf_stmt(b, BPF_LD | BPF_B | BPF_ABS, 4);
+	bpf_jump(b, BPF_JMP | BPF_JSET | BPF_K, RT_PRESENT_FLAGS, 0, good);
+
+	/* count present words */
+	for (i = 0; i < RT_MAX_PRESENT; i++) {
+		bpf_stmt(b, BPF_LD | BPF_B | BPF_ABS, 7 + 4 * i);
+		bpf_jump(b, BPF_JMP | BPF_JSET | BPF_K, RT_PRESENT_EXT,
+			 i < RT_MAX_PRESENT - 1 ? 0 : accept, present[i]);
+	}
+
+	/* load flags field */
+	for (i = 0; i < RT_MAX_PRESENT; i++) {
+		data = 8 + 4 * i;
+		bpf_label_set(b, present[i]);
+		bpf_stmt(b, BPF_LD | BPF_B | BPF_ABS, 4);
+		bpf_jump(b, BPF_JMP | BPF_JSET | BPF_K, RT_PRESENT_TSFT, 0, notsf[i]);
+		bpf_stmt(b, BPF_LD | BPF_B | BPF_ABS, ((data + 7) & ~7) + 8);
+		bpf_goto(b, fcs);
+		bpf_label_set(b, notsf[i]);
+		bpf_stmt(b, BPF_LD | BPF_B | BPF_ABS, data);
+		bpf_goto(b, fcs);
+	}
+
+	bpf_label_set(b, fcs);
+	bpf_jump(b, BPF_JMP | BPF_JSET | BPF_K, RT_FLAG_BADFCS,
+		 conf.filter_badfcs ? accept : reject, good);
+}
+
+/* frame type and subtype (first byte of frame control) */
+static void compile_stype(struct bpf_asm* b, int reject)
+{
+	int type[WLAN_NUM_TYPES];
+	int ok = bpf_label_new(b);
+	int t, i;
+
+	for (t = 0; t < WLAN_NUM_TYPES; t++)
+		type[t] = bpf_label_new(b);
+
+	bpf_stmt(b, BPF_LD | BPF_B | BPF_IND, 0);
+	bpf_stmt(b, BPF_ALU | BPF_AND | BPF_K, 0x0c);
+	for (t = 0; t < WLAN_NUM_TYPES; t++)
+		bpf_jump(b, BPF_JMP | BPF_JEQ | BPF_K, t << 2, type[t], 0);
+	bpf_goto(b, reject); /* type 3 is not defined */
+
+	for (t = 0; t < WLAN_NUM_TYPES; t++) {
+		bpf_label_set(b, type[t]);
+		if (conf.filter_stype[t] == 0xffff) {
+			bpf_goto(b, ok);
+			continue;
+		}
+		if (conf.filter_stype[t] != 0) {
+			bpf_stmt(b, BPF_LD | BPF_B | BPF_IND, 0);
+			bpf_stmt(b, BPF_ALU | BPF_RSH | BPF_K, 4);
+			for (i = 0; i < WLAN_NUM_STYPES; i++) {
+				if (conf.filter_stype[t] & BIT(i))
+					bpf_jump(b, BPF_JMP | BPF_JEQ | BPF_K, i, ok, 0);
+			}
+		}
+		bpf_goto(b, reject);
+	}
+
+	bpf_label_set(b, ok);
+}
+
+/* A = length of 802.11 frame */
+static void compile_wlan_len(struct bpf_asm* b)
+{
+	bpf_stmt(b, BPF_LD | BPF_W | BPF_LEN, 0);
+	bpf_stmt(b, BPF_ALU | BPF_SUB | BPF_X, 0);
+}
+
+/* BSSID can be any of the first three addresses, depending on frame type
+ * and DS bits. To be safe we accept the frame if any of them matches */
+static void compile_bssid(struct bpf_asm* b, int reject)
+{
+	static const int off[3] = { 4, 10, 16 };
+	int ok = bpf_label_new(b);
+	int next, i;
+
+	for (i = 0; i < 3; i++) {
+		next = bpf_label_new(b);
+		compile_wlan_len(b);
+		bpf_jump(b, BPF_JMP | BPF_JGE | BPF_K, off[i] + WLAN_MAC_LEN, 0, reject);
+		bpf_stmt(b, BPF_LD | BPF_W | BPF_IND, off[i]);
+		bpf_jump(b, BPF_JMP | BPF_JEQ | BPF_K, mac_word(conf.filterbssid), 0, next);
+		bpf_stmt(b, BPF_LD | BPF_H | BPF_IND, off[i] + 4);
+		bpf_jump(b, BPF_JMP | BPF_JEQ | BPF_K, mac_half(conf.filterbssid), ok, next);
+		bpf_label_set(b, next);
+	}
+	bpf_goto(b, reject);
+
+	bpf_label_set(b, ok);
+}
+
+/* transmitter address is always the second address */
+static void compile_ta(struct bpf_asm* b, int reject)
+{
+	int ok = bpf_label_new(b);
+	int next, i;
+
+	compile_wlan_len(b);
+	bpf_jump(b, BPF_JMP | BPF_JGE | BPF_K, 10 + WLAN_MAC_LEN, 0, reject);
+
+	for (i = 0; i < MAX_FILTERMAC; i++) {
+		if (!conf.filtermac_enabled[i])
+			continue;
+		next = bpf_label_new(b);
+		bpf_stmt(b, BPF_LD | BPF_W | BPF_IND, 10);
+		bpf_jump(b, BPF_JMP | BPF_JEQ | BPF_K, mac_word(conf.filtermac[i]), 0, next);
+		bpf_stmt(b, BPF_LD | BPF_H | BPF_IND, 14);
+		bpf_jump(b, BPF_JMP | BPF_JEQ | BPF_K, mac_half(conf.filtermac[i]), ok, next);
+		bpf_label_set(b, next);
+	}
+	bpf_goto(b, reject);
+
+	bpf_label_set(b, ok);
+}
+
+static bool filter_needed(void)
+{
+	int i;
+
+	if (conf.filter_off)
+		return false;
+
+	for (i = 0; i < WLAN_NUM_TYPES; i++)
+		if (conf.filter_stype[i] != 0xffff)
+			return true;
+
+	return !conf.filter_badfcs || MAC_NOT_EMPTY(conf.filterbssid) ||
+		conf.do_macfilter;
+}
+
+static bool filter_compile(struct bpf_asm* b)
+{
+	int accept = bpf_label_new(b);
+	int reject = bpf_label_new(b);
+	int hdr = bpf_label_new(b);
+
+	switch (conf.intf.arphdr) {
+	case ARPHRD_IEEE80211_RADIOTAP:
+		compile_badfcs(b, accept, reject, hdr);
+		bpf_label_set(b, hdr);
+		/* X = radiotap header length (little endian) */
+		bpf_stmt(b, BPF_LD | BPF_B | BPF_ABS, 3);
+		bpf_stmt(b, BPF_ALU | BPF_LSH | BPF_K, 8);
+		bpf_stmt(b, BPF_MISC | BPF_TAX, 0);
+		bpf_stmt(b, BPF_LD | BPF_B | BPF_ABS, 2);
+		bpf_stmt(b, BPF_ALU | BPF_OR | BPF_X, 0);
+		bpf_stmt(b, BPF_MISC | BPF_TAX, 0);
+		break;
+	case ARPHRD_IEEE80211:
+		/* no FCS information, nothing to skip */
+		bpf_label_set(b, hdr);
+		bpf_stmt(b, BPF_LDX | BPF_W | BPF_IMM, 0);
+		break;
+	default:
+		/* prism header: leave it to userspace */
+		return false;
+	}
+
+	compile_stype(b, reject);
+
+	if (MAC_NOT_EMPTY(conf.filterbssid))
+		compile_bssid(b, reject);
+
+	if (conf.do_macfilter)
+		compile_ta(b, reject);
+
+	bpf_label_set(b, accept);
+	bpf_stmt(b, BPF_RET | BPF_K, BPF_ACCEPT_LEN);
+	bpf_label_set(b, reject);
+	bpf_stmt(b, BPF_RET | BPF_K, 0);
+
+	return bpf_resolve(b);
+}
+
+static void filter_detach(void)
+{
+	int dummy = 0;
+
+	if (!filter_attached)
+		return;
+
+	setsockopt(filter_fd, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(dummy));
+	filter_attached = false;
+	LOG_DBG("BPF filter detached");
+}
+
+void bpf_filter_update(void)
+{
+	struct bpf_asm b;
+	struct sock_fprog prog;
+
+	if (filter_fd < 0)
+		return;
+
+	if (!filter_needed()) {
+		filter_detach();
+		return;
+	}
+
+	memset(&b, 0, sizeof(b));
+	if (!filter_compile(&b)) {
+		LOG_DBG("BPF filter not possible");
+		filter_detach();
+		return;
+	}
+
+	prog.len = b.len;
+	prog.filter = b.insn;
+
+	if (setsockopt(filter_fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+		LOG_ERR("Could not attach BPF filter (%s)", strerror(errno));
+		filter_detach();
+		return;
+	}
+
+	filter_attached = true;
+	LOG_DBG("BPF filter attached (%d instructions)", b.len);
+}
+
+void bpf_filter_init(int fd)
+{
+	filter_fd = fd;
+	bpf_filter_update();
+}
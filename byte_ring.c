@@ -0,0 +1,103 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#define _GNU_SOURCE	/* for syscall() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <uwifi/log.h>
+
+#include "byte_ring.h"
+
+/* anonymous file for the memory of the ring */
+static int ring_file(size_t size)
+{
+	char name[] = "/tmp/horst-ring-XXXXXX";
+	int fd = -1;
+
+#ifdef SYS_memfd_create
+	fd = syscall(SYS_memfd_create, "horst-ring", 0);
+#endif
+	if (fd < 0) {
+		/* kernels before 3.17 */
+		fd = mkstemp(name);
+		if (fd < 0)
+			return -1;
+		unlink(name);
+	}
+
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool byte_ring_init(struct byte_ring* r, size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	unsigned char* addr;
+	int fd;
+
+	size = (size + page - 1) / page * page;
+	r->buf = NULL;
+	r->size = size;
+	r->head = 0;
+	r->tail = 0;
+
+	fd = ring_file(size);
+	if (fd < 0) {
+		LOG_ERR("Could not create ring buffer (%s)", strerror(errno));
+		return false;
+	}
+
+	/* reserve space for both copies, then map the file twice into it */
+	addr = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		goto fail;
+
+	if (mmap(addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+		 fd, 0) == MAP_FAILED ||
+	    mmap(addr + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+		 fd, 0) == MAP_FAILED) {
+		munmap(addr, 2 * size);
+		goto fail;
+	}
+
+	close(fd);
+	r->buf = addr;
+	return true;
+
+fail:
+	LOG_ERR("Could not map ring buffer (%s)", strerror(errno));
+	close(fd);
+	return false;
+}
+
+void byte_ring_free(struct byte_ring* r)
+{
+	if (r->buf != NULL)
+		munmap(r->buf, 2 * r->size);
+	r->buf = NULL;
+}
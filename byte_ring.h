@@ -0,0 +1,79 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _BYTE_RING_H_
+#define _BYTE_RING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Ring buffer of bytes for a stream of messages.
+ *
+ * The memory of the ring is mapped twice, one copy directly after the other,
+ * so the used and the free part of the ring are always contiguous in memory,
+ * even when they wrap around the end. Messages can be received with one
+ * recv() and parsed in place, or queued and sent with one send(), without
+ * copying or moving them.
+ */
+struct byte_ring {
+	unsigned char*	buf;
+	size_t		size;		/* multiple of the page size */
+	size_t		head;		/* write position */
+	size_t		tail;		/* read position */
+};
+
+bool byte_ring_init(struct byte_ring* r, size_t size);
+void byte_ring_free(struct byte_ring* r);
+
+static inline size_t byte_ring_used(const struct byte_ring* r)
+{
+	return r->head - r->tail;
+}
+
+static inline size_t byte_ring_space(const struct byte_ring* r)
+{
+	return r->size - byte_ring_used(r);
+}
+
+/* the used bytes, contiguous */
+static inline unsigned char* byte_ring_read_ptr(const struct byte_ring* r)
+{
+	return r->buf + r->tail % r->size;
+}
+
+/* the free space, contiguous */
+static inline unsigned char* byte_ring_write_ptr(const struct byte_ring* r)
+{
+	return r->buf + r->head % r->size;
+}
+
+static inline void byte_ring_consume(struct byte_ring* r, size_t len)
+{
+	r->tail += len;
+	if (r->tail == r->head)
+		r->tail = r->head = 0;
+}
+
+static inline void byte_ring_produce(struct byte_ring* r, size_t len)
+{
+	r->head += len;
+}
+
+#endif
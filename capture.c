@@ -0,0 +1,532 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#define _GNU_SOURCE	/* for recvmmsg() */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/if_packet.h>
+
+#include <uwifi/util.h>
+#include <uwifi/log.h>
+#include <uwifi/packet_sock.h>
+
+#include "main.h"
+#include "capture.h"
+#include "spsc_ring.h"
+#include "protocol_parser.h"
+
+int capture_event_fd = -1;
+
+static void capture_packet(unsigned char* buf, size_t len,
+			   const struct timespec* ts);
+
+static bool thread_running;
+
+/* The receive functions run on the capture thread if it is used, so they
+ * don't touch stats directly. They count here with atomic operations and the
+ * main thread adds the counters to stats in capture_stats_collect() */
+static struct {
+	unsigned long	ring_packets;
+	unsigned long	ring_drops;
+	unsigned long	ring_freezes;
+	unsigned long	batch_hist[MAX_BATCH_HIST];
+	unsigned long	queue_drops;
+} cap_stats;
+
+#define CAP_STATS_ADD(_x, _n)	__atomic_add_fetch(&cap_stats._x, (_n), __ATOMIC_RELAXED)
+#define CAP_STATS_TAKE(_x)	__atomic_exchange_n(&cap_stats._x, 0, __ATOMIC_RELAXED)
+
+static void capture_stats_collect(void)
+{
+	int i;
+
+	stats.ring_packets += CAP_STATS_TAKE(ring_packets);
+	stats.ring_drops += CAP_STATS_TAKE(ring_drops);
+	stats.ring_freezes += CAP_STATS_TAKE(ring_freezes);
+	stats.queue_drops += CAP_STATS_TAKE(queue_drops);
+	for (i = 0; i < MAX_BATCH_HIST; i++)
+		stats.batch_hist[i] += CAP_STATS_TAKE(batch_hist[i]);
+}
+
+/*
+ * Memory mapped TPACKET_V3 receive ring
+ *
+ * The kernel fills frames into blocks of the ring and "retires" a block to
+ * userspace when it is full or when the retire timeout expires. We then walk
+ * all frames of the block, parse and handle them in place (without copying)
+ * and hand the block back to the kernel.
+ */
+
+static int ring_fd = -1;
+static unsigned char* ring;
+static size_t ring_len;
+static unsigned int ring_block_size;
+static unsigned int ring_block_nr;
+static unsigned int ring_block_cur;
+static time_t ring_stats_time;
+
+bool capture_ring_init(int fd)
+{
+	struct tpacket_req3 req;
+	int ver = TPACKET_V3;
+	unsigned int pagesize = getpagesize();
+
+	/* block size has to be a multiple of the page size */
+	ring_block_size = conf.ring_block_size;
+	if (ring_block_size < pagesize)
+		ring_block_size = pagesize;
+	if (ring_block_size % pagesize)
+		ring_block_size += pagesize - ring_block_size % pagesize;
+	ring_block_nr = conf.ring_blocks > 0 ? conf.ring_blocks : 1;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) < 0) {
+		LOG_ERR("Could not set TPACKET_V3 (%s)", strerror(errno));
+		return false;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = ring_block_size;
+	req.tp_block_nr = ring_block_nr;
+	/* frames are variable size in V3, this is only used for sanity checks */
+	req.tp_frame_size = 2048;
+	req.tp_frame_nr = ring_block_size / req.tp_frame_size * ring_block_nr;
+	req.tp_retire_blk_tov = conf.ring_timeout;
+	req.tp_feature_req_word = 0;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		LOG_ERR("Could not set up RX ring (%s)", strerror(errno));
+		return false;
+	}
+
+	ring_len = (size_t)ring_block_size * ring_block_nr;
+	ring = mmap(NULL, ring_len, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_LOCKED, fd, 0);
+	if (ring == MAP_FAILED) {
+		/* MAP_LOCKED may fail because of RLIMIT_MEMLOCK, try without */
+		ring = mmap(NULL, ring_len, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, fd, 0);
+	}
+	if (ring == MAP_FAILED) {
+		LOG_ERR("Could not mmap RX ring (%s)", strerror(errno));
+		ring = NULL;
+		return false;
+	}
+
+	ring_fd = fd;
+	ring_block_cur = 0;
+
+	LOG_INF("Using RX ring: %u blocks of %u bytes, timeout %u ms",
+		ring_block_nr, ring_block_size, conf.ring_timeout);
+	return true;
+}
+
+static void capture_ring_walk_block(struct tpacket_block_desc* bd)
+{
+	struct tpacket3_hdr* ph;
+	struct timespec ts;
+	unsigned int i;
+
+	ph = (struct tpacket3_hdr*)((unsigned char*)bd +
+				    bd->hdr.bh1.offset_to_first_pkt);
+
+	for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+		ts.tv_sec = ph->tp_sec;
+		ts.tv_nsec = ph->tp_nsec;
+		capture_packet((unsigned char*)ph + ph->tp_mac, ph->tp_snaplen, &ts);
+		ph = (struct tpacket3_hdr*)((unsigned char*)ph + ph->tp_next_offset);
+	}
+}
+
+void capture_ring_receive(void)
+{
+	struct tpacket_block_desc* bd;
+	struct timespec now;
+	unsigned int n;
+
+	if (ring == NULL)
+		return;
+
+	/* handle at most one round of blocks, so we get back to the mainloop */
+	for (n = 0; n < ring_block_nr; n++) {
+		bd = (struct tpacket_block_desc*)(ring +
+			(size_t)ring_block_cur * ring_block_size);
+
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE)
+		      & TP_STATUS_USER))
+			break;
+
+		capture_ring_walk_block(bd);
+
+		/* give block back to kernel */
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+				 __ATOMIC_RELEASE);
+		ring_block_cur = (ring_block_cur + 1) % ring_block_nr;
+	}
+
+	/* update kernel drop counters about once per second. time_mono belongs
+	 * to the main thread, so we get our own time */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec != ring_stats_time) {
+		ring_stats_time = now.tv_sec;
+		capture_ring_update_stats();
+	}
+
+	if (!thread_running)
+		capture_stats_collect();
+}
+
+void capture_ring_update_stats(void)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+
+	if (ring_fd < 0)
+		return;
+
+	/* the kernel resets the counters on every read, so we add them up */
+	if (getsockopt(ring_fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0)
+		return;
+
+	CAP_STATS_ADD(ring_packets, st.tp_packets);
+	CAP_STATS_ADD(ring_drops, st.tp_drops);
+	CAP_STATS_ADD(ring_freezes, st.tp_freeze_q_cnt);
+}
+
+/*
+ * Batched receive with recvmmsg()
+ *
+ * Where the mmap ring is not available we can still save most of the system
+ * calls by receiving up to recv_batch packets at once into an array of
+ * preallocated buffers.
+ */
+
+static unsigned char* mmsg_buf;
+static struct iovec* mmsg_iov;
+static struct mmsghdr* mmsg_hdr;
+static unsigned char* mmsg_ctrl;
+static unsigned int mmsg_num;
+
+/* control buffer per message for the SO_TIMESTAMPNS receive time */
+#define MMSG_CTRL_LEN	CMSG_SPACE(sizeof(struct timespec))
+
+bool capture_mmsg_init(int fd)
+{
+	unsigned int i;
+	int on = 1;
+
+	mmsg_num = conf.recv_batch > 0 ? conf.recv_batch : 1;
+	mmsg_buf = malloc((size_t)mmsg_num * MAX_PACKET_LEN);
+	mmsg_iov = calloc(mmsg_num, sizeof(struct iovec));
+	mmsg_hdr = calloc(mmsg_num, sizeof(struct mmsghdr));
+	mmsg_ctrl = calloc(mmsg_num, MMSG_CTRL_LEN);
+	if (mmsg_buf == NULL || mmsg_iov == NULL || mmsg_hdr == NULL ||
+	    mmsg_ctrl == NULL) {
+		LOG_ERR("Could not allocate receive batch");
+		capture_finish();
+		return false;
+	}
+
+	for (i = 0; i < mmsg_num; i++) {
+		mmsg_iov[i].iov_base = mmsg_buf + (size_t)i * MAX_PACKET_LEN;
+		mmsg_iov[i].iov_len = MAX_PACKET_LEN;
+		mmsg_hdr[i].msg_hdr.msg_iov = &mmsg_iov[i];
+		mmsg_hdr[i].msg_hdr.msg_iovlen = 1;
+		mmsg_hdr[i].msg_hdr.msg_control = mmsg_ctrl + (size_t)i * MMSG_CTRL_LEN;
+	}
+
+	/* without it the packets of a batch get the time we received them */
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0)
+		LOG_ERR("Could not enable packet timestamps (%s)", strerror(errno));
+
+	LOG_INF("Using batched receive of up to %u packets", mmsg_num);
+	return true;
+}
+
+static void capture_batch_hist_add(unsigned int n)
+{
+	unsigned int i = 0;
+
+	while (n > 1 && i < MAX_BATCH_HIST - 1) {
+		n >>= 1;
+		i++;
+	}
+	CAP_STATS_ADD(batch_hist[i], 1);
+}
+
+static const struct timespec* capture_mmsg_timestamp(struct msghdr* mh)
+{
+	struct cmsghdr* cm;
+
+	for (cm = CMSG_FIRSTHDR(mh); cm != NULL; cm = CMSG_NXTHDR(mh, cm)) {
+		if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS)
+			return (const struct timespec*)CMSG_DATA(cm);
+	}
+	return NULL;
+}
+
+void capture_mmsg_receive(int fd)
+{
+	int ret, i;
+
+	/* the kernel changes the control length, reset it for every call */
+	for (i = 0; i < (int)mmsg_num; i++)
+		mmsg_hdr[i].msg_hdr.msg_controllen = MMSG_CTRL_LEN;
+
+	ret = recvmmsg(fd, mmsg_hdr, mmsg_num, MSG_DONTWAIT, NULL);
+	if (ret <= 0) {
+		LOG_DBG("recvmmsg error");
+		return;
+	}
+
+	capture_batch_hist_add(ret);
+
+	for (i = 0; i < ret; i++)
+		capture_packet(mmsg_iov[i].iov_base, mmsg_hdr[i].msg_len,
+			       capture_mmsg_timestamp(&mmsg_hdr[i].msg_hdr));
+
+	if (!thread_running)
+		capture_stats_collect();
+}
+
+/*
+ * Capture thread
+ *
+ * Optionally packets are received and parsed in a separate thread, which
+ * passes them to the main thread thru a bounded single producer, single
+ * consumer queue. The main thread does all the aggregation (nodes, ESSIDs,
+ * spectrum, statistics) and the display, so a slow terminal can not delay
+ * reading from the socket any more. When the queue is full packets are
+ * dropped and counted.
+ *
+ * The capture thread wakes up the main thread with an eventfd, but only if
+ * it is not already pending.
+ */
+
+static pthread_t capture_thread;
+static bool thread_stop;
+static bool notify_pending;
+static struct spsc_ring pkt_queue;
+static unsigned char thread_buf[MAX_PACKET_LEN];
+
+/* queue element: the parsed packet, its capture time and, only if it is
+ * needed for the pcap outfile, a copy of the original frame */
+struct queued_packet {
+	struct uwifi_packet	pkt;
+	struct timespec		ts;
+	unsigned int		raw_len;
+	unsigned char		raw[];
+};
+
+static size_t queue_raw_size;
+
+static void capture_queue_notify(void)
+{
+	uint64_t ev = 1;
+
+	if (__atomic_exchange_n(&notify_pending, true, __ATOMIC_SEQ_CST))
+		return;
+
+	/* EAGAIN means the counter is full, so it is readable anyway. On other
+	 * errors try again next time, we can't log from the capture thread */
+	if (write(capture_event_fd, &ev, sizeof(ev)) < 0 && errno != EAGAIN)
+		__atomic_store_n(&notify_pending, false, __ATOMIC_SEQ_CST);
+}
+
+static void capture_queue_packet(unsigned char* buf, size_t len,
+				 const struct timespec* ts)
+{
+	struct queued_packet* q = spsc_ring_write_slot(&pkt_queue);
+
+	if (q == NULL) {
+		CAP_STATS_ADD(queue_drops, 1);
+		return;
+	}
+
+	memset(&q->pkt, 0, sizeof(q->pkt));
+	if (!parse_packet(buf, len, &q->pkt))
+		return;
+
+	/* time_real belongs to the main thread and is only updated when it
+	 * wakes up, so it is too late for the packets of a batch */
+	if (ts != NULL)
+		q->ts = *ts;
+	else
+		clock_gettime(CLOCK_REALTIME, &q->ts);
+
+	q->raw_len = MIN(len, queue_raw_size);
+	if (q->raw_len > 0)
+		memcpy(q->raw, buf, q->raw_len);
+
+	spsc_ring_write_done(&pkt_queue);
+}
+
+static void capture_packet(unsigned char* buf, size_t len,
+			   const struct timespec* ts)
+{
+	if (thread_running)
+		capture_queue_packet(buf, len, ts);
+	else
+		handle_raw_packet(buf, len, ts);
+}
+
+static void* capture_thread_main(__attribute__((unused)) void* arg)
+{
+	struct pollfd pfd;
+	ssize_t len;
+
+	pfd.fd = conf.intf.sock;
+	pfd.events = POLLIN;
+
+	while (!__atomic_load_n(&thread_stop, __ATOMIC_RELAXED)) {
+		/* timeout to check for thread_stop */
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		if (conf.capture_mode == CAPTURE_RING)
+			capture_ring_receive();
+		else if (conf.capture_mode == CAPTURE_MMSG)
+			capture_mmsg_receive(conf.intf.sock);
+		else {
+			len = packet_socket_recv(conf.intf.sock, thread_buf,
+						 sizeof(thread_buf));
+			if (len > 0)
+				capture_queue_packet(thread_buf, len, NULL);
+		}
+
+		if (spsc_ring_count(&pkt_queue) > 0)
+			capture_queue_notify();
+	}
+	return NULL;
+}
+
+bool capture_thread_start(void)
+{
+	queue_raw_size = conf.outfile_format == OUTFILE_PCAP ? MAX_PACKET_LEN : 0;
+
+	/* keep elements aligned */
+	if (!spsc_ring_init(&pkt_queue, conf.capture_queue,
+			    (sizeof(struct queued_packet) + queue_raw_size + 7) & ~7)) {
+		LOG_ERR("Could not allocate capture queue");
+		return false;
+	}
+
+	capture_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (capture_event_fd < 0) {
+		LOG_ERR("Could not create eventfd (%s)", strerror(errno));
+		spsc_ring_free(&pkt_queue);
+		return false;
+	}
+
+	thread_running = true;
+	if (pthread_create(&capture_thread, NULL, capture_thread_main, NULL) != 0) {
+		LOG_ERR("Could not start capture thread");
+		thread_running = false;
+		close(capture_event_fd);
+		capture_event_fd = -1;
+		spsc_ring_free(&pkt_queue);
+		return false;
+	}
+
+	LOG_INF("Using capture thread, queue size %u", spsc_ring_size(&pkt_queue));
+	return true;
+}
+
+void capture_thread_stop(void)
+{
+	if (!thread_running)
+		return;
+
+	__atomic_store_n(&thread_stop, true, __ATOMIC_RELAXED);
+	pthread_join(capture_thread, NULL);
+	thread_running = false;
+	capture_stats_collect();
+
+	close(capture_event_fd);
+	capture_event_fd = -1;
+	spsc_ring_free(&pkt_queue);
+}
+
+/* called by main thread when capture_event_fd is readable */
+void capture_queue_process(void)
+{
+	struct queued_packet* q;
+	unsigned int n;
+	uint64_t ev;
+
+	if (read(capture_event_fd, &ev, sizeof(ev)) < 0 && errno != EAGAIN)
+		LOG_ERR("Could not read capture eventfd (%s)", strerror(errno));
+	__atomic_store_n(&notify_pending, false, __ATOMIC_SEQ_CST);
+
+	capture_stats_collect();
+
+	n = spsc_ring_count(&pkt_queue);
+	if (n > stats.queue_max)
+		stats.queue_max = n;
+
+	/* don't stay here forever, to get back to the mainloop */
+	for (n = 0; n < spsc_ring_size(&pkt_queue); n++) {
+		q = spsc_ring_read_slot(&pkt_queue);
+		if (q == NULL)
+			return;
+		handle_packet(&q->pkt, q->raw_len ? q->raw : NULL, q->raw_len,
+			      &q->ts);
+		spsc_ring_read_done(&pkt_queue);
+	}
+
+	/* more left, make sure we get called again */
+	capture_queue_notify();
+}
+
+unsigned int capture_queue_count(void)
+{
+	return thread_running ? spsc_ring_count(&pkt_queue) : 0;
+}
+
+unsigned int capture_queue_size(void)
+{
+	return thread_running ? spsc_ring_size(&pkt_queue) : 0;
+}
+
+void capture_finish(void)
+{
+	free(mmsg_buf);
+	free(mmsg_iov);
+	free(mmsg_hdr);
+	free(mmsg_ctrl);
+	mmsg_buf = NULL;
+	mmsg_iov = NULL;
+	mmsg_hdr = NULL;
+	mmsg_ctrl = NULL;
+
+	if (ring != NULL) {
+		munmap(ring, ring_len);
+		ring = NULL;
+	}
+	ring_fd = -1;
+}
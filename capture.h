@@ -0,0 +1,39 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdbool.h>
+
+extern int capture_event_fd;
+
+bool capture_ring_init(int fd);
+void capture_ring_receive(void);
+void capture_ring_update_stats(void);
+bool capture_mmsg_init(int fd);
+void capture_mmsg_receive(int fd);
+bool capture_thread_start(void);
+void capture_thread_stop(void);
+void capture_queue_process(void);
+unsigned int capture_queue_count(void);
+unsigned int capture_queue_size(void);
+void capture_finish(void);
+
+#endif
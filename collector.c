@@ -0,0 +1,548 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include <uwifi/util.h>
+#include <uwifi/log.h>
+#include <uwifi/average.h>
+
+#include "main.h"
+#include "network.h"
+#include "collector.h"
+#include "spsc_ring.h"
+#include "pool.h"
+#include "nodes.h"
+
+/*
+ * Collector mode
+ *
+ * When more than one server is given, horst connects to all of them (the
+ * sensors) and merges their packets into one view of nodes, ESSIDs and the
+ * spectrum. Every sensor has its own thread, which connects and reconnects,
+ * receives and decodes (and decompresses) the packet infos and passes them
+ * to the main thread thru a single producer, single consumer queue, like the
+ * capture thread. The main thread does the aggregation as usual and in
+ * addition keeps the signal of each node as seen by each sensor.
+ *
+ * Configuration messages (channel list, channel and filter settings) are
+ * passed to the main thread as well, but only the ones of one sensor are
+ * used, the first which is connected. Channel and filter changes are sent to
+ * all sensors.
+ */
+
+#define COLLECTOR_CONNECT_TIMEOUT	5	/* sec */
+#define COLLECTOR_RECONNECT_TIME	5	/* sec */
+/* largest configuration message, the channel list */
+#define COLLECTOR_MSG_MAX		512
+
+/* queue element: a packet or a configuration message */
+struct collector_item {
+	unsigned int		msg_len;	/* 0 for a packet */
+	unsigned int		sample;		/* sampling ratio of the packet */
+	union {
+		struct uwifi_packet	pkt;
+		unsigned char		msg[COLLECTOR_MSG_MAX];
+	};
+};
+
+struct sensor {
+	int			id;		/* 1 based, as shown */
+	char			host[MAX_CONF_VALUE_STRLEN + 1];
+	int			port;
+	pthread_t		thread;
+	/* protects fd, which the main thread uses to send the configuration */
+	pthread_mutex_t		lock;
+	int			fd;
+	bool			connected;	/* set by the thread */
+	bool			was_connected;	/* last state seen by the main thread */
+	unsigned int		connects;
+	unsigned long		packets;
+	unsigned long		drops;
+	struct net_rx		rx;
+	struct spsc_ring	queue;
+};
+
+static void sensor_nodes_init(void);
+static void sensor_nodes_free(void);
+
+static struct sensor sensors[MAX_SENSORS];
+static int num_sensors;
+static int primary = -1;	/* sensor of which we use the configuration */
+static bool thread_stop;
+static bool notify_pending;
+
+int collector_event_fd = -1;
+
+static void collector_notify(void)
+{
+	uint64_t ev = 1;
+
+	if (__atomic_exchange_n(&notify_pending, true, __ATOMIC_SEQ_CST))
+		return;
+
+	/* EAGAIN means the counter is full, so it is readable anyway. On other
+	 * errors try again next time, the threads can't log */
+	if (write(collector_event_fd, &ev, sizeof(ev)) < 0 && errno != EAGAIN)
+		__atomic_store_n(&notify_pending, false, __ATOMIC_SEQ_CST);
+}
+
+static void collector_queue_packet(struct uwifi_packet* p, void* ctx)
+{
+	struct sensor* s = ctx;
+	struct collector_item* it = spsc_ring_write_slot(&s->queue);
+
+	if (it == NULL) {
+		__atomic_add_fetch(&s->drops, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	it->msg_len = 0;
+	it->sample = s->rx.sample;
+	it->pkt = *p;
+	spsc_ring_write_done(&s->queue);
+}
+
+static void collector_queue_message(unsigned char* buf, size_t len, void* ctx)
+{
+	struct sensor* s = ctx;
+	struct collector_item* it;
+
+	if (len > COLLECTOR_MSG_MAX)
+		return;
+
+	/* configuration messages must not get lost, so wait for space */
+	while ((it = spsc_ring_write_slot(&s->queue)) == NULL) {
+		if (__atomic_load_n(&thread_stop, __ATOMIC_RELAXED))
+			return;
+		collector_notify();
+		usleep(1000);
+	}
+
+	it->msg_len = len;
+	memcpy(it->msg, buf, len);
+	spsc_ring_write_done(&s->queue);
+}
+
+/* net_rx_receive() does not tell us if the connection was closed */
+static bool collector_conn_closed(int fd)
+{
+	char dummy;
+	ssize_t ret = recv(fd, &dummy, 1, MSG_DONTWAIT | MSG_PEEK);
+
+	return ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+static void collector_set_fd(struct sensor* s, int fd)
+{
+	pthread_mutex_lock(&s->lock);
+	if (s->fd != -1)
+		close(s->fd);
+	s->fd = fd;
+	/* the hello must come before any configuration we send. If it fails
+	 * the receive loop sees the closed connection and we reconnect */
+	if (fd != -1 && !net_send_collector_hello(fd))
+		shutdown(fd, SHUT_RDWR);
+	pthread_mutex_unlock(&s->lock);
+
+	__atomic_store_n(&s->connected, fd != -1, __ATOMIC_RELEASE);
+	collector_notify();
+}
+
+static void collector_receive(struct sensor* s, int fd)
+{
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (!__atomic_load_n(&thread_stop, __ATOMIC_RELAXED)) {
+		/* timeout to check for thread_stop */
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		if (net_rx_receive(fd, &s->rx) < 0 && collector_conn_closed(fd))
+			return;
+
+		if (spsc_ring_count(&s->queue) > 0)
+			collector_notify();
+	}
+}
+
+static void* collector_thread_main(void* arg)
+{
+	struct sensor* s = arg;
+	int fd, i;
+
+	while (!__atomic_load_n(&thread_stop, __ATOMIC_RELAXED)) {
+		fd = net_connect(s->host, s->port, COLLECTOR_CONNECT_TIMEOUT);
+		if (fd != -1 && net_rx_init(&s->rx)) {
+			__atomic_add_fetch(&s->connects, 1, __ATOMIC_RELAXED);
+			collector_set_fd(s, fd);
+			collector_receive(s, fd);
+			collector_set_fd(s, -1);
+			net_rx_free(&s->rx);
+		} else if (fd != -1)
+			close(fd);
+
+		/* wait before connecting again, but check thread_stop */
+		for (i = 0; i < COLLECTOR_RECONNECT_TIME * 10; i++) {
+			if (__atomic_load_n(&thread_stop, __ATOMIC_RELAXED))
+				break;
+			usleep(100000);
+		}
+	}
+	return NULL;
+}
+
+/* parse "host[:port],host[:port],..." */
+static bool collector_parse_servers(const char* servers, int port)
+{
+	char buf[MAX_CONF_VALUE_STRLEN + 1];
+	char *tok, *save, *colon;
+	struct sensor* s;
+
+	strncpy(buf, servers, MAX_CONF_VALUE_STRLEN);
+	buf[MAX_CONF_VALUE_STRLEN] = '\0';
+
+	for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+		if (num_sensors >= MAX_SENSORS) {
+			LOG_ERR("Only %d sensors are supported", MAX_SENSORS);
+			return false;
+		}
+		s = &sensors[num_sensors];
+		s->id = num_sensors + 1;
+		s->port = port;
+		colon = strchr(tok, ':');
+		if (colon != NULL) {
+			*colon = '\0';
+			s->port = atoi(colon + 1);
+		}
+		if (tok[0] == '\0' || s->port <= 0) {
+			LOG_ERR("Invalid sensor '%s'", tok);
+			return false;
+		}
+		strcpy(s->host, tok);
+		num_sensors++;
+	}
+	return true;
+}
+
+bool collector_init(const char* servers, int port)
+{
+	struct sensor* s;
+	int i;
+
+	if (!collector_parse_servers(servers, port))
+		return false;
+
+	sensor_nodes_init();
+
+	collector_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (collector_event_fd < 0) {
+		LOG_ERR("Could not create eventfd (%s)", strerror(errno));
+		num_sensors = 0;
+		return false;
+	}
+
+	for (i = 0; i < num_sensors; i++) {
+		s = &sensors[i];
+		s->fd = -1;
+		s->rx.packet_cb = collector_queue_packet;
+		s->rx.message_cb = collector_queue_message;
+		s->rx.ctx = s;
+		pthread_mutex_init(&s->lock, NULL);
+		if (!spsc_ring_init(&s->queue, conf.capture_queue, sizeof(struct collector_item)) ||
+		    pthread_create(&s->thread, NULL, collector_thread_main, s) != 0) {
+			LOG_ERR("Could not start thread for sensor %s", s->host);
+			spsc_ring_free(&s->queue);
+			num_sensors = i;
+			collector_finish();
+			return false;
+		}
+		LOG_INF("Collecting from sensor %d: %s port %d", s->id, s->host, s->port);
+	}
+	return true;
+}
+
+void collector_finish(void)
+{
+	struct sensor* s;
+	int i;
+
+	if (collector_event_fd == -1)
+		return;
+
+	__atomic_store_n(&thread_stop, true, __ATOMIC_RELAXED);
+	for (i = 0; i < num_sensors; i++) {
+		s = &sensors[i];
+		pthread_join(s->thread, NULL);
+		if (s->fd != -1)
+			close(s->fd);
+		s->fd = -1;
+		pthread_mutex_destroy(&s->lock);
+		spsc_ring_free(&s->queue);
+	}
+	num_sensors = 0;
+	sensor_nodes_free();
+
+	close(collector_event_fd);
+	collector_event_fd = -1;
+}
+
+bool collector_active(void)
+{
+	return num_sensors > 0;
+}
+
+/* send our configuration to all connected sensors */
+void collector_send(void (*send)(int fd))
+{
+	struct sensor* s;
+	int i;
+
+	for (i = 0; i < num_sensors; i++) {
+		s = &sensors[i];
+		pthread_mutex_lock(&s->lock);
+		if (s->fd != -1)
+			send(s->fd);
+		pthread_mutex_unlock(&s->lock);
+	}
+}
+
+/*
+ * Signal of each node per sensor, kept in a hash table by MAC address.
+ * Only used in the main thread.
+ */
+
+#define SENSOR_NODE_HASH_BITS	10
+#define SENSOR_NODE_HASH_SIZE	(1 << SENSOR_NODE_HASH_BITS)
+
+struct sensor_node {
+	struct sensor_node*	next;
+	unsigned char		mac[WLAN_MAC_LEN];
+	time_t			last_seen[MAX_SENSORS];	/* 0: never */
+	int			sig_last[MAX_SENSORS];
+	struct ewma		sig_avg[MAX_SENSORS];
+};
+
+static struct sensor_node* sensor_nodes[SENSOR_NODE_HASH_SIZE];
+static struct pool sensor_node_pool;
+
+static unsigned int sensor_node_hash(const unsigned char* mac)
+{
+	uint32_t h = mac[2] | (mac[3] << 8) | (mac[4] << 16) | ((uint32_t)mac[5] << 24);
+
+	return (h * 2654435761u) >> (32 - SENSOR_NODE_HASH_BITS);
+}
+
+static struct sensor_node* sensor_node_get(const unsigned char* mac)
+{
+	struct sensor_node** head = &sensor_nodes[sensor_node_hash(mac)];
+	struct sensor_node* sn;
+
+	for (sn = *head; sn != NULL; sn = sn->next)
+		if (memcmp(sn->mac, mac, WLAN_MAC_LEN) == 0)
+			return sn;
+
+	/* like the node list, but nodes are only removed by the timeout */
+	if (conf.node_max > 0 && sensor_node_pool.used >= conf.node_max)
+		return NULL;
+
+	sn = pool_alloc(&sensor_node_pool);
+	if (sn == NULL)
+		return NULL;
+	memset(sn, 0, sizeof(*sn));
+	memcpy(sn->mac, mac, WLAN_MAC_LEN);
+	sn->next = *head;
+	*head = sn;
+	return sn;
+}
+
+static void sensor_node_update(struct sensor* s, struct uwifi_packet* p)
+{
+	struct sensor_node* sn;
+	int i = s->id - 1;
+
+	if (p->phy_signal == 0 || !MAC_NOT_EMPTY(p->wlan_ta))
+		return;
+
+	sn = sensor_node_get(nodes_random_probe(p) ? nodes_random_bucket : p->wlan_ta);
+	if (sn == NULL)
+		return;
+
+	if (sn->last_seen[i] == 0)
+		ewma_init(&sn->sig_avg[i], 1024, 8);
+	sn->last_seen[i] = time_mono.tv_sec;
+	sn->sig_last[i] = p->phy_signal;
+	ewma_add(&sn->sig_avg[i], -p->phy_signal);
+}
+
+/* print the average signal of a node per sensor, like "1:-52 3:-70" */
+int collector_node_signals(const unsigned char* mac, char* buf, size_t len)
+{
+	struct sensor_node* sn;
+	int i, pos = 0;
+
+	buf[0] = '\0';
+	for (sn = sensor_nodes[sensor_node_hash(mac)]; sn != NULL; sn = sn->next)
+		if (memcmp(sn->mac, mac, WLAN_MAC_LEN) == 0)
+			break;
+	if (sn == NULL)
+		return 0;
+
+	for (i = 0; i < num_sensors && (size_t)pos < len; i++) {
+		if (sn->last_seen[i] == 0)
+			continue;
+		pos += snprintf(buf + pos, len - pos, "%s%d:%ld", pos > 0 ? " " : "",
+				i + 1, -(long)ewma_read(&sn->sig_avg[i]));
+	}
+	return MIN((size_t)pos, len - 1);
+}
+
+/* forget what a sensor has not seen for node_timeout */
+void collector_timeout(void)
+{
+	struct sensor_node **pp, *sn;
+	bool seen;
+	int i;
+
+	for (i = 0; i < SENSOR_NODE_HASH_SIZE; i++) {
+		pp = &sensor_nodes[i];
+		while ((sn = *pp) != NULL) {
+			seen = false;
+			for (int j = 0; j < num_sensors; j++) {
+				if (sn->last_seen[j] + conf.node_timeout < time_mono.tv_sec)
+					sn->last_seen[j] = 0;
+				else
+					seen = true;
+			}
+			if (!seen) {
+				*pp = sn->next;
+				pool_free(&sensor_node_pool, sn);
+			} else
+				pp = &sn->next;
+		}
+	}
+}
+
+static void sensor_nodes_init(void)
+{
+	pool_init(&sensor_node_pool, "sensor_node", sizeof(struct sensor_node), 64);
+}
+
+static void sensor_nodes_free(void)
+{
+	memset(sensor_nodes, 0, sizeof(sensor_nodes));
+	pool_destroy(&sensor_node_pool);
+}
+
+static void collector_check_state(struct sensor* s)
+{
+	bool connected = __atomic_load_n(&s->connected, __ATOMIC_ACQUIRE);
+
+	if (connected == s->was_connected)
+		return;
+	s->was_connected = connected;
+
+	if (connected)
+		LOG_INF("Sensor %d (%s) connected", s->id, s->host);
+	else
+		LOG_ERR("Sensor %d (%s) disconnected, reconnecting", s->id, s->host);
+
+	if (connected && (primary == -1 || !sensors[primary].was_connected))
+		primary = s->id - 1;
+}
+
+/* called by main thread when collector_event_fd is readable */
+void collector_queue_process(void)
+{
+	struct collector_item* it;
+	struct sensor* s;
+	bool more = false;
+	unsigned int n;
+	uint64_t ev;
+
+	if (read(collector_event_fd, &ev, sizeof(ev)) < 0 && errno != EAGAIN)
+		LOG_ERR("Could not read collector eventfd (%s)", strerror(errno));
+	__atomic_store_n(&notify_pending, false, __ATOMIC_SEQ_CST);
+
+	for (int i = 0; i < num_sensors; i++) {
+		s = &sensors[i];
+		collector_check_state(s);
+
+		n = spsc_ring_count(&s->queue);
+		if (n > stats.queue_max)
+			stats.queue_max = n;
+
+		/* don't stay here forever, to get back to the mainloop */
+		for (n = 0; n < spsc_ring_size(&s->queue); n++) {
+			it = spsc_ring_read_slot(&s->queue);
+			if (it == NULL)
+				break;
+			if (it->msg_len == 0) {
+				s->packets++;
+				net_sample = it->sample;
+				handle_packet(&it->pkt, NULL, 0, NULL);
+				sensor_node_update(s, &it->pkt);
+			} else if (i == primary)
+				net_receive_message(it->msg, it->msg_len);
+			spsc_ring_read_done(&s->queue);
+		}
+		if (n == spsc_ring_size(&s->queue))
+			more = true;
+	}
+
+	/* more left, make sure we get called again */
+	if (more)
+		collector_notify();
+}
+
+const struct pool* collector_node_pool(void)
+{
+	return &sensor_node_pool;
+}
+
+int collector_num_sensors(void)
+{
+	return num_sensors;
+}
+
+void collector_sensor_status(int i, struct sensor_status* st)
+{
+	struct sensor* s = &sensors[i];
+
+	st->host = s->host;
+	st->port = s->port;
+	st->connected = s->was_connected;
+	st->connects = __atomic_load_n(&s->connects, __ATOMIC_RELAXED);
+	st->packets = s->packets;
+	st->drops = __atomic_load_n(&s->drops, __ATOMIC_RELAXED);
+	st->errors = __atomic_load_n(&s->rx.errors, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,54 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef _COLLECTOR_H_
+#define _COLLECTOR_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_SENSORS		16
+
+struct sensor_status {
+	const char*	host;
+	int		port;
+	bool		connected;
+	unsigned int	connects;
+	unsigned long	packets;
+	unsigned long	drops;
+	unsigned long	errors;		/* invalid messages */
+};
+
+struct pool;
+
+extern int collector_event_fd;
+
+bool collector_init(const char* servers, int port);
+void collector_finish(void);
+bool collector_active(void);
+void collector_queue_process(void);
+void collector_send(void (*send)(int fd));
+void collector_timeout(void);
+int collector_num_sensors(void);
+void collector_sensor_status(int i, struct sensor_status* st);
+int collector_node_signals(const unsigned char* mac, char* buf, size_t len);
+const struct pool* collector_node_pool(void);
+
+#endif
@@ -0,0 +1,591 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Columnar binary capture log ("outfile_format=column") and query mode.
+ *
+ * The file starts with a small header followed by chunks of up to
+ * COLLOG_CHUNK_ROWS packets. Each chunk has a header with the number of rows
+ * and the minimum and maximum timestamp, a dictionary of the MAC addresses
+ * and one of the ESSIDs used in the chunk and then one fixed width column per
+ * field. Addresses and ESSIDs are stored as 16 bit dictionary indices. All
+ * parts are 8 byte aligned and all numbers are little endian, so a log
+ * written on a big endian sensor can be queried anywhere.
+ *
+ * A query can skip whole chunks by looking only at the time range in the
+ * chunk header and at the MAC dictionary, and compares dictionary indices
+ * instead of addresses in the chunks it has to read.
+ */
+
+#define _GNU_SOURCE /* for strptime() */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <uwifi/util.h>
+#include <uwifi/wlan80211.h>
+#include <uwifi/wlan_parser.h>
+#include <uwifi/log.h>
+
+#include "main.h"
+#include "csvfile.h"
+#include "collog.h"
+
+#define COLLOG_MAGIC		"HORSTCL1"
+#define COLLOG_VERSION		1
+#define COLLOG_CHUNK_MAGIC	0x4b434c48	/* "HLCK" */
+#define COLLOG_CHUNK_ROWS	4096
+#define COLLOG_MAX_MACS		(3 * COLLOG_CHUNK_ROWS)
+#define COLLOG_MAX_ESSIDS	1024
+#define COLLOG_ESSID_LEN	33
+#define COLLOG_NO_IDX		0xffff
+#define COLLOG_STALL_USEC	10000
+
+#define MAC_HASH_BITS		15
+#define MAC_HASH_SIZE		(1 << MAC_HASH_BITS)
+#define ESSID_HASH_BITS		11
+#define ESSID_HASH_SIZE		(1 << ESSID_HASH_BITS)
+
+#define ALIGN8(x)		(((x) + 7) & ~(size_t)7)
+
+#define FLAG_WEP		0x1
+#define FLAG_WPA		0x2
+#define FLAG_RSN		0x4
+
+struct collog_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	chunk_rows;
+};
+
+struct collog_chunk {
+	uint32_t	magic;
+	uint32_t	len;		/* of the whole chunk */
+	uint32_t	rows;
+	uint16_t	num_macs;
+	uint16_t	num_essids;
+	int64_t		time_min;	/* usec since the epoch */
+	int64_t		time_max;
+};
+
+enum collog_column {
+	COL_TIME, COL_TSF, COL_IP_SRC, COL_IP_DST,
+	COL_TYPE, COL_TA, COL_RA, COL_BSSID, COL_ESSID,
+	COL_LEN, COL_RATE, COL_FREQ, COL_MODE, COL_PKT_TYPES,
+	COL_SIGNAL, COL_CHANNEL, COL_FLAGS,
+	COL_NUM
+};
+
+static const unsigned char col_width[COL_NUM] = {
+	8, 8, 4, 4,
+	2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2,
+	1, 1, 1
+};
+
+struct collog_layout {
+	size_t		mac_off;
+	size_t		essid_off;
+	size_t		col_off[COL_NUM];
+	size_t		len;
+};
+
+static void collog_get_layout(struct collog_layout* l, unsigned int rows,
+			      unsigned int num_macs, unsigned int num_essids)
+{
+	size_t o = sizeof(struct collog_chunk);
+
+	l->mac_off = o;
+	o = ALIGN8(o + (size_t)num_macs * WLAN_MAC_LEN);
+	l->essid_off = o;
+	o = ALIGN8(o + (size_t)num_essids * COLLOG_ESSID_LEN);
+	for (int i = 0; i < COL_NUM; i++) {
+		l->col_off[i] = o;
+		o = ALIGN8(o + (size_t)rows * col_width[i]);
+	}
+	l->len = o;
+}
+
+/*** writer ***/
+
+/* the columns are kept in file (little endian) byte order */
+static struct {
+	int64_t		time[COLLOG_CHUNK_ROWS];
+	uint64_t	tsf[COLLOG_CHUNK_ROWS];
+	uint32_t	ip_src[COLLOG_CHUNK_ROWS];
+	uint32_t	ip_dst[COLLOG_CHUNK_ROWS];
+	uint16_t	type[COLLOG_CHUNK_ROWS];
+	uint16_t	ta[COLLOG_CHUNK_ROWS];
+	uint16_t	ra[COLLOG_CHUNK_ROWS];
+	uint16_t	bssid[COLLOG_CHUNK_ROWS];
+	uint16_t	essid[COLLOG_CHUNK_ROWS];
+	uint16_t	len[COLLOG_CHUNK_ROWS];
+	uint16_t	rate[COLLOG_CHUNK_ROWS];
+	uint16_t	freq[COLLOG_CHUNK_ROWS];
+	uint16_t	mode[COLLOG_CHUNK_ROWS];
+	uint16_t	pkt_types[COLLOG_CHUNK_ROWS];
+	int8_t		signal[COLLOG_CHUNK_ROWS];
+	uint8_t		channel[COLLOG_CHUNK_ROWS];
+	uint8_t		flags[COLLOG_CHUNK_ROWS];
+} col;
+
+/* in the order of enum collog_column */
+static const void* const col_data[COL_NUM] = {
+	col.time, col.tsf, col.ip_src, col.ip_dst,
+	col.type, col.ta, col.ra, col.bssid, col.essid,
+	col.len, col.rate, col.freq, col.mode, col.pkt_types,
+	col.signal, col.channel, col.flags
+};
+
+static unsigned char mac_dict[COLLOG_MAX_MACS][WLAN_MAC_LEN];
+static uint16_t mac_hash[MAC_HASH_SIZE];	/* index + 1, 0 is empty */
+static unsigned int num_macs;
+
+static char essid_dict[COLLOG_MAX_ESSIDS][COLLOG_ESSID_LEN];
+static uint16_t essid_hash[ESSID_HASH_SIZE];	/* index + 1, 0 is empty */
+static unsigned int num_essids;
+
+static unsigned int rows;
+static int64_t time_min, time_max;
+static struct timespec chunk_start;
+
+static int col_fd = -1;
+static unsigned char* out_buf;
+
+static uint16_t collog_mac_idx(const unsigned char* mac)
+{
+	uint32_t h;
+	unsigned int i;
+
+	memcpy(&h, mac + 2, sizeof(h));
+	h = ((h ^ mac[0] ^ (mac[1] << 8)) * 2654435761u) >> (32 - MAC_HASH_BITS);
+
+	for (i = h; mac_hash[i] != 0; i = (i + 1) & (MAC_HASH_SIZE - 1)) {
+		if (memcmp(mac_dict[mac_hash[i] - 1], mac, WLAN_MAC_LEN) == 0)
+			return mac_hash[i] - 1;
+	}
+
+	memcpy(mac_dict[num_macs], mac, WLAN_MAC_LEN);
+	mac_hash[i] = ++num_macs;
+	return num_macs - 1;
+}
+
+static uint16_t collog_essid_idx(const char* essid)
+{
+	size_t len = strnlen(essid, COLLOG_ESSID_LEN - 1);
+	uint32_t h = 2166136261u;
+	unsigned int i;
+	char* e;
+
+	if (len == 0)
+		return COLLOG_NO_IDX;
+
+	/* FNV-1a */
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char)essid[i]) * 16777619u;
+	h >>= 32 - ESSID_HASH_BITS;
+
+	for (i = h; essid_hash[i] != 0; i = (i + 1) & (ESSID_HASH_SIZE - 1)) {
+		e = essid_dict[essid_hash[i] - 1];
+		if (memcmp(e, essid, len) == 0 && e[len] == '\0')
+			return essid_hash[i] - 1;
+	}
+
+	e = essid_dict[num_essids];
+	memset(e, 0, COLLOG_ESSID_LEN);
+	memcpy(e, essid, len);
+	essid_hash[i] = ++num_essids;
+	return num_essids - 1;
+}
+
+static void collog_write_buf(const unsigned char* buf, size_t len)
+{
+	struct timespec t1, t2;
+	ssize_t ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	while (len > 0) {
+		ret = write(col_fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			LOG_ERR("Could not write outfile (%s)", strerror(errno));
+			stats.outfile_stalls++;
+			return;
+		}
+		buf += ret;
+		len -= ret;
+		stats.outfile_bytes += ret;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	if ((t2.tv_sec - t1.tv_sec) * 1000000 + (t2.tv_nsec - t1.tv_nsec) / 1000
+	    > COLLOG_STALL_USEC)
+		stats.outfile_stalls++;
+}
+
+static void collog_write_chunk(void)
+{
+	struct collog_layout l;
+	struct collog_chunk* ch = (struct collog_chunk*)out_buf;
+
+	if (rows == 0)
+		return;
+
+	collog_get_layout(&l, rows, num_macs, num_essids);
+	memset(out_buf, 0, l.len);
+
+	ch->magic = htole32(COLLOG_CHUNK_MAGIC);
+	ch->len = htole32(l.len);
+	ch->rows = htole32(rows);
+	ch->num_macs = htole16(num_macs);
+	ch->num_essids = htole16(num_essids);
+	ch->time_min = htole64(time_min);
+	ch->time_max = htole64(time_max);
+
+	memcpy(out_buf + l.mac_off, mac_dict, (size_t)num_macs * WLAN_MAC_LEN);
+	memcpy(out_buf + l.essid_off, essid_dict, (size_t)num_essids * COLLOG_ESSID_LEN);
+	for (int i = 0; i < COL_NUM; i++)
+		memcpy(out_buf + l.col_off[i], col_data[i], (size_t)rows * col_width[i]);
+
+	collog_write_buf(out_buf, l.len);
+
+	rows = 0;
+	num_macs = 0;
+	num_essids = 0;
+	memset(mac_hash, 0, sizeof(mac_hash));
+	memset(essid_hash, 0, sizeof(essid_hash));
+}
+
+bool collog_open(const char* name)
+{
+	struct collog_layout l;
+	struct collog_header fh;
+
+	collog_close();
+
+	collog_get_layout(&l, COLLOG_CHUNK_ROWS, COLLOG_MAX_MACS, COLLOG_MAX_ESSIDS);
+	out_buf = malloc(l.len);
+	if (out_buf == NULL)
+		return false;
+
+	col_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (col_fd < 0) {
+		LOG_ERR("Couldn't open outfile '%s' (%s)", name, strerror(errno));
+		free(out_buf);
+		out_buf = NULL;
+		return false;
+	}
+
+	memset(&fh, 0, sizeof(fh));
+	memcpy(fh.magic, COLLOG_MAGIC, sizeof(fh.magic));
+	fh.version = htole32(COLLOG_VERSION);
+	fh.chunk_rows = htole32(COLLOG_CHUNK_ROWS);
+	collog_write_buf((unsigned char*)&fh, sizeof(fh));
+
+	rows = 0;
+	num_macs = 0;
+	num_essids = 0;
+	memset(mac_hash, 0, sizeof(mac_hash));
+	memset(essid_hash, 0, sizeof(essid_hash));
+
+	LOG_INF("- Writing column log to outfile %s", name);
+	return true;
+}
+
+void collog_write(struct uwifi_packet* p)
+{
+	int64_t t;
+
+	if (col_fd < 0)
+		return;
+
+	t = (int64_t)time_real.tv_sec * 1000000 + time_real.tv_nsec / 1000;
+	if (rows == 0) {
+		time_min = time_max = t;
+		chunk_start = time_mono;
+	} else {
+		time_min = MIN(time_min, t);
+		time_max = MAX(time_max, t);
+	}
+
+	/* IP addresses are in network byte order, they stay as they are */
+	col.time[rows] = htole64(t);
+	col.tsf[rows] = htole64(p->wlan_tsf);
+	col.ip_src[rows] = p->ip_src;
+	col.ip_dst[rows] = p->ip_dst;
+	col.type[rows] = htole16(p->wlan_type);
+	col.ta[rows] = htole16(collog_mac_idx(p->wlan_ta));
+	col.ra[rows] = htole16(collog_mac_idx(p->wlan_ra));
+	col.bssid[rows] = htole16(collog_mac_idx(p->wlan_bssid));
+	col.essid[rows] = htole16(collog_essid_idx(p->wlan_essid));
+	col.len[rows] = htole16(p->wlan_len);
+	col.rate[rows] = htole16(p->phy_rate);
+	col.freq[rows] = htole16(p->phy_freq);
+	col.mode[rows] = htole16(p->wlan_mode);
+	col.pkt_types[rows] = htole16(p->pkt_types);
+	col.signal[rows] = p->phy_signal;
+	col.channel[rows] = p->wlan_channel;
+	col.flags[rows] = (p->wlan_wep ? FLAG_WEP : 0) |
+			  (p->wlan_wpa ? FLAG_WPA : 0) |
+			  (p->wlan_rsn ? FLAG_RSN : 0);
+	rows++;
+
+	/* end chunk when it is full or a dictionary might overflow */
+	if (rows == COLLOG_CHUNK_ROWS || num_macs > COLLOG_MAX_MACS - 3 ||
+	    num_essids == COLLOG_MAX_ESSIDS)
+		collog_write_chunk();
+}
+
+/* called every second, writes a partial chunk after outfile_flush ms */
+void collog_flush(void)
+{
+	if (col_fd < 0 || rows == 0)
+		return;
+
+	if ((time_mono.tv_sec - chunk_start.tv_sec) * 1000 +
+	    (time_mono.tv_nsec - chunk_start.tv_nsec) / 1000000 >= conf.outfile_flush)
+		collog_write_chunk();
+}
+
+void collog_close(void)
+{
+	if (col_fd >= 0) {
+		collog_write_chunk();
+		close(col_fd);
+		col_fd = -1;
+	}
+	free(out_buf);
+	out_buf = NULL;
+}
+
+/*** query ***/
+
+bool collog_parse_time(const char* str, time_t* t)
+{
+	static const char* formats[] = {
+		"%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M:%S", "%Y-%m-%d"
+	};
+	struct tm tm;
+	char* end;
+	long long v;
+
+	/* seconds since the epoch */
+	v = strtoll(str, &end, 10);
+	if (end != str && *end == '\0') {
+		*t = v;
+		return true;
+	}
+
+	/* local time */
+	for (unsigned int i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		memset(&tm, 0, sizeof(tm));
+		end = strptime(str, formats[i], &tm);
+		if (end != NULL && *end == '\0') {
+			tm.tm_isdst = -1;
+			*t = mktime(&tm);
+			return true;
+		}
+	}
+	return false;
+}
+
+/* find index of mac in the chunk dictionary or return COLLOG_NO_IDX */
+static uint16_t query_dict_find(const unsigned char* dict, unsigned int num,
+				const unsigned char* mac)
+{
+	for (unsigned int i = 0; i < num; i++)
+		if (memcmp(dict + i * WLAN_MAC_LEN, mac, WLAN_MAC_LEN) == 0)
+			return i;
+	return COLLOG_NO_IDX;
+}
+
+int collog_query(const char* name)
+{
+	const struct collog_header* fh;
+	const struct collog_chunk* ch;
+	const unsigned char* map;
+	const unsigned char* c;
+	struct collog_layout l;
+	struct csv_record rec;
+	struct stat st;
+	char line[CSVFILE_MAX_LINE];
+	uint32_t ch_len, ch_rows;
+	uint16_t ch_macs, ch_essids;
+	uint16_t mac_idx[MAX_FILTERMAC];
+	uint16_t bssid_idx = COLLOG_NO_IDX;
+	unsigned int n_mac_idx;
+	unsigned long chunks = 0, chunks_read = 0, matched = 0;
+	int64_t from = INT64_MIN, to = INT64_MAX;
+	bool do_bssid = MAC_NOT_EMPTY(conf.filterbssid);
+	size_t pos;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "Could not open '%s' (%s)\n", name, strerror(errno));
+		return 1;
+	}
+	if ((size_t)st.st_size < sizeof(*fh)) {
+		fprintf(stderr, "'%s' is not a horst column log\n", name);
+		close(fd);
+		return 1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Could not mmap '%s' (%s)\n", name, strerror(errno));
+		return 1;
+	}
+
+	fh = (const struct collog_header*)map;
+	if (memcmp(fh->magic, COLLOG_MAGIC, sizeof(fh->magic)) != 0 ||
+	    le32toh(fh->version) != COLLOG_VERSION) {
+		fprintf(stderr, "'%s' is not a horst column log (or wrong version)\n", name);
+		munmap((void*)map, st.st_size);
+		return 1;
+	}
+
+	if (conf.query_from)
+		from = (int64_t)conf.query_from * 1000000;
+	if (conf.query_to)
+		to = (int64_t)conf.query_to * 1000000 + 999999;
+
+	fputs(CSVFILE_HEADER, stdout);
+
+	for (pos = sizeof(*fh); st.st_size - pos >= sizeof(*ch); pos += ch_len) {
+		ch = (const struct collog_chunk*)(map + pos);
+		ch_len = le32toh(ch->len);
+		ch_rows = le32toh(ch->rows);
+		ch_macs = le16toh(ch->num_macs);
+		ch_essids = le16toh(ch->num_essids);
+		if (le32toh(ch->magic) != COLLOG_CHUNK_MAGIC || ch_len < sizeof(*ch) ||
+		    ch_len > st.st_size - pos) {
+			fprintf(stderr, "Corrupt chunk at offset %zu\n", pos);
+			break;
+		}
+		collog_get_layout(&l, ch_rows, ch_macs, ch_essids);
+		if (l.len != ch_len) {
+			fprintf(stderr, "Corrupt chunk at offset %zu\n", pos);
+			break;
+		}
+		chunks++;
+
+		/* skip chunks by time index and MAC dictionary */
+		if ((int64_t)le64toh(ch->time_max) < from ||
+		    (int64_t)le64toh(ch->time_min) > to)
+			continue;
+
+		c = (const unsigned char*)ch;
+		n_mac_idx = 0;
+		if (conf.do_macfilter) {
+			for (int i = 0; i < MAX_FILTERMAC; i++) {
+				if (!conf.filtermac_enabled[i])
+					continue;
+				mac_idx[n_mac_idx] = query_dict_find(c + l.mac_off, ch_macs,
+								     conf.filtermac[i]);
+				if (mac_idx[n_mac_idx] != COLLOG_NO_IDX)
+					n_mac_idx++;
+			}
+			if (n_mac_idx == 0)
+				continue;
+		}
+		if (do_bssid) {
+			bssid_idx = query_dict_find(c + l.mac_off, ch_macs, conf.filterbssid);
+			if (bssid_idx == COLLOG_NO_IDX)
+				continue;
+		}
+		chunks_read++;
+
+		const int64_t* time = (const int64_t*)(c + l.col_off[COL_TIME]);
+		const uint16_t* ta = (const uint16_t*)(c + l.col_off[COL_TA]);
+		const uint16_t* ra = (const uint16_t*)(c + l.col_off[COL_RA]);
+		const uint16_t* bssid = (const uint16_t*)(c + l.col_off[COL_BSSID]);
+		const uint16_t* essid = (const uint16_t*)(c + l.col_off[COL_ESSID]);
+		const unsigned char* dict = c + l.mac_off;
+
+		for (unsigned int r = 0; r < ch_rows; r++) {
+			int64_t t = le64toh(time[r]);
+			uint16_t r_ta = le16toh(ta[r]);
+			uint16_t r_ra = le16toh(ra[r]);
+			uint16_t r_bssid = le16toh(bssid[r]);
+			uint16_t r_essid;
+
+			if (t < from || t > to)
+				continue;
+			if (do_bssid && r_bssid != bssid_idx)
+				continue;
+			if (n_mac_idx > 0) {
+				unsigned int i;
+				for (i = 0; i < n_mac_idx; i++)
+					if (r_ta == mac_idx[i] || r_ra == mac_idx[i])
+						break;
+				if (i == n_mac_idx)
+					continue;
+			}
+			if (r_ta >= ch_macs || r_ra >= ch_macs || r_bssid >= ch_macs)
+				continue;
+
+			memset(&rec, 0, sizeof(rec));
+			rec.ts.tv_sec = t / 1000000;
+			rec.ts.tv_nsec = t % 1000000 * 1000;
+			rec.tsf = le64toh(((const uint64_t*)(c + l.col_off[COL_TSF]))[r]);
+			rec.ip_src = ((const uint32_t*)(c + l.col_off[COL_IP_SRC]))[r];
+			rec.ip_dst = ((const uint32_t*)(c + l.col_off[COL_IP_DST]))[r];
+			rec.type = le16toh(((const uint16_t*)(c + l.col_off[COL_TYPE]))[r]);
+			rec.len = le16toh(((const uint16_t*)(c + l.col_off[COL_LEN]))[r]);
+			rec.rate = le16toh(((const uint16_t*)(c + l.col_off[COL_RATE]))[r]);
+			rec.freq = le16toh(((const uint16_t*)(c + l.col_off[COL_FREQ]))[r]);
+			rec.mode = le16toh(((const uint16_t*)(c + l.col_off[COL_MODE]))[r]);
+			rec.pkt_types = le16toh(((const uint16_t*)(c + l.col_off[COL_PKT_TYPES]))[r]);
+			rec.signal = ((const int8_t*)(c + l.col_off[COL_SIGNAL]))[r];
+			rec.channel = ((const uint8_t*)(c + l.col_off[COL_CHANNEL]))[r];
+			uint8_t flags = ((const uint8_t*)(c + l.col_off[COL_FLAGS]))[r];
+			rec.wep = !!(flags & FLAG_WEP);
+			rec.wpa = !!(flags & FLAG_WPA);
+			rec.rsn = !!(flags & FLAG_RSN);
+			memcpy(rec.ta, dict + r_ta * WLAN_MAC_LEN, WLAN_MAC_LEN);
+			memcpy(rec.ra, dict + r_ra * WLAN_MAC_LEN, WLAN_MAC_LEN);
+			memcpy(rec.bssid, dict + r_bssid * WLAN_MAC_LEN, WLAN_MAC_LEN);
+			r_essid = le16toh(essid[r]);
+			if (r_essid < ch_essids)
+				strncpy(rec.essid, (const char*)c + l.essid_off +
+					r_essid * COLLOG_ESSID_LEN, COLLOG_ESSID_LEN - 1);
+
+			fwrite(line, 1, csvfile_format_record(line, &rec), stdout);
+			matched++;
+		}
+	}
+
+	fflush(stdout);
+	fprintf(stderr, "%lu records matched, %lu of %lu chunks read\n",
+		matched, chunks_read, chunks);
+
+	munmap((void*)map, st.st_size);
+	return 0;
+}
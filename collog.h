@@ -0,0 +1,36 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _COLLOG_H_
+#define _COLLOG_H_
+
+#include <stdbool.h>
+#include <time.h>
+
+struct uwifi_packet;
+
+bool collog_open(const char* name);
+void collog_write(struct uwifi_packet* p);
+void collog_flush(void);
+void collog_close(void);
+
+bool collog_parse_time(const char* str, time_t* t);
+int collog_query(const char* name);
+
+#endif
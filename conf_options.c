@@ -21,6 +21,7 @@
 #include <string.h>
 #include <getopt.h>
 #include <err.h>
+#include <arpa/inet.h>
 
 #include <uwifi/util.h>
 #include <uwifi/wlan_util.h>
@@ -30,6 +31,10 @@
 #include "hutil.h"
 #include "control.h"
 #include "conf_options.h"
+#include "collog.h"
+#include "network.h"
+#include "net_compress.h"
+#include "oui.h"
 
 struct conf_option {
 	int		option;
@@ -66,21 +71,127 @@ static bool conf_add_monitor(const char* value) {
 	return true;
 }
 
+/* set by -Q, the log is only read and no outfile is opened */
+static const char* query_file;
+
 static bool conf_outfile(const char* value) {
+	if (query_file != NULL)
+		return true;
 	dumpfile_open(value);
 	return true;
 }
 
+static bool conf_outfile_format(const char* value) {
+	if (strcasecmp(value, "pcap") == 0)
+		conf.outfile_format = OUTFILE_PCAP;
+	else if (strcasecmp(value, "csv") == 0)
+		conf.outfile_format = OUTFILE_CSV;
+	else if (strcasecmp(value, "column") == 0)
+		conf.outfile_format = OUTFILE_COLUMN;
+	else {
+		LOG_ERR("Unknown outfile format '%s'", value);
+		return false;
+	}
+	/* reopen outfile in new format */
+	if (conf.dumpfile[0] != '\0' && query_file == NULL)
+		dumpfile_open(conf.dumpfile);
+	return true;
+}
+
+static bool conf_outfile_snaplen(const char* value) {
+	conf.outfile_snaplen = atoi(value);
+	return true;
+}
+
+static bool conf_outfile_rotate_size(const char* value) {
+	conf.outfile_rotate_size = atoi(value);
+	return true;
+}
+
+static bool conf_outfile_rotate_time(const char* value) {
+	conf.outfile_rotate_time = atoi(value);
+	return true;
+}
+
+static bool conf_outfile_queue(const char* value) {
+	conf.outfile_queue = atoi(value);
+	return true;
+}
+
+static bool conf_outfile_flush(const char* value) {
+	conf.outfile_flush = atoi(value);
+	return true;
+}
+
 static bool conf_node_timeout(const char* value) {
 	conf.node_timeout = atoi(value);
 	return true;
 }
 
+static bool conf_node_max(const char* value) {
+	conf.node_max = atoi(value);
+	return true;
+}
+
+static bool conf_node_random_bucket(const char* value) {
+	conf.node_random_bucket = atoi(value) != 0;
+	return true;
+}
+
 static bool conf_receive_buffer(const char* value) {
 	conf.recv_buffer_size = atoi(value);
 	return true;
 }
 
+static bool conf_capture_mode(const char* value) {
+	if (strcasecmp(value, "ring") == 0)
+		conf.capture_mode = CAPTURE_RING;
+	else if (strcasecmp(value, "mmsg") == 0)
+		conf.capture_mode = CAPTURE_MMSG;
+	else if (strcasecmp(value, "recv") == 0)
+		conf.capture_mode = CAPTURE_RECV;
+	else {
+		LOG_ERR("Unknown capture mode '%s'", value);
+		return false;
+	}
+	return true;
+}
+
+static bool conf_ring_block_size(const char* value) {
+	conf.ring_block_size = atoi(value);
+	return true;
+}
+
+static bool conf_ring_blocks(const char* value) {
+	conf.ring_blocks = atoi(value);
+	return true;
+}
+
+static bool conf_ring_timeout(const char* value) {
+	conf.ring_timeout = atoi(value);
+	return true;
+}
+
+static bool conf_recv_batch(const char* value) {
+	conf.recv_batch = atoi(value);
+	if (conf.recv_batch < 1)
+		conf.recv_batch = 1;
+	return true;
+}
+
+static bool conf_capture_thread(const char* value) {
+	if (value != NULL && strcmp(value, "0") == 0)
+		conf.capture_thread = 0;
+	else
+		conf.capture_thread = 1;
+	return true;
+}
+
+static bool conf_capture_queue(const char* value) {
+	conf.capture_queue = atoi(value);
+	return true;
+}
+
 static bool conf_channel_set(const char* value) {
 	bool ht40plus = false;
 	enum uwifi_chan_width width = CHAN_WIDTH_20_NOHT;
@@ -176,11 +287,90 @@ static bool conf_client(const char* value) {
 	return true;
 }
 
+static bool conf_client_summary(const char* value) {
+	if (value != NULL && strcmp(value, "0") == 0)
+		conf.client_summary = 0;
+	else
+		conf.client_summary = 1;
+	return true;
+}
+
+static bool conf_client_mcast(const char* value) {
+	if (value != NULL && strcmp(value, "0") == 0)
+		conf.client_mcast = 0;
+	else
+		conf.client_mcast = 1;
+	return true;
+}
+
 static bool conf_port(const char* value) {
 	conf.port = atoi(value);
 	return true;
 }
 
+static bool conf_server_flush(const char* value) {
+	conf.server_flush = atoi(value);
+	return true;
+}
+
+static bool conf_server_batch(const char* value) {
+	conf.server_batch = atoi(value);
+	if (conf.server_batch < 256)
+		conf.server_batch = 256;
+	else if (conf.server_batch > NET_MAX_BATCH)
+		conf.server_batch = NET_MAX_BATCH;
+	return true;
+}
+
+static bool conf_server_compress(const char* value) {
+	conf.server_compress = atoi(value);
+	if (conf.server_compress > 0 && net_compress_methods() == 0) {
+		LOG_ERR("Compression is not supported by this build");
+		conf.server_compress = 0;
+	}
+	return true;
+}
+
+static bool conf_server_summary(const char* value) {
+	conf.server_summary = atoi(value);
+	return true;
+}
+
+static bool conf_server_sample_max(const char* value) {
+	int n = atoi(value);
+
+	if (n < 1 || n > 65535) {
+		LOG_ERR("server_sample_max must be from 1 to 65535");
+		return false;
+	}
+	conf.server_sample_max = n;
+	return true;
+}
+
+static bool conf_server_mcast(const char* value) {
+	struct in_addr addr;
+
+	if (inet_aton(value, &addr) == 0 || !IN_MULTICAST(ntohl(addr.s_addr))) {
+		LOG_ERR("Invalid multicast group '%s'", value);
+		return false;
+	}
+	strncpy(conf.server_mcast, value, MAX_CONF_VALUE_STRLEN);
+	conf.server_mcast[MAX_CONF_VALUE_STRLEN] = '\0';
+	return true;
+}
+
+static bool conf_server_mcast_if(const char* value) {
+	struct in_addr addr;
+
+	if (inet_aton(value, &addr) == 0) {
+		LOG_ERR("Invalid interface address '%s'", value);
+		return false;
+	}
+	strncpy(conf.server_mcast_if, value, MAX_CONF_VALUE_STRLEN);
+	conf.server_mcast_if[MAX_CONF_VALUE_STRLEN] = '\0';
+	return true;
+}
+
 static bool conf_control_pipe(const char* value) {
 	/*
 	 * Here it's a bit difficult because -X is used for two purposes:
@@ -299,6 +489,50 @@ static bool conf_mac_names(const char* value) {
 	return true;
 }
 
+static bool conf_replay(const char* value) {
+	strncpy(conf.replay_file, value, MAX_CONF_VALUE_STRLEN);
+	conf.replay_file[MAX_CONF_VALUE_STRLEN] = '\0';
+	return true;
+}
+
+static bool conf_replay_speed(const char* value) {
+	if (strcasecmp(value, "max") == 0)
+		conf.replay_speed = 0;
+	else
+		conf.replay_speed = atof(value);
+	if (conf.replay_speed < 0) {
+		LOG_ERR("Invalid replay speed '%s'", value);
+		conf.replay_speed = 0;
+		return false;
+	}
+	return true;
+}
+
+static bool conf_oui_file(const char* value) {
+	if (value != NULL)
+		strncpy(conf.oui_file, value, MAX_CONF_VALUE_STRLEN);
+	else
+		strncpy(conf.oui_file, DEFAULT_OUI_FILE, MAX_CONF_VALUE_STRLEN);
+	conf.oui_file[MAX_CONF_VALUE_STRLEN] = '\0';
+	return true;
+}
+
+static bool conf_query_from(const char* value) {
+	if (!collog_parse_time(value, &conf.query_from)) {
+		LOG_ERR("Invalid time '%s'", value);
+		return false;
+	}
+	return true;
+}
+
+static bool conf_query_to(const char* value) {
+	if (!collog_parse_time(value, &conf.query_to)) {
+		LOG_ERR("Invalid time '%s'", value);
+		return false;
+	}
+	return true;
+}
+
 static struct conf_option conf_options[] = {
 	/* C , NAME        VALUE REQUIRED, DEFAULT	CALLBACK */
 	{ 'q', "quiet",			0, NULL,	conf_quiet },		// NOT dynamic
@@ -310,8 +544,23 @@ static struct conf_option conf_options[] = {
 	{ 'd', "display_interval",	1, "100", 	conf_display_interval },
 	{ 'V', "display_view",		1, NULL, 	conf_display_view },
 	{ 'o', "outfile", 		1, NULL,	conf_outfile },
+	{  0 , "outfile_format",	1, "csv",	conf_outfile_format },
+	{  0 , "outfile_snaplen",	1, "0",		conf_outfile_snaplen },
+	{  0 , "outfile_rotate_size",	1, "0",		conf_outfile_rotate_size },
+	{  0 , "outfile_rotate_time",	1, "0",		conf_outfile_rotate_time },
+	{  0 , "outfile_queue",		1, "4096",	conf_outfile_queue },
+	{  0 , "outfile_flush",		1, "1000",	conf_outfile_flush },
 	{ 't', "node_timeout", 		1, "60",	conf_node_timeout },
+	{  0 , "node_max",		1, "10000",	conf_node_max },
+	{  0 , "node_random_bucket",	1, "1",		conf_node_random_bucket },
 	{ 'b', "receive_buffer",	1, NULL,	conf_receive_buffer },	// NOT dynamic
+	{  0 , "capture_mode",		1, "recv",	conf_capture_mode },	// NOT dynamic
+	{  0 , "ring_block_size",	1, "131072",	conf_ring_block_size },	// NOT dynamic
+	{  0 , "ring_blocks",		1, "16",	conf_ring_blocks },	// NOT dynamic
+	{  0 , "ring_timeout",		1, "50",	conf_ring_timeout },	// NOT dynamic
+	{  0 , "recv_batch",		1, "32",	conf_recv_batch },	// NOT dynamic
+	{  0 , "capture_thread",	0, NULL,	conf_capture_thread },	// NOT dynamic
+	{  0 , "capture_queue",		1, "2048",	conf_capture_queue },	// NOT dynamic
 	{ 'C', "channel",		1, NULL, 	conf_channel_set },
 	{ 's', "channel_scan",		0, NULL,	conf_channel_scan },
 	{  0 , "channel_scan_rounds",	1, "-1",	conf_channel_scan_rounds },
@@ -319,13 +568,27 @@ static struct conf_option conf_options[] = {
 	{ 'u', "channel_upper",		1, NULL, 	conf_channel_upper },
 	{ 'N', "server",		0, NULL,	conf_server },		// NOT dynamic
 	{ 'n', "client",		1, NULL,	conf_client },		// NOT dynamic
+	{  0 , "client_summary",	0, NULL,	conf_client_summary },	// NOT dynamic
+	{  0 , "client_multicast",	0, NULL,	conf_client_mcast },	// NOT dynamic
 	{ 'p', "port",			1, "4444",	conf_port },		// NOT dynamic
+	{  0 , "server_flush",		1, "10",	conf_server_flush },
+	{  0 , "server_batch",		1, "16384",	conf_server_batch },
+	{  0 , "server_compress",	1, "0",		conf_server_compress },
+	{  0 , "server_summary",	1, "0",		conf_server_summary },
+	{  0 , "server_sample_max",	1, "64",	conf_server_sample_max },
+	{  0 , "server_multicast",	1, NULL,	conf_server_mcast },	// NOT dynamic
+	{  0 , "server_multicast_if",	1, NULL,	conf_server_mcast_if },	// NOT dynamic
+	{ 'r', "replay",		1, NULL,	conf_replay },		// NOT dynamic
+	{  0 , "replay_speed",		1, "1",		conf_replay_speed },	// NOT dynamic
 	{ 'X', "control_pipe",		2, NULL,	conf_control_pipe },	// NOT dynamic
 	{ 'e', "filter_mac", 		1, NULL,	conf_filter_mac },
 	{ 'B', "filter_bssid", 		1, NULL,	conf_filter_bssid },
 	{ 'm', "filter_mode",		1, "ALL",	conf_filter_mode },
 	{ 'f', "filter_packet",		1, "ALL",	conf_filter_pkt },
 	{ 'M', "mac_names",		2, NULL,	conf_mac_names },
+	{ 'U', "oui_file",		2, NULL,	conf_oui_file },	// NOT dynamic
+	{ 'F', "query_from",		1, NULL,	conf_query_from },
+	{ 'T', "query_to",		1, NULL,	conf_query_to },
 };
 
 /*
@@ -458,8 +721,8 @@ static char* config_get_getopt_string(char* buf, size_t maxlen, const char* add)
 static void print_usage(const char* name)
 {
 	printf("\nUsage: %s [-v] [-h] [-q] [-D] [-a] [-c file] [-i interface] [-t sec] [-d ms] [-V view] [-b bytes]\n"
-		"\t\t[-s] [-u] [-N] [-n IP] [-p port] [-o file] [-X[name]] [-x command]\n"
-		"\t\t[][-e MAC] [-f PKT_NAME] [-m MODE] [-B BSSID]\n\n"
+		"\t\t[-s] [-u] [-N] [-n IP] [-p port] [-r file] [-o file] [-X[name]] [-x command]\n"
+		"\t\t[-Q file] [-F time] [-T time] [-e MAC] [-f PKT_NAME] [-m MODE] [-B BSSID]\n\n"
 
 		"General Options: Description (default value)\n"
 		"  -v\t\tshow version\n"
@@ -477,6 +740,8 @@ static void print_usage(const char* name)
 		"  -V view\tDisplay view: history|essid|statistics|spectrum\n"
 		"  -b <bytes>\tReceive buffer size in bytes (not set)\n"
 		"  -M[filename]\tMAC address to host name mapping (/tmp/dhcp.leases)\n"
+		"  -U[filename]\tShow vendors from OUI table (" DEFAULT_OUI_FILE ")\n"
+		"  -O <oui.txt>\tConvert IEEE OUI registry to OUI table on stdout\n"
 
 		"\nFeature Options:\n"
 		"  -s\t\t(Poor mans) Spectrum analyzer mode\n"
@@ -486,10 +751,16 @@ static void print_usage(const char* name)
 		"  -n <IP>\tConnect to server with <IP>, client mode (off)\n"
 		"  -p <port>\tPort number of server (4444)\n\n"
 
+		"  -r <filename>\tReplay radiotap pcap or pcapng file instead of capturing\n\n"
+
 		"  -o <filename>\tWrite packet info into 'filename'\n\n"
 
 		"  -X[filename]\tAllow control socket on 'filename' (/tmp/horst)\n"
-		"  -x <command>\tSend control command\n"
+		"  -x <command>\tSend control command\n\n"
+
+		"  -Q <filename>\tQuery column outfile and print matching packets as CSV\n"
+		"  -F <time>\tQuery from time (epoch seconds or YYYY-MM-DD[ HH:MM:SS])\n"
+		"  -T <time>\tQuery up to time\n"
 
 		"\nFilter Options:\n"
 		" Filters are generally 'positive' or 'inclusive' which means you define\n"
@@ -510,7 +781,7 @@ void config_parse_file_and_cmdline(int argc, char** argv)
 	char* conf_filename = CONFIG_FILE;
 	int c;
 
-	config_get_getopt_string(getopt_str, sizeof(getopt_str), "hvc:x:");
+	config_get_getopt_string(getopt_str, sizeof(getopt_str), "hvc:x:Q:O:");
 
 	/* first: apply default values */
 	config_apply_defaults();
@@ -525,6 +796,11 @@ void config_parse_file_and_cmdline(int argc, char** argv)
 			LOG_INF("Using config file '%s'", optarg);
 			conf_filename = optarg;
 			break;
+		case 'Q':
+			query_file = optarg;
+			break;
+		case 'O':
+			exit(oui_build(optarg));
 		case 'v':
 			printf("%s using libuwifi %s\n", VERSION, UWIFI_VERSION);
 			exit(0);
@@ -549,7 +825,7 @@ void config_parse_file_and_cmdline(int argc, char** argv)
 
 	/*
 	 * and finally get command line options ("commands") which depend
-	 * on config options ("x:")
+	 * on config options ("x:Q:")
 	 */
 	optind = 1;
 	while ((c = getopt(argc, argv, getopt_str)) > 0) {
@@ -557,6 +833,8 @@ void config_parse_file_and_cmdline(int argc, char** argv)
 		case 'x':
 			control_send_command(optarg);
 			exit(0);
+		case 'Q':
+			exit(collog_query(optarg));
 		}
 	}
 }
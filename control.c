@@ -29,6 +29,7 @@
 #include "main.h"
 #include "control.h"
 #include "conf_options.h"
+#include "bpf_filter.h"
 
 #define MAX_CMD 255
 
@@ -100,6 +101,8 @@ static void parse_command(char* in) {
 	else {
 		/* handle the rest thru config options */
 		config_handle_option(0, cmd, val);
+		if (strncmp(cmd, "filter_", 7) == 0)
+			bpf_filter_update();
 	}
 }
 
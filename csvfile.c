@@ -0,0 +1,422 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * CSV outfile written by a separate thread.
+ *
+ * The main thread only copies the fields we write into a fixed size record
+ * and puts it into a lock-free queue. The writer thread formats the records
+ * into a large stdio buffer and flushes it every outfile_flush milliseconds,
+ * so a slow disk can not stall packet processing. When the queue is full
+ * records are dropped and counted.
+ *
+ * The writer thread sleeps on an eventfd while there is nothing to do. Like
+ * with the capture queue, the main thread only writes to it when the
+ * notification is not already pending, so this costs one system call per
+ * wakeup and not per record.
+ *
+ * The writer thread does not touch stats and does not log. It counts in
+ * csv_stats and the main thread adds the counters to stats and reports write
+ * errors in csvfile_stats_collect().
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <uwifi/util.h>
+#include <uwifi/wlan80211.h>
+#include <uwifi/wlan_parser.h>
+#include <uwifi/wlan_util.h>
+#include <uwifi/log.h>
+
+#include "main.h"
+#include "csvfile.h"
+#include "spsc_ring.h"
+
+#define CSVFILE_BUF_SIZE	(256 * 1024)
+#define CSVFILE_STALL_USEC	10000
+
+static FILE* DF = NULL;
+static char df_buf[CSVFILE_BUF_SIZE];
+
+static struct spsc_ring rec_queue;
+static pthread_t writer_thread;
+static bool writer_running;
+static bool writer_stop;
+static bool notify_pending;
+static int writer_event_fd = -1;
+
+static struct {
+	unsigned long	bytes;
+	unsigned long	stalls;
+	unsigned long	errors;
+	int		error;		/* errno of the last write error */
+} csv_stats;
+
+#define CSV_STATS_ADD(_x, _n)	__atomic_add_fetch(&csv_stats._x, (_n), __ATOMIC_RELAXED)
+#define CSV_STATS_TAKE(_x)	__atomic_exchange_n(&csv_stats._x, 0, __ATOMIC_RELAXED)
+
+static long usec_diff(const struct timespec* a, const struct timespec* b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000000 + (a->tv_nsec - b->tv_nsec) / 1000;
+}
+
+/*
+ * Formatting helpers. The timestamp prefix and timezone only change once per
+ * second, so they are cached and only the microseconds are filled in per
+ * record. MAC and IP addresses are converted with lookup tables instead of
+ * printf. This is used by the writer thread or in query mode only.
+ */
+
+static const char hex_digits[] = "0123456789abcdef";
+static char dec_str[256][4];
+static unsigned char dec_len[256];
+
+static time_t ts_cache_sec = -1;
+static char ts_prefix[32];
+static size_t ts_prefix_len;
+static char ts_zone[16];
+static size_t ts_zone_len;
+
+static void csvfile_init_tables(void)
+{
+	if (dec_len[0] != 0)
+		return;
+
+	for (int i = 0; i < 256; i++)
+		dec_len[i] = snprintf(dec_str[i], sizeof(dec_str[i]), "%d", i);
+}
+
+/* timestamp, e.g. 2015-05-16 15:05:44.338806 +0300 */
+static char* put_timestamp(char* b, const struct timespec* ts)
+{
+	unsigned int usec = ts->tv_nsec / 1000;
+	struct tm ltm;
+
+	if (ts->tv_sec != ts_cache_sec) {
+		localtime_r(&ts->tv_sec, &ltm);
+		ts_prefix_len = strftime(ts_prefix, sizeof(ts_prefix), "%Y-%m-%d %H:%M:%S", &ltm);
+		ts_zone_len = strftime(ts_zone, sizeof(ts_zone), " %z", &ltm);
+		ts_cache_sec = ts->tv_sec;
+	}
+
+	memcpy(b, ts_prefix, ts_prefix_len);
+	b += ts_prefix_len;
+	*b++ = '.';
+	for (int i = 5; i >= 0; i--) {
+		b[i] = '0' + usec % 10;
+		usec /= 10;
+	}
+	b += 6;
+	memcpy(b, ts_zone, ts_zone_len);
+	return b + ts_zone_len;
+}
+
+static char* put_str(char* b, const char* s)
+{
+	size_t len = strlen(s);
+	memcpy(b, s, len);
+	return b + len;
+}
+
+static char* put_mac(char* b, const unsigned char* mac)
+{
+	for (int i = 0; i < WLAN_MAC_LEN; i++) {
+		*b++ = hex_digits[mac[i] >> 4];
+		*b++ = hex_digits[mac[i] & 0xf];
+		*b++ = ':';
+	}
+	return b - 1; /* no trailing colon */
+}
+
+static char* put_ip(char* b, unsigned int ip)
+{
+	const unsigned char* c = (const unsigned char*)&ip;
+
+	for (int i = 0; i < 4; i++) {
+		memcpy(b, dec_str[c[i]], dec_len[c[i]]);
+		b += dec_len[c[i]];
+		*b++ = '.';
+	}
+	return b - 1; /* no trailing dot */
+}
+
+/* format one line into buf, which must have CSVFILE_MAX_LINE bytes */
+size_t csvfile_format_record(char* buf, const struct csv_record* r)
+{
+	char* b = buf;
+
+	csvfile_init_tables();
+
+	b = put_timestamp(b, &r->ts);
+	b = put_str(b, ", ");
+	b = put_str(b, wlan_get_packet_type_name(r->type));
+	b = put_str(b, ", ");
+	b = put_mac(b, r->ta);
+	b = put_str(b, ", ");
+	b = put_mac(b, r->ra);
+	b = put_str(b, ", ");
+	b = put_mac(b, r->bssid);
+	b += sprintf(b, ", %x, %d, %d, %d, %d, %016llx, ",
+		     r->pkt_types, r->signal, r->len, r->rate, r->freq,
+		     (unsigned long long)r->tsf);
+	b = put_str(b, r->essid);
+	b += sprintf(b, ", %d, %d, %d, %d, %d, ",
+		     r->mode, r->channel, r->wep, r->wpa, r->rsn);
+	b = put_ip(b, r->ip_src);
+	b = put_str(b, ", ");
+	b = put_ip(b, r->ip_dst);
+	*b++ = '\n';
+
+	return b - buf;
+}
+
+static void csvfile_format(const struct csv_record* r)
+{
+	char buf[CSVFILE_MAX_LINE];
+	size_t len = csvfile_format_record(buf, r);
+
+	fwrite(buf, 1, len, DF);
+	CSV_STATS_ADD(bytes, len);
+}
+
+static void csvfile_flush(void)
+{
+	struct timespec t1, t2;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (fflush(DF) != 0) {
+		__atomic_store_n(&csv_stats.error, errno, __ATOMIC_RELAXED);
+		CSV_STATS_ADD(errors, 1);
+		clearerr(DF);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	if (usec_diff(&t2, &t1) > CSVFILE_STALL_USEC)
+		CSV_STATS_ADD(stalls, 1);
+}
+
+static void csvfile_notify(void)
+{
+	uint64_t ev = 1;
+
+	if (__atomic_exchange_n(&notify_pending, true, __ATOMIC_SEQ_CST))
+		return;
+
+	/* EAGAIN means the counter is full, so it is readable anyway */
+	if (write(writer_event_fd, &ev, sizeof(ev)) < 0 && errno != EAGAIN) {
+		LOG_ERR("Could not notify outfile writer (%s)", strerror(errno));
+		__atomic_store_n(&notify_pending, false, __ATOMIC_SEQ_CST);
+	}
+}
+
+static void* csvfile_writer_main(__attribute__((unused)) void* arg)
+{
+	struct pollfd pfd = { .fd = writer_event_fd, .events = POLLIN };
+	struct timespec now, last_flush;
+	struct csv_record* r;
+	bool stop, pending = false;
+	long wait_ms;
+	uint64_t ev;
+
+	clock_gettime(CLOCK_MONOTONIC, &last_flush);
+
+	for (;;) {
+		stop = __atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE);
+
+		while ((r = spsc_ring_read_slot(&rec_queue)) != NULL) {
+			csvfile_format(r);
+			spsc_ring_read_done(&rec_queue);
+			pending = true;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (pending && (stop || usec_diff(&now, &last_flush) >=
+					conf.outfile_flush * 1000L)) {
+			csvfile_flush();
+			last_flush = now;
+			pending = false;
+		}
+
+		/* the main thread stops producing before it sets writer_stop,
+		 * so the queue is completely drained here */
+		if (stop)
+			break;
+
+		/* sleep until notified, or until the next flush is due */
+		if (pending) {
+			wait_ms = conf.outfile_flush - usec_diff(&now, &last_flush) / 1000;
+			if (wait_ms < 0)
+				wait_ms = 0;
+		} else
+			wait_ms = -1;
+
+		/* we can't log from the writer thread. After a failed read the
+		 * eventfd stays readable, so we just go round again */
+		if (poll(&pfd, 1, wait_ms) > 0 &&
+		    read(writer_event_fd, &ev, sizeof(ev)) < 0)
+			continue;
+		__atomic_store_n(&notify_pending, false, __ATOMIC_SEQ_CST);
+	}
+	return NULL;
+}
+
+bool csvfile_open(const char* name)
+{
+	sigset_t all, old;
+
+	DF = fopen(name, "w");
+	if (DF == NULL)
+		return false;
+
+	setvbuf(DF, df_buf, _IOFBF, sizeof(df_buf));
+	fputs(CSVFILE_HEADER, DF);
+
+	if (!spsc_ring_init(&rec_queue, conf.outfile_queue, sizeof(struct csv_record))) {
+		LOG_ERR("Could not allocate outfile queue");
+		fclose(DF);
+		DF = NULL;
+		return false;
+	}
+
+	writer_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (writer_event_fd < 0) {
+		LOG_ERR("Could not create eventfd (%s)", strerror(errno));
+		spsc_ring_free(&rec_queue);
+		fclose(DF);
+		DF = NULL;
+		return false;
+	}
+
+	/* signals are handled by the main thread only */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	writer_stop = false;
+	notify_pending = false;
+	writer_running = pthread_create(&writer_thread, NULL,
+					csvfile_writer_main, NULL) == 0;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (!writer_running) {
+		LOG_ERR("Could not start outfile writer thread");
+		close(writer_event_fd);
+		writer_event_fd = -1;
+		spsc_ring_free(&rec_queue);
+		fclose(DF);
+		DF = NULL;
+		return false;
+	}
+	return true;
+}
+
+void csvfile_write(struct uwifi_packet* p)
+{
+	struct csv_record* r;
+
+	if (!writer_running)
+		return;
+
+	r = spsc_ring_write_slot(&rec_queue);
+	if (r == NULL) {
+		stats.outfile_queue_drops++;
+		return;
+	}
+
+	r->ts = time_real;
+	r->tsf = p->wlan_tsf;
+	r->type = p->wlan_type;
+	r->pkt_types = p->pkt_types;
+	r->signal = p->phy_signal;
+	r->len = p->wlan_len;
+	r->rate = p->phy_rate;
+	r->freq = p->phy_freq;
+	r->mode = p->wlan_mode;
+	r->ip_src = p->ip_src;
+	r->ip_dst = p->ip_dst;
+	memcpy(r->ta, p->wlan_ta, WLAN_MAC_LEN);
+	memcpy(r->ra, p->wlan_ra, WLAN_MAC_LEN);
+	memcpy(r->bssid, p->wlan_bssid, WLAN_MAC_LEN);
+	r->channel = p->wlan_channel;
+	r->wep = p->wlan_wep;
+	r->wpa = p->wlan_wpa;
+	r->rsn = p->wlan_rsn;
+	memcpy(r->essid, p->wlan_essid, WLAN_MAX_SSID_LEN);
+	r->essid[WLAN_MAX_SSID_LEN] = '\0';
+
+	spsc_ring_write_done(&rec_queue);
+	csvfile_notify();
+
+	if (spsc_ring_count(&rec_queue) > stats.outfile_queue_max)
+		stats.outfile_queue_max = spsc_ring_count(&rec_queue);
+}
+
+/* called by the main thread once per second and on close */
+void csvfile_stats_collect(void)
+{
+	unsigned long errors;
+
+	stats.outfile_bytes += CSV_STATS_TAKE(bytes);
+	stats.outfile_stalls += CSV_STATS_TAKE(stalls);
+
+	/* like pcapfile a failed write also counts as stall */
+	errors = CSV_STATS_TAKE(errors);
+	if (errors > 0) {
+		stats.outfile_stalls += errors;
+		LOG_ERR("Could not write outfile (%s)",
+			strerror(__atomic_load_n(&csv_stats.error, __ATOMIC_RELAXED)));
+	}
+}
+
+void csvfile_close(void)
+{
+	if (writer_running) {
+		__atomic_store_n(&writer_stop, true, __ATOMIC_RELEASE);
+		__atomic_store_n(&notify_pending, false, __ATOMIC_SEQ_CST);
+		csvfile_notify();
+		pthread_join(writer_thread, NULL);
+		writer_running = false;
+		csvfile_stats_collect();
+		close(writer_event_fd);
+		writer_event_fd = -1;
+		spsc_ring_free(&rec_queue);
+	}
+
+	if (DF != NULL) {
+		fclose(DF);
+		DF = NULL;
+	}
+}
+
+unsigned int csvfile_queue_count(void)
+{
+	return writer_running ? spsc_ring_count(&rec_queue) : 0;
+}
+
+unsigned int csvfile_queue_size(void)
+{
+	return writer_running ? spsc_ring_size(&rec_queue) : 0;
+}
@@ -0,0 +1,70 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _CSVFILE_H_
+#define _CSVFILE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <uwifi/wlan80211.h>
+
+#define CSVFILE_HEADER	"TIME, WLAN TYPE, MAC SRC, MAC DST, BSSID, PACKET TYPES, SIGNAL, " \
+			"LENGTH, PHY RATE, FREQUENCY, TSF, ESSID, MODE, CHANNEL, " \
+			"WEP, WPA1, RSN (WPA2), IP SRC, IP DST\n"
+
+#define CSVFILE_MAX_LINE	300
+
+struct uwifi_packet;
+
+/* the fields of one CSV line */
+struct csv_record {
+	struct timespec	ts;
+	uint64_t	tsf;
+	unsigned int	type;
+	unsigned int	pkt_types;
+	int		signal;
+	unsigned int	len;
+	unsigned int	rate;
+	unsigned int	freq;
+	unsigned int	mode;
+	unsigned int	ip_src;
+	unsigned int	ip_dst;
+	unsigned char	ta[WLAN_MAC_LEN];
+	unsigned char	ra[WLAN_MAC_LEN];
+	unsigned char	bssid[WLAN_MAC_LEN];
+	unsigned char	channel;
+	unsigned char	wep:1,
+			wpa:1,
+			rsn:1;
+	char		essid[WLAN_MAX_SSID_LEN + 1];
+};
+
+size_t csvfile_format_record(char* buf, const struct csv_record* r);
+
+bool csvfile_open(const char* name);
+void csvfile_write(struct uwifi_packet* p);
+void csvfile_stats_collect(void);
+void csvfile_close(void);
+unsigned int csvfile_queue_count(void);
+unsigned int csvfile_queue_size(void);
+
+#endif
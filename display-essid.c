@@ -29,6 +29,7 @@
 #include "display.h"
 #include "main.h"
 #include "hutil.h"
+#include "oui.h"
 
 void update_essid_win(WINDOW *win)
 {
@@ -36,6 +37,7 @@ void update_essid_win(WINDOW *win)
 	int line = 1;
 	struct essid_info* e;
 	struct uwifi_node* n;
+	const char* vendor;
 
 	werase(win);
 	wattron(win, WHITE);
@@ -81,6 +83,9 @@ void update_essid_win(WINDOW *win)
 			wprintw(win, " %s", n->wlan_wep ? "W" : " ");
 			if (n->pkt_types & PKT_TYPE_IP)
 				wprintw(win, " %s", ip_sprintf(n->ip_src));
+			vendor = oui_vendor(n->wlan_src);
+			if (vendor != NULL)
+				wprintw(win, " %.20s", vendor);
 			line++;
 		}
 	}
@@ -28,6 +28,7 @@
 #include "main.h"
 #include "hutil.h"
 #include "network.h"
+#include "bpf_filter.h"
 
 #define MAC_COL 2
 #define MODE_COL 30
@@ -207,6 +208,7 @@ out:
 			conf.do_macfilter = 1;
 	}
 
+	bpf_filter_update();
 	net_send_filter_config();
 
 	update_filter_win(win);
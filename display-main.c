@@ -34,6 +34,8 @@
 #include "olsr_header.h"
 #include "batman_adv_header-14.h"
 #include "listsort.h"
+#include "collector.h"
+#include "oui.h"
 
 static WINDOW *sort_win = NULL;
 static WINDOW *dump_win = NULL;
@@ -231,6 +233,8 @@ static char spin[4] = {'/', '-', '\\', '|'};
 
 static bool print_node_list_line(int line, struct uwifi_node* n)
 {
+	const char* vendor;
+
 	if (conf.filter_mode != 0 && (n->wlan_mode & conf.filter_mode) == 0)
 		return false;
 
@@ -304,6 +308,17 @@ static bool print_node_list_line(int line, struct uwifi_node* n)
 	if (!(n->wlan_mode & WLAN_MODE_AP) && n->pkt_types & PKT_TYPE_IP)
 		wprintw(list_win, "%s", ip_sprintf(n->ip_src));
 
+	vendor = oui_vendor(n->wlan_src);
+	if (vendor != NULL)
+		wprintw(list_win, " %.20s", vendor);
+
+	/* signal per sensor in collector mode */
+	if (collector_active()) {
+		char sig[MAX_SENSORS * 8];
+		if (collector_node_signals(n->wlan_src, sig, sizeof(sig)) > 0)
+			wprintw(list_win, " [%s]", sig);
+	}
+
 	wattroff(list_win, A_BOLD);
 	wattroff(list_win, GREEN);
 	wattroff(list_win, RED);
@@ -26,6 +26,11 @@
 #include "display.h"
 #include "main.h"
 #include "hutil.h"
+#include "capture.h"
+#include "csvfile.h"
+#include "network.h"
+#include "collector.h"
+#include "nodes.h"
 
 
 #define STAT_PACK_POS 9
@@ -36,6 +41,12 @@
 #define STAT_AIR_POS (STAT_BP_POS + 6)
 #define STAT_AIRG_POS (STAT_AIR_POS + 6)
 
+static void print_pool(WINDOW *win, const struct pool* p)
+{
+	wprintw(win, " %s %u/%zu (%s)", p->name, p->used, pool_size(p),
+		kilo_mega_ize(pool_size(p) * p->elem_size));
+}
+
 void update_statistics_win(WINDOW *win)
 {
 	int i;
@@ -73,7 +84,73 @@ void update_statistics_win(WINDOW *win)
 		  dps * 1.0 / 10000, dps ); /* usec in % */
 	wattroff(win, A_BOLD);
 
-	line = 6;
+	line = 5;
+	if (conf.capture_mode == CAPTURE_RING) {
+		mvwprintw(win, line++, 2, "Ring:    %lu packets, %lu dropped (%.1f%%), %lu freezes",
+			  stats.ring_packets, stats.ring_drops,
+			  stats.ring_packets ? stats.ring_drops * 100.0 / stats.ring_packets : 0.0,
+			  stats.ring_freezes);
+	} else if (conf.capture_mode == CAPTURE_MMSG) {
+		mvwprintw(win, line++, 2, "Batch:  ");
+		for (i = 0; i < MAX_BATCH_HIST; i++)
+			wprintw(win, " %d%s:%lu", 1 << i,
+				i == MAX_BATCH_HIST - 1 ? "+" : "",
+				stats.batch_hist[i]);
+	}
+	if (capture_queue_size() > 0) {
+		mvwprintw(win, line++, 2, "Queue:   %u/%u (max %lu), %lu dropped",
+			  capture_queue_count(), capture_queue_size(),
+			  stats.queue_max, stats.queue_drops);
+	}
+
+	if (conf.dumpfile[0] != '\0') {
+		mvwprintw(win, line++, 2, "Outfile: %s written, %lu stalls",
+			  kilo_mega_ize(stats.outfile_bytes), stats.outfile_stalls);
+		if (csvfile_queue_size() > 0)
+			wprintw(win, ", queue %u/%u (max %lu), %lu dropped",
+				csvfile_queue_count(), csvfile_queue_size(),
+				stats.outfile_queue_max, stats.outfile_queue_drops);
+	}
+
+	if (conf.allow_client && conf.serveraddr[0] == '\0') {
+		mvwprintw(win, line++, 2, "Clients: %d connected, %lu packets dropped, %.1f packets/send",
+			  net_num_clients, stats.net_drops,
+			  stats.net_flushes ? stats.net_flush_records * 1.0 / stats.net_flushes : 0.0);
+		if (stats.net_sampled > 0)
+			mvwprintw(win, line++, 2, "Sampling: %lu packets not sent to slow clients",
+				  stats.net_sampled);
+		if (mcast_fd != -1)
+			mvwprintw(win, line++, 2, "Multicast: %s, %lu datagrams sent",
+				  conf.server_mcast, stats.net_mcast_sent);
+		if (stats.net_comp_blocks > 0)
+			mvwprintw(win, line++, 2, "Compression: %lu blocks, ratio %.2f, %.1f usec/block",
+				  stats.net_comp_blocks,
+				  stats.net_comp_in * 1.0 / stats.net_comp_out,
+				  stats.net_comp_nsec / 1000.0 / stats.net_comp_blocks);
+	}
+
+	if (conf.serveraddr[0] != '\0' && net_sample > 1)
+		mvwprintw(win, line++, 2, "Sampling: server sends 1 in %u data frames", net_sample);
+	if (conf.serveraddr[0] != '\0' && stats.net_mcast_lost > 0)
+		mvwprintw(win, line++, 2, "Multicast: %lu datagrams lost", stats.net_mcast_lost);
+
+	for (i = 0; i < collector_num_sensors(); i++) {
+		struct sensor_status st;
+		collector_sensor_status(i, &st);
+		mvwprintw(win, line++, 2, "Sensor %d: %s:%d %s, %lu packets, %lu dropped, %lu errors, %u connects",
+			  i + 1, st.host, st.port, st.connected ? "up" : "DOWN",
+			  st.packets, st.drops, st.errors, st.connects);
+	}
+
+	mvwprintw(win, line++, 2, "Nodes:   %u (max %u), %lu removed, %lu probes from ~%u random MACs",
+		  nodes_count(), conf.node_max, stats.node_evictions,
+		  stats.node_random_probes, nodes_random_macs());
+	mvwprintw(win, line++, 2, "Pools:  ");
+	print_pool(win, &chan_node_pool);
+	if (collector_active())
+		print_pool(win, collector_node_pool());
+
+	line++;
 	mvwprintw(win, line, STAT_PACK_POS, " Packets");
 	mvwprintw(win, line, STAT_BYTE_POS, "   Bytes");
 	mvwprintw(win, line, STAT_BPP_POS, "~B/P");
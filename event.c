@@ -0,0 +1,218 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include <uwifi/log.h>
+
+#include "event.h"
+
+#define MAX_EVENT_HANDLERS	32
+#define MAX_EVENTS		16
+
+struct event_handler {
+	int		fd;
+	bool		timer;
+	event_cb	cb;
+	event_cb	write_cb;
+};
+
+static int epoll_fd = -1;
+static struct event_handler handlers[MAX_EVENT_HANDLERS];
+static struct epoll_event events[MAX_EVENTS];
+
+void event_init(void)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+		err(1, "epoll_create1");
+
+	for (int i = 0; i < MAX_EVENT_HANDLERS; i++)
+		handlers[i].fd = -1;
+}
+
+static bool event_add(int fd, event_cb cb, bool timer)
+{
+	struct epoll_event ev;
+	int i;
+
+	for (i = 0; i < MAX_EVENT_HANDLERS; i++)
+		if (handlers[i].fd == -1)
+			break;
+
+	if (i == MAX_EVENT_HANDLERS) {
+		LOG_ERR("Too many event handlers");
+		return false;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	/* slot index and fd, so we can detect a slot which was reused while
+	 * its events were still pending */
+	ev.data.u64 = (uint64_t)i << 32 | (uint32_t)fd;
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		LOG_ERR("Could not add fd %d to epoll (%s)", fd, strerror(errno));
+		return false;
+	}
+
+	handlers[i].fd = fd;
+	handlers[i].timer = timer;
+	handlers[i].cb = cb;
+	handlers[i].write_cb = NULL;
+	return true;
+}
+
+bool event_add_fd(int fd, event_cb cb)
+{
+	return event_add(fd, cb, false);
+}
+
+void event_del_fd(int fd)
+{
+	if (fd < 0)
+		return;
+
+	for (int i = 0; i < MAX_EVENT_HANDLERS; i++) {
+		if (handlers[i].fd == fd) {
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+			handlers[i].fd = -1;
+			handlers[i].cb = NULL;
+			handlers[i].write_cb = NULL;
+			return;
+		}
+	}
+}
+
+/* call cb when fd becomes writable, NULL stops it */
+void event_set_write_cb(int fd, event_cb cb)
+{
+	struct epoll_event ev;
+	int i;
+
+	for (i = 0; i < MAX_EVENT_HANDLERS; i++)
+		if (handlers[i].fd == fd)
+			break;
+
+	if (i == MAX_EVENT_HANDLERS || handlers[i].write_cb == cb)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = cb != NULL ? EPOLLIN | EPOLLOUT : EPOLLIN;
+	ev.data.u64 = (uint64_t)i << 32 | (uint32_t)fd;
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+		LOG_ERR("Could not modify fd %d in epoll (%s)", fd, strerror(errno));
+		return;
+	}
+	handlers[i].write_cb = cb;
+}
+
+/* the timer is created disarmed, use event_timer_set() to start it */
+int event_timer_add(event_cb cb)
+{
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		err(1, "timerfd_create");
+
+	if (!event_add(fd, cb, true)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void event_timer_set(int fd, unsigned int usecs, bool periodic)
+{
+	struct itimerspec its;
+
+	if (fd < 0)
+		return;
+
+	/* a zero value would disarm the timer */
+	if (usecs == 0)
+		usecs = 1;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = usecs / 1000000;
+	its.it_value.tv_nsec = usecs % 1000000 * 1000;
+	if (periodic)
+		its.it_interval = its.it_value;
+
+	if (timerfd_settime(fd, 0, &its, NULL) < 0)
+		LOG_ERR("timerfd_settime failed (%s)", strerror(errno));
+}
+
+/* wait for events and return their number, 0 if interrupted by a signal */
+int event_wait(void)
+{
+	int num = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+	if (num < 0) {
+		if (errno == EINTR)
+			return 0;
+		err(1, "epoll_wait");
+	}
+	return num;
+}
+
+void event_dispatch(int num)
+{
+	struct event_handler* h;
+	uint64_t exp;
+	int fd;
+
+	for (int i = 0; i < num; i++) {
+		h = &handlers[events[i].data.u64 >> 32];
+		fd = (int)(uint32_t)events[i].data.u64;
+
+		/* removed by an earlier callback */
+		if (h->fd != fd || h->cb == NULL)
+			continue;
+
+		if (h->timer && read(fd, &exp, sizeof(exp)) != sizeof(exp))
+			continue;
+
+		if (events[i].events & ~EPOLLOUT)
+			h->cb(fd);
+
+		/* the read callback may have removed it */
+		if ((events[i].events & EPOLLOUT) && h->fd == fd && h->write_cb != NULL)
+			h->write_cb(fd);
+	}
+}
+
+void event_finish(void)
+{
+	for (int i = 0; i < MAX_EVENT_HANDLERS; i++) {
+		if (handlers[i].fd != -1 && handlers[i].timer)
+			close(handlers[i].fd);
+		handlers[i].fd = -1;
+	}
+
+	if (epoll_fd != -1) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+}
@@ -0,0 +1,44 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _EVENT_H_
+#define _EVENT_H_
+
+#include <stdbool.h>
+
+/*
+ * Minimal epoll based event loop. File descriptors are registered with a
+ * callback which is called when they become readable. Timers are timerfds
+ * and are handled the same way, the expiration count is consumed before
+ * the callback is called. A second callback can be set for a file
+ * descriptor, which is called when it becomes writable.
+ */
+typedef void (*event_cb)(int fd);
+
+void event_init(void);
+bool event_add_fd(int fd, event_cb cb);
+void event_del_fd(int fd);
+void event_set_write_cb(int fd, event_cb cb);
+int event_timer_add(event_cb cb);
+void event_timer_set(int fd, unsigned int usecs, bool periodic);
+int event_wait(void);
+void event_dispatch(int num);
+void event_finish(void);
+
+#endif
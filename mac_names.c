@@ -0,0 +1,309 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/*
+ * MAC address to name mapping, read from a dnsmasq dhcp.leases file or a
+ * file of "MAC name" lines.
+ *
+ * The names are kept in a hash table which grows as needed. The file is
+ * watched with inotify and read again when it was changed, a few hundred
+ * lines every time the event loop runs, so the packet processing does not
+ * stall on a large file. Entries are updated in place while reading, so
+ * lookups find the old or new name, and the entries which were not in the
+ * new file are removed at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include <uwifi/util.h>
+#include <uwifi/log.h>
+
+#include "main.h"
+#include "hutil.h"
+#include "event.h"
+#include "pool.h"
+#include "mac_names.h"
+
+/* lines read per run of the event loop when reloading */
+#define MAC_NAMES_BATCH		256
+#define MAC_NAMES_MIN_BITS	8
+
+struct mac_name {
+	struct mac_name*	next;
+	unsigned char		mac[WLAN_MAC_LEN];
+	unsigned char		gen;	/* reload in which it was last read */
+	char			name[MAX_NODE_NAME_STRLEN + 1];
+};
+
+static struct mac_name** table;
+static unsigned int table_bits;
+static unsigned int table_size;	/* 1 << table_bits */
+static unsigned int count;
+static struct pool name_pool;
+
+static char file_path[MAX_CONF_VALUE_STRLEN + 1];
+static char file_name[MAX_CONF_VALUE_STRLEN + 1];
+static FILE* reload_fp;
+static unsigned char reload_gen;
+static bool reload_pending;
+static int inotify_fd = -1;
+static int timer_fd = -1;
+
+static unsigned int mac_hash(const unsigned char* mac, unsigned int bits)
+{
+	uint32_t h = mac[2] | (mac[3] << 8) | (mac[4] << 16) | ((uint32_t)mac[5] << 24);
+
+	h ^= mac[0] | (mac[1] << 8);
+	return (h * 2654435761u) >> (32 - bits);
+}
+
+static void table_resize(unsigned int bits)
+{
+	unsigned int size = 1 << bits;
+	struct mac_name** t;
+	struct mac_name *e, *next;
+	unsigned int i, h;
+
+	t = calloc(size, sizeof(*t));
+	if (t == NULL)
+		return;	/* keep the old one, only the chains get longer */
+
+	for (i = 0; i < table_size; i++) {
+		for (e = table[i]; e != NULL; e = next) {
+			next = e->next;
+			h = mac_hash(e->mac, bits);
+			e->next = t[h];
+			t[h] = e;
+		}
+	}
+	free(table);
+	table = t;
+	table_bits = bits;
+	table_size = size;
+}
+
+static void mac_name_set(const unsigned char* mac, const char* name)
+{
+	struct mac_name** head = &table[mac_hash(mac, table_bits)];
+	struct mac_name* e;
+
+	for (e = *head; e != NULL; e = e->next)
+		if (memcmp(e->mac, mac, WLAN_MAC_LEN) == 0)
+			break;
+
+	if (e == NULL) {
+		e = pool_alloc(&name_pool);
+		if (e == NULL)
+			return;
+		memcpy(e->mac, mac, WLAN_MAC_LEN);
+		e->next = *head;
+		*head = e;
+		if (++count > table_size)
+			table_resize(table_bits + 1);
+	}
+
+	e->gen = reload_gen;
+	strncpy(e->name, name, MAX_NODE_NAME_STRLEN);
+	e->name[MAX_NODE_NAME_STRLEN] = '\0';
+	LOG_DBG("MAC " MAC_FMT " = %s", MAC_PAR(mac), e->name);
+}
+
+/* remove the entries which were not in the file any more */
+static void mac_names_expire(void)
+{
+	struct mac_name **pp, *e;
+
+	for (unsigned int i = 0; i < table_size; i++) {
+		pp = &table[i];
+		while ((e = *pp) != NULL) {
+			if (e->gen != reload_gen) {
+				*pp = e->next;
+				pool_free(&name_pool, e);
+				count--;
+			} else
+				pp = &e->next;
+		}
+	}
+}
+
+/* read up to max lines, returns true when the whole file was read */
+static bool mac_names_read(unsigned int max)
+{
+	char line[255];
+	char macs[18];
+	char name[MAX_NODE_NAME_STRLEN + 1];
+	unsigned char mac[WLAN_MAC_LEN];
+	int n;
+
+	while (max-- > 0) {
+		if (fgets(line, sizeof(line), reload_fp) == NULL)
+			return true;
+		// first try dnsmasq dhcp.leases format
+		n = sscanf(line, "%*s %17s %*s %18s", macs, name);
+		if (n < 2) // if not MAC name
+			n = sscanf(line, "%17s %18s", macs, name);
+		if (n == 2) {
+			convert_string_to_mac(macs, mac);
+			mac_name_set(mac, name);
+		}
+	}
+	return false;
+}
+
+static bool mac_names_open(void)
+{
+	reload_fp = fopen(file_path, "r");
+	if (reload_fp == NULL)
+		return false;
+	reload_gen++;
+	reload_pending = false;
+	return true;
+}
+
+static void mac_names_close(void)
+{
+	fclose(reload_fp);
+	reload_fp = NULL;
+	mac_names_expire();
+	/* shrink after the file got much smaller */
+	while (table_bits > MAC_NAMES_MIN_BITS && count < table_size / 4)
+		table_resize(table_bits - 1);
+}
+
+static void mac_names_timer(__attribute__((unused)) int fd)
+{
+	if (reload_fp == NULL && !mac_names_open())
+		return;	/* try again on the next change */
+
+	if (!mac_names_read(MAC_NAMES_BATCH)) {
+		event_timer_set(timer_fd, 1, false);
+		return;
+	}
+
+	mac_names_close();
+	LOG_DBG("Reloaded %u MAC names from '%s'", count, file_path);
+
+	/* changed again while reading */
+	if (reload_pending)
+		event_timer_set(timer_fd, 1, false);
+}
+
+static void mac_names_inotify(int fd)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event* ev;
+	bool changed = false;
+	ssize_t len;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (char* p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event*)p;
+			if (ev->len > 0 && strcmp(ev->name, file_name) == 0)
+				changed = true;
+		}
+	}
+
+	if (!changed)
+		return;
+
+	if (reload_fp != NULL)
+		reload_pending = true;	/* start again when done */
+	else
+		event_timer_set(timer_fd, 1, false);
+}
+
+bool mac_names_init(const char* filename)
+{
+	char dir[MAX_CONF_VALUE_STRLEN + 1];
+
+	strncpy(file_path, filename, MAX_CONF_VALUE_STRLEN);
+	file_path[MAX_CONF_VALUE_STRLEN] = '\0';
+	/* basename() and dirname() may modify their argument */
+	strcpy(dir, file_path);
+	strcpy(file_name, basename(dir));
+	strcpy(dir, file_path);
+
+	pool_init(&name_pool, "mac_name", sizeof(struct mac_name), 256);
+	table_resize(MAC_NAMES_MIN_BITS);
+	if (table == NULL)
+		return false;
+
+	/* the first time the whole file is read at once */
+	if (mac_names_open()) {
+		mac_names_read(-1);
+		mac_names_close();
+		LOG_INF("Read %u MAC names from '%s'", count, file_path);
+	} else
+		LOG_ERR("Could not open mac name file '%s'", file_path);
+
+	/* watch the directory, as the file is usually replaced by a new one */
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0 ||
+	    inotify_add_watch(inotify_fd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		LOG_ERR("Could not watch mac name file (%s)", strerror(errno));
+		if (inotify_fd >= 0)
+			close(inotify_fd);
+		inotify_fd = -1;
+		return true;
+	}
+	timer_fd = event_timer_add(mac_names_timer);
+	event_add_fd(inotify_fd, mac_names_inotify);
+	return true;
+}
+
+void mac_names_finish(void)
+{
+	if (reload_fp != NULL) {
+		fclose(reload_fp);
+		reload_fp = NULL;
+	}
+	if (inotify_fd >= 0) {
+		event_del_fd(inotify_fd);
+		close(inotify_fd);
+		inotify_fd = -1;
+		event_del_fd(timer_fd);
+		close(timer_fd);
+		timer_fd = -1;
+	}
+	free(table);
+	table = NULL;
+	table_bits = table_size = count = 0;
+	pool_destroy(&name_pool);
+}
+
+const char* mac_names_find(const unsigned char* mac)
+{
+	struct mac_name* e;
+
+	if (table == NULL)
+		return NULL;
+
+	for (e = table[mac_hash(mac, table_bits)]; e != NULL; e = e->next)
+		if (memcmp(e->mac, mac, WLAN_MAC_LEN) == 0)
+			return e->name;
+	return NULL;
+}
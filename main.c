@@ -27,6 +27,7 @@
 #include <errno.h>
 #include <err.h>
 #include <sys/socket.h>
+#include <sys/signalfd.h>
 #include <net/if.h>
 
 #include <uwifi/packet_sock.h>
@@ -48,48 +49,38 @@
 #include "conf_options.h"
 #include "ieee80211_duration.h"
 #include "protocol_parser.h"
+#include "capture.h"
+#include "collector.h"
+#include "bpf_filter.h"
+#include "event.h"
+#include "replay.h"
+#include "pcapfile.h"
+#include "csvfile.h"
+#include "collog.h"
+#include "pool.h"
+#include "nodes.h"
+#include "mac_names.h"
+#include "oui.h"
 
 struct cc_list_head essids;
 struct history hist;
 struct statistics stats;
 struct channel_info spectrum[MAX_CHANNELS];
-struct node_names_info node_names;
+struct pool chan_node_pool;
 
 struct config conf;
 
 struct timespec time_mono;
 struct timespec time_real;
 
-static FILE* DF = NULL;
+/* receive packet buffer for local capture. The buffers for the network
+ * connections, where partial and several packets at once are received, are
+ * in network.c */
+static unsigned char buffer[MAX_PACKET_LEN];
 
-/* receive packet buffer
- *
- * due to the way we receive packets the network (TCP connection) we have to
- * expect the reception of partial packet as well as the reception of several
- * packets at one. thus we implement a buffered receive where partially received
- * data stays in the buffer.
- *
- * we need two buffers: one for packet capture or receiving from the server and
- * another one for data the clients sends to the server.
- *
- * not sure if this is also an issue with local packet capture, but it is not
- * implemented there.
- *
- * size: max 80211 frame (2312) + space for prism2 header (144)
- * or radiotap header (usually only 26) + some extra */
-static unsigned char buffer[2312 + 200];
-static size_t buflen;
-
-/* for packets from client to server */
-static unsigned char cli_buffer[500];
-static size_t cli_buflen;
-
-/* for select */
-static fd_set read_fds;
-static fd_set write_fds;
-static fd_set excpt_fds;
-
-static volatile sig_atomic_t is_sigint_caught;
+static int channel_timer = -1;
+static int display_timer = -1;
+static int second_timer = -1;
 
 void __attribute__ ((format (printf, 2, 3)))
 log_out(enum loglevel level, const char *fmt, ...)
@@ -128,28 +119,68 @@ static void update_history(struct uwifi_packet* p)
 static void update_statistics(struct uwifi_packet* p)
 {
 	int type = (p->phy_flags & PHY_FLAG_BADFCS) ? 1 : p->wlan_type;
+	/* when the server sends only 1 in net_sample data and control frames
+	 * each of them stands for net_sample frames */
+	unsigned int w = WLAN_FRAME_IS_MGMT(p->wlan_type) ? 1 : net_sample;
 
 	if (p->phy_rate_idx == 0)
 		return;
 
-	stats.packets++;
-	stats.bytes += p->wlan_len;
+	stats.packets += w;
+	stats.bytes += w * p->wlan_len;
 	if (p->wlan_retry)
-		stats.retries++;
+		stats.retries += w;
 
 	if (p->phy_rate_idx > 0 && p->phy_rate_idx < MAX_RATES) {
-		stats.duration += p->pkt_duration;
-		stats.packets_per_rate[p->phy_rate_idx]++;
-		stats.bytes_per_rate[p->phy_rate_idx] += p->wlan_len;
-		stats.duration_per_rate[p->phy_rate_idx] += p->pkt_duration;
+		stats.duration += w * p->pkt_duration;
+		stats.packets_per_rate[p->phy_rate_idx] += w;
+		stats.bytes_per_rate[p->phy_rate_idx] += w * p->wlan_len;
+		stats.duration_per_rate[p->phy_rate_idx] += w * p->pkt_duration;
 	}
 
 	if (type >= 0 && type < MAX_FSTYPE) {
-		stats.packets_per_type[type]++;
-		stats.bytes_per_type[type] += p->wlan_len;
+		stats.packets_per_type[type] += w;
+		stats.bytes_per_type[type] += w * p->wlan_len;
 		if (p->phy_rate_idx > 0 && p->phy_rate_idx < MAX_RATES)
-			stats.duration_per_type[type] += p->pkt_duration;
+			stats.duration_per_type[type] += w * p->pkt_duration;
+	}
+}
+
+/* find the node on the channel or add it if not already there.
+ *
+ * This runs for every packet, so we search the few channels the node was
+ * seen on, not the nodes of the channel, which can be hundreds. The channel
+ * found is moved to the front, usually a node stays on one channel and then
+ * it is found at the first try */
+struct chan_node* spectrum_chan_node(struct channel_info* chan, struct uwifi_node* n)
+{
+	struct chan_node* cn;
+
+	cc_list_for_each(&n->on_channels, cn, node_list) {
+		if (cn->chan == chan) {
+			if (cc_list_top(&n->on_channels, struct chan_node, node_list) != cn) {
+				cc_list_del(&cn->node_list);
+				cc_list_add(&n->on_channels, &cn->node_list);
+			}
+			return cn;
+		}
 	}
+
+	LOG_DBG("SPEC node adding %p", n);
+	cn = pool_alloc(&chan_node_pool);
+	if (cn == NULL)
+		return NULL;
+	cn->node = n;
+	cn->chan = chan;
+	cn->sig = 0;
+	cn->packets = 0;
+	ewma_init(&cn->sig_avg, 1024, 8);
+	cc_list_add_tail(&chan->nodes, &cn->chan_list);
+	cc_list_add_tail(&n->on_channels, &cn->node_list);
+	nodes_chan_node_add(cn);
+	chan->num_nodes++;
+	n->num_on_channels++;
+	return cn;
 }
 
 static void update_spectrum(struct uwifi_packet* p, struct uwifi_node* n)
@@ -172,24 +203,10 @@ static void update_spectrum(struct uwifi_packet* p, struct uwifi_node* n)
 		return;
 	}
 
-	/* add node to channel if not already there */
-	cc_list_for_each(&chan->nodes, cn, chan_list) {
-		if (cn->node == n) {
-			LOG_DBG("SPEC node found %p", cn->node);
-			break;
-		}
-	}
-	if (cn->node != n) {
-		LOG_DBG("SPEC node adding %p", n);
-		cn = malloc(sizeof(struct chan_node));
-		cn->node = n;
-		cn->chan = chan;
-		ewma_init(&cn->sig_avg, 1024, 8);
-		cc_list_add_tail(&chan->nodes, &cn->chan_list);
-		cc_list_add_tail(&n->on_channels, &cn->node_list);
-		chan->num_nodes++;
-		n->num_on_channels++;
-	}
+	cn = spectrum_chan_node(chan, n);
+	if (cn == NULL)
+		return;
+
 	/* keep signal of this node as seen on this channel */
 	cn->sig = p->phy_signal;
 	ewma_add(&cn->sig_avg, -cn->sig);
@@ -209,32 +226,6 @@ void update_spectrum_durations(void)
 	}
 }
 
-static void write_to_file(struct uwifi_packet* p)
-{
-	char buf[40];
-	int i;
-	struct tm* ltm = localtime(&time_real.tv_sec);
-
-	//timestamp, e.g. 2015-05-16 15:05:44.338806 +0300
-	i = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", ltm);
-	i += snprintf(buf + i, sizeof(buf) - i, ".%06ld", (long)(time_real.tv_nsec / 1000));
-	i += strftime(buf + i, sizeof(buf) - i, " %z", ltm);
-	fprintf(DF, "%s, ", buf);
-
-	fprintf(DF, "%s, " MAC_FMT ", ",
-		wlan_get_packet_type_name(p->wlan_type), MAC_PAR(p->wlan_ta));
-	fprintf(DF, MAC_FMT ", ", MAC_PAR(p->wlan_ra));
-	fprintf(DF, MAC_FMT ", ", MAC_PAR(p->wlan_bssid));
-	fprintf(DF, "%x, %d, %d, %d, %d, ",
-		p->pkt_types, p->phy_signal, p->wlan_len, p->phy_rate, p->phy_freq);
-	fprintf(DF, "%016llx, ", (unsigned long long)p->wlan_tsf);
-	fprintf(DF, "%s, %d, %d, %d, %d, %d, ",
-		p->wlan_essid, p->wlan_mode, p->wlan_channel,
-		p->wlan_wep, p->wlan_wpa, p->wlan_rsn);
-	fprintf(DF, "%s, %s\n", ip_sprintf(p->ip_src), ip_sprintf(p->ip_dst));
-	fflush(DF);
-}
-
 /* return true if packet is filtered */
 static bool filter_packet(struct uwifi_packet* p)
 {
@@ -296,7 +287,10 @@ static bool filter_packet(struct uwifi_packet* p)
 	return false;
 }
 
-void handle_packet(struct uwifi_packet* p)
+/* raw is the original radiotap frame, it may be NULL if not available. ts is
+ * the capture time of the frame, NULL means now */
+void handle_packet(struct uwifi_packet* p, unsigned char* raw, size_t raw_len,
+		   const struct timespec* ts)
 {
 	struct uwifi_node* n = NULL;
 
@@ -309,11 +303,17 @@ void handle_packet(struct uwifi_packet* p)
 
 	uwifi_fixup_packet_channel(p, &conf.intf);
 
-	if (cli_fd != -1)
+	if (net_num_clients > 0 || mcast_fd != -1)
 		net_send_packet(p);
 
-	if (conf.dumpfile[0] != '\0' && !conf.paused && DF != NULL)
-		write_to_file(p);
+	if (conf.dumpfile[0] != '\0' && !conf.paused) {
+		if (conf.outfile_format == OUTFILE_PCAP)
+			pcapfile_write(raw, raw_len, ts);
+		else if (conf.outfile_format == OUTFILE_COLUMN)
+			collog_write(p);
+		else
+			csvfile_write(p);
+	}
 
 	if (conf.paused)
 		return;
@@ -324,9 +324,7 @@ void handle_packet(struct uwifi_packet* p)
 			wlan_get_packet_type_name(p->wlan_type),
 			MAC_PAR(p->wlan_ta), MAC_PAR(p->wlan_bssid));
 
-		n = uwifi_node_update(p, &conf.intf.wlan_nodes);
-		if (n)
-			uwifi_nodes_find_ap(n, &conf.intf.wlan_nodes);
+		n = nodes_update(p);
 
 		p->pkt_duration = ieee80211_frame_duration(
 				p->phy_flags & PHY_FLAG_MODE_MASK,
@@ -344,128 +342,167 @@ void handle_packet(struct uwifi_packet* p)
 
 	if (!conf.quiet && !conf.debug)
 		update_display(p);
+
+	nodes_limit();
 }
 
-static void local_receive_packet(int fd, unsigned char* buffer, size_t bufsize)
+void handle_raw_packet(unsigned char* buf, size_t len, const struct timespec* ts)
 {
 	struct uwifi_packet p;
 
-	LOG_DBG("===============================================================================");
-
-	ssize_t len = packet_socket_recv(fd, buffer, bufsize);
-	if (len <= 0) {
-		LOG_DBG("recv error");
-		return;
-	}
-
 #if DEBUG
 	if (conf.debug) {
-		dump_hex(buffer, len, NULL);
+		dump_hex(buf, len, NULL);
 	}
 #endif
 	memset(&p, 0, sizeof(p));
 
-	if (!parse_packet(buffer, len, &p)) {
+	if (!parse_packet(buf, len, &p)) {
 		LOG_DBG("parsing failed");
 		return;
 	}
 
-	handle_packet(&p);
+	handle_packet(&p, buf, len, ts);
 }
 
-static void receive_any(const sigset_t *const waitmask)
+static void local_receive_packet(int fd, unsigned char* buffer, size_t bufsize)
 {
-	int ret, mfd;
-	uint32_t usecs = UINT32_MAX;
-	struct timespec ts;
+	LOG_DBG("===============================================================================");
 
-	FD_ZERO(&read_fds);
-	FD_ZERO(&write_fds);
-	FD_ZERO(&excpt_fds);
-	if (!conf.quiet && !conf.debug)
-		FD_SET(0, &read_fds);
-	FD_SET(conf.intf.sock, &read_fds);
-	if (srv_fd != -1)
-		FD_SET(srv_fd, &read_fds);
-	if (cli_fd != -1)
-		FD_SET(cli_fd, &read_fds);
-	if (ctlpipe != -1)
-		FD_SET(ctlpipe, &read_fds);
+	ssize_t len = packet_socket_recv(fd, buffer, bufsize);
+	if (len <= 0) {
+		LOG_DBG("recv error");
+		return;
+	}
 
-	usecs = MIN(uwifi_channel_get_remaining_dwell_time(&conf.intf), 1000000);
-	ts.tv_sec = usecs / 1000000;
-	ts.tv_nsec = usecs % 1000000 * 1000;
-	mfd = MAX(conf.intf.sock, srv_fd);
-	mfd = MAX(mfd, ctlpipe);
-	mfd = MAX(mfd, cli_fd) + 1;
+	handle_raw_packet(buffer, len, NULL);
+}
 
-	ret = pselect(mfd, &read_fds, &write_fds, &excpt_fds, &ts, waitmask);
-	if (ret == -1 && errno == EINTR) /* interrupted */
-		return;
-	if (ret == 0) { /* timeout */
-		if (!conf.quiet && !conf.debug)
-			update_display_clock();
-		return;
+static void receive_local(int fd)
+{
+	if (conf.serveraddr[0] != '\0') {
+		/* drain what is available, but at most recv_batch reads */
+		for (unsigned int i = 0; i < conf.recv_batch; i++) {
+			if (net_receive(fd) < 0)
+				break;
+		}
 	}
-	else if (ret < 0) /* error */
-		err(1, "select()");
+	else if (conf.capture_mode == CAPTURE_RING)
+		capture_ring_receive();
+	else if (conf.capture_mode == CAPTURE_MMSG)
+		capture_mmsg_receive(fd);
+	else
+		local_receive_packet(fd, buffer, sizeof(buffer));
+}
 
-	/* stdin */
-	if (FD_ISSET(0, &read_fds) && !conf.quiet && !conf.debug)
-		handle_user_input();
+static void receive_capture_queue(__attribute__((unused)) int fd)
+{
+	capture_queue_process();
+}
 
-	/* local packet or client */
-	if (FD_ISSET(conf.intf.sock, &read_fds)) {
-		if (conf.serveraddr[0] != '\0')
-			net_receive(conf.intf.sock, buffer, &buflen, sizeof(buffer));
-		else
-			local_receive_packet(conf.intf.sock, buffer, sizeof(buffer));
+static void receive_collector_queue(__attribute__((unused)) int fd)
+{
+	collector_queue_process();
+}
+
+static void receive_user_input(__attribute__((unused)) int fd)
+{
+	handle_user_input();
+}
+
+static void receive_control(__attribute__((unused)) int fd)
+{
+	control_receive_command();
+}
+
+static void receive_signal(int fd)
+{
+	struct signalfd_siginfo si;
+
+	if (read(fd, &si, sizeof(si)) == sizeof(si))
+		exit(2);
+}
+
+static void channel_timer_handler(int fd)
+{
+	if (!conf.paused) {
+		int ret = uwifi_channel_auto_change(&conf.intf);
+		if (ret == 1) {
+			net_send_channel_config();
+			update_spectrum_durations();
+			if (!conf.quiet && !conf.debug)
+				update_display(NULL);
+
+			if (conf.intf.channel_idx == uwifi_channel_idx_from_freq(&conf.intf.channels, conf.intf.channel_set.freq)
+			    && conf.intf.channel_scan_rounds > 0)
+				--conf.intf.channel_scan_rounds;
+		} else if (ret == -1) {
+			LOG_ERR("Channel change failed. Disabling scan on '%s'",
+				 conf.intf.ifname);
+			conf.intf.channel_scan = false;
+			update_display(NULL);
+		}
 	}
 
-	/* server */
-	if (srv_fd > -1 && FD_ISSET(srv_fd, &read_fds))
-		net_handle_server_conn();
+	/* check at least every second, scanning may be enabled at runtime */
+	event_timer_set(fd, MIN(uwifi_channel_get_remaining_dwell_time(&conf.intf),
+				1000000), false);
+}
+
+static void display_timer_handler(__attribute__((unused)) int fd)
+{
+	update_display_clock();
+}
+
+static void second_timer_handler(__attribute__((unused)) int fd)
+{
+	/* when replaying nodes time out by capture time, see replay.c */
+	if (conf.replay_file[0] == '\0')
+		nodes_timeout();
 
-	/* from client to server */
-	if (cli_fd > -1 && FD_ISSET(cli_fd, &read_fds))
-		net_receive(cli_fd, cli_buffer, &cli_buflen, sizeof(cli_buffer));
+	if (collector_active())
+		collector_timeout();
 
-	/* named pipe */
-	if (ctlpipe > -1 && FD_ISSET(ctlpipe, &read_fds))
-		control_receive_command();
+	pcapfile_flush();
+	collog_flush();
+	csvfile_stats_collect();
 }
 
 void free_lists(void)
 {
-	struct chan_node *cn, *cn2;
-
-	/* free channel nodes */
-	for (int i = 0; i < uwifi_channel_get_num_channels(&conf.intf.channels); i++) {
-		cc_list_for_each_safe(&spectrum[i].nodes, cn, cn2, chan_list) {
-			LOG_DBG("free chan_node %p", cn);
-			cc_list_del(&cn->chan_list);
-			cn->chan->num_nodes--;
-			free(cn);
-		}
+	/* free all channel nodes at once */
+	pool_reset(&chan_node_pool);
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		cc_list_head_init(&spectrum[i].nodes);
+		spectrum[i].num_nodes = 0;
 	}
 
-	uwifi_nodes_free(&conf.intf.wlan_nodes);
+	nodes_free();
 	uwifi_essids_free(&essids);
 }
 
 static void exit_handler(void)
 {
 	free_lists();
+	pool_destroy(&chan_node_pool);
+
+	capture_thread_stop();
+	capture_finish();
+	collector_finish();
+	replay_finish();
+	mac_names_finish();
+	oui_close();
+
+	event_finish();
 
 	uwifi_fini(&conf.intf);
 
 	if (conf.monitor_added)
 		ifctrl_iwdel(conf.intf.ifname);
 
-	if (DF != NULL) {
-		fclose(DF);
-		DF = NULL;
-	}
+	csvfile_close();
+	pcapfile_close();
+	collog_close();
 
 	if (conf.allow_control)
 		control_finish();
@@ -479,14 +516,6 @@ static void exit_handler(void)
 	ifctrl_finish();
 }
 
-static void sigint_handler(__attribute__((unused)) int sig)
-{
-	/* Only set an atomic flag here to keep processing in the interrupt
-	 * context as minimal as possible (at least all unsafe functions are
-	 * prohibited, see signal(7)). The flag is handled in the mainloop. */
-	is_sigint_caught = 1;
-}
-
 static void sigpipe_handler(__attribute__((unused)) int sig)
 {
 	/* ignore signal here - we will handle it after write failed */
@@ -503,52 +532,14 @@ void init_spectrum(void)
 	}
 }
 
-static void mac_name_file_read(const char* filename)
-{
-	FILE* fp;
-	char line[255];
-	char macs[18];
-	char name[18];
-	int idx = 0;
-	int n;
-
-	if ((fp = fopen(filename, "r")) == NULL) {
-		LOG_ERR("Could not open mac name file '%s'", filename);
-		return;
-	}
-
-	while (fgets(line, sizeof(line), fp) != NULL) {
-		// first try dnsmasq dhcp.leases format
-		n = sscanf(line, "%*s %17s %*s %17s", macs, name);
-		if (n < 2) // if not MAC name
-			n = sscanf(line, "%17s %17s", macs, name);
-		if (n == 2) {
-			convert_string_to_mac(macs, node_names.entry[idx].mac);
-			strncpy(node_names.entry[idx].name, name, MAX_NODE_NAME_STRLEN);
-			node_names.entry[idx].name[MAX_NODE_NAME_STRLEN] = '\0';
-			idx++;
-		}
-	}
-
-	fclose(fp);
-
-	node_names.count = idx;
-
-	for (n = 0; n < node_names.count; n++) {
-		LOG_INF("MAC " MAC_FMT " = %s", MAC_PAR(node_names.entry[n].mac),
-			 node_names.entry[n].name );
-	}
-}
-
 const char* mac_name_lookup(const unsigned char* mac, int shorten_mac)
 {
-	int i;
-	if (conf.mac_name_lookup) {
-		for (i = 0; i < node_names.count; i++) {
-			if (memcmp(node_names.entry[i].mac, mac, WLAN_MAC_LEN) == 0)
-				return node_names.entry[i].name;
-		}
-	}
+	const char* name;
+
+	if (nodes_is_random_bucket(mac))
+		return "RANDOM MACs";
+	if (conf.mac_name_lookup && (name = mac_names_find(mac)) != NULL)
+		return name;
 	return shorten_mac ? mac_sprint_short(mac) : mac_sprint(mac);
 }
 
@@ -572,28 +563,39 @@ static void generate_mon_ifname(char *const buf, const size_t buf_size)
 
 int main(int argc, char** argv)
 {
-	sigset_t workmask;
-	sigset_t waitmask;
-	struct sigaction sigint_action;
+	sigset_t sigmask;
 	struct sigaction sigpipe_action;
+	int sig_fd;
 
 	cc_list_head_init(&essids);
+	pool_init(&chan_node_pool, "chan_node", sizeof(struct chan_node), 256);
+	nodes_init();
 	init_spectrum();
 
 	config_parse_file_and_cmdline(argc, argv);
 
-	sigint_action.sa_handler = sigint_handler;
-	sigemptyset(&sigint_action.sa_mask);
-	sigint_action.sa_flags = 0;
-	sigaction(SIGINT, &sigint_action, NULL);
-	sigaction(SIGTERM, &sigint_action, NULL);
-	sigaction(SIGHUP, &sigint_action, NULL);
+	/* SIGINT, SIGTERM and SIGHUP are blocked and only received thru a
+	 * signalfd in the event loop. Block them before the capture thread is
+	 * started, so they are never delivered to it. */
+	if (sigemptyset(&sigmask)                  == -1 ||
+	    sigaddset(&sigmask, SIGINT)            == -1 ||
+	    sigaddset(&sigmask, SIGHUP)            == -1 ||
+	    sigaddset(&sigmask, SIGTERM)           == -1 ||
+	    sigprocmask(SIG_BLOCK, &sigmask, NULL) == -1)
+		err(1, "failed to block signals: %m");
 
 	sigpipe_action.sa_handler = sigpipe_handler;
 	sigaction(SIGPIPE, &sigpipe_action, NULL);
 
 	atexit(exit_handler);
 
+	event_init();
+
+	sig_fd = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sig_fd < 0)
+		err(1, "signalfd");
+	event_add_fd(sig_fd, receive_signal);
+
 	clock_gettime(CLOCK_MONOTONIC, &stats.stats_time);
 	clock_gettime(CLOCK_MONOTONIC, &time_mono);
 	clock_gettime(CLOCK_REALTIME, &time_real);
@@ -601,16 +603,32 @@ int main(int argc, char** argv)
 	conf.intf.channel_idx = -1;
 
 	if (conf.mac_name_lookup)
-		mac_name_file_read(conf.mac_name_file);
+		mac_names_init(conf.mac_name_file);
+
+	if (conf.oui_file[0] != '\0')
+		oui_open(conf.oui_file);
 
 	if (conf.allow_control) {
 		LOG_INF("Allowing control socket '%s'", conf.control_pipe);
 		control_init_pipe();
 	}
 
-	if (conf.serveraddr[0] != '\0') {
+	if (strchr(conf.serveraddr, ',') != NULL) {
+		/* more than one server: collector mode */
+		if (!collector_init(conf.serveraddr, conf.port))
+			exit(1);
+		cc_list_head_init(&conf.intf.wlan_nodes);
+		if (conf.outfile_format == OUTFILE_PCAP && conf.dumpfile[0] != '\0')
+			LOG_ERR("pcap outfile needs the original frames, not written in client mode");
+	} else if (conf.serveraddr[0] != '\0') {
 		conf.intf.sock = net_open_client_socket(conf.serveraddr, conf.port);
 		cc_list_head_init(&conf.intf.wlan_nodes);
+		if (conf.outfile_format == OUTFILE_PCAP && conf.dumpfile[0] != '\0')
+			LOG_ERR("pcap outfile needs the original frames, not written in client mode");
+	} else if (conf.replay_file[0] != '\0') {
+		cc_list_head_init(&conf.intf.wlan_nodes);
+		if (!replay_init(conf.replay_file))
+			exit(1);
 	} else {
 		ifctrl_init();
 		ifctrl_iwget_interface_info(&conf.intf);
@@ -639,8 +657,18 @@ int main(int argc, char** argv)
 
 		uwifi_init(&conf.intf);
 
-		if (conf.recv_buffer_size)
+		if ((conf.capture_mode == CAPTURE_RING &&
+		     !capture_ring_init(conf.intf.sock)) ||
+		    (conf.capture_mode == CAPTURE_MMSG &&
+		     !capture_mmsg_init(conf.intf.sock))) {
+			LOG_ERR("Falling back to normal receive");
+			conf.capture_mode = CAPTURE_RECV;
+		}
+
+		if (conf.recv_buffer_size && conf.capture_mode != CAPTURE_RING)
 			socket_set_receive_buffer(conf.intf.sock, conf.recv_buffer_size);
+
+		bpf_filter_init(conf.intf.sock);
 	}
 
 	printf("Max PHY rate: %d Mbps\n", conf.intf.max_phy_rate/10);
@@ -651,48 +679,54 @@ int main(int argc, char** argv)
 	if (conf.serveraddr[0] == '\0' && conf.port && conf.allow_client)
 		net_init_server_socket(conf.port);
 
-	/* Race-free signal handling:
-	 *   1. block all handled signals while working (with workmask)
-	 *   2. receive signals *only* while waiting in pselect() (with waitmask)
-	 *   3. switch between these two masks atomically with pselect()
-	 */
-	if (sigemptyset(&workmask)                       == -1 ||
-	    sigaddset(&workmask, SIGINT)                 == -1 ||
-	    sigaddset(&workmask, SIGHUP)                 == -1 ||
-	    sigaddset(&workmask, SIGTERM)                == -1 ||
-	    sigprocmask(SIG_BLOCK, &workmask, &waitmask) == -1)
-		err(1, "failed to block signals: %m");
+	if (!conf.quiet && !conf.debug) {
+		event_add_fd(0, receive_user_input);
+		display_timer = event_timer_add(display_timer_handler);
+		event_timer_set(display_timer, 1000000, true);
+	}
+
+	if (ctlpipe != -1)
+		event_add_fd(ctlpipe, receive_control);
+
+	if (conf.replay_file[0] != '\0') {
+		/* node timeouts follow the capture clock, see replay.c */
+		replay_start();
+	} else if (collector_active()) {
+		event_add_fd(collector_event_fd, receive_collector_queue);
+	} else {
+		if (conf.capture_thread && conf.serveraddr[0] == '\0') {
+			if (capture_thread_start())
+				event_add_fd(capture_event_fd, receive_capture_queue);
+			else
+				LOG_ERR("Receiving packets in main thread");
+		}
+
+		if (capture_event_fd == -1)
+			event_add_fd(conf.intf.sock, receive_local);
+	}
+
+	second_timer = event_timer_add(second_timer_handler);
+	event_timer_set(second_timer, 1000000, true);
+
+	/* channels are only changed on the server or local side */
+	if (conf.serveraddr[0] == '\0' && conf.replay_file[0] == '\0') {
+		channel_timer = event_timer_add(channel_timer_handler);
+		event_timer_set(channel_timer, MIN(uwifi_channel_get_remaining_dwell_time(&conf.intf),
+						   1000000), false);
+	}
 
 	while (!conf.intf.channel_scan || conf.intf.channel_scan_rounds != 0)
 	{
-		receive_any(&waitmask);
-
-		if (is_sigint_caught)
-			exit(2);
-
-		clock_gettime(CLOCK_MONOTONIC, &time_mono);
-		clock_gettime(CLOCK_REALTIME, &time_real);
-		uwifi_nodes_timeout(&conf.intf.wlan_nodes, conf.node_timeout,
-				    &conf.intf.last_nodetimeout);
-
-		if (conf.serveraddr[0] == '\0' /* server */ && !conf.paused) {
-			int ret = uwifi_channel_auto_change(&conf.intf);
-			if (ret == 1) {
-				net_send_channel_config();
-				update_spectrum_durations();
-				if (!conf.quiet && !conf.debug)
-					update_display(NULL);
-
-				if (conf.intf.channel_idx == uwifi_channel_idx_from_freq(&conf.intf.channels, conf.intf.channel_set.freq)
-				    && conf.intf.channel_scan_rounds > 0)
-					--conf.intf.channel_scan_rounds;
-			} else if (ret == -1) {
-				LOG_ERR("Channel change failed. Disabling scan on '%s'",
-					 conf.intf.ifname);
-				conf.intf.channel_scan = false;
-				update_display(NULL);
-			}
+		int num = event_wait();
+
+		/* update the clock once per wakeup for all events handled,
+		 * when replaying it is set from the capture timestamps */
+		if (conf.replay_file[0] == '\0') {
+			clock_gettime(CLOCK_MONOTONIC, &time_mono);
+			clock_gettime(CLOCK_REALTIME, &time_real);
 		}
+
+		event_dispatch(num);
 	}
 	return 0;
 }
@@ -719,10 +753,9 @@ void main_reset(void)
 
 void dumpfile_open(const char* name)
 {
-	if (DF != NULL) {
-		fclose(DF);
-		DF = NULL;
-	}
+	csvfile_close();
+	pcapfile_close();
+	collog_close();
 
 	if (name == NULL || strlen(name) == 0) {
 		LOG_INF("- Not writing outfile");
@@ -730,15 +763,25 @@ void dumpfile_open(const char* name)
 		return;
 	}
 
-	strncpy(conf.dumpfile, name, MAX_CONF_VALUE_STRLEN);
-	conf.dumpfile[MAX_CONF_VALUE_STRLEN] = '\0';
-	DF = fopen(conf.dumpfile, "w");
-	if (DF == NULL)
-		err(1, "Couldn't open dump file");
+	if (name != conf.dumpfile) {
+		strncpy(conf.dumpfile, name, MAX_CONF_VALUE_STRLEN);
+		conf.dumpfile[MAX_CONF_VALUE_STRLEN] = '\0';
+	}
+
+	if (conf.outfile_format == OUTFILE_PCAP) {
+		if (!pcapfile_open(conf.dumpfile))
+			err(1, "Couldn't open dump file");
+		return;
+	}
 
-	fprintf(DF, "TIME, WLAN TYPE, MAC SRC, MAC DST, BSSID, PACKET TYPES, SIGNAL, ");
-	fprintf(DF, "LENGTH, PHY RATE, FREQUENCY, TSF, ESSID, MODE, CHANNEL, ");
-	fprintf(DF, "WEP, WPA1, RSN (WPA2), IP SRC, IP DST\n");
+	if (conf.outfile_format == OUTFILE_COLUMN) {
+		if (!collog_open(conf.dumpfile))
+			err(1, "Couldn't open dump file");
+		return;
+	}
+
+	if (!csvfile_open(conf.dumpfile))
+		err(1, "Couldn't open dump file");
 
 	LOG_INF("- Writing to outfile %s", conf.dumpfile);
 }
@@ -32,6 +32,8 @@
 #include <uwifi/conf.h>
 #include <uwifi/platform.h>
 
+#include "pool.h"
+
 #define CONFIG_FILE "/etc/horst.conf"
 
 #define MAX_HISTORY		255
@@ -39,7 +41,6 @@
 #define MAX_FSTYPE		0xff
 
 #define MAX_NODE_NAME_STRLEN	18
-#define MAX_NODE_NAMES		64
 
 /* higher level packet types */
 #define PKT_TYPE_ARP		BIT(0)
@@ -56,22 +57,64 @@
 				 PKT_TYPE_OLSR | PKT_TYPE_BATMAN | PKT_TYPE_MESHZ)
 
 #define DEFAULT_MAC_NAME_FILE	"/tmp/dhcp.leases"
+#define DEFAULT_OUI_FILE	"/usr/share/horst/oui.bin"
 
 #define MAX_CONF_VALUE_STRLEN	200
 #define MAX_CONF_NAME_STRLEN	32
 #define MAX_FILTERMAC		9
 
+/* packet capture method */
+#define CAPTURE_RECV		0	/* one recv() per packet */
+#define CAPTURE_RING		1	/* TPACKET_V3 mmap ring */
+#define CAPTURE_MMSG		2	/* batches with recvmmsg() */
+
+/* outfile format */
+#define OUTFILE_CSV		0
+#define OUTFILE_PCAP		1
+#define OUTFILE_COLUMN		2
+
+/* max 80211 frame (2312) + space for prism2 header (144)
+ * or radiotap header (usually only 26) + some extra */
+#define MAX_PACKET_LEN		(2312 + 200)
+
+/* histogram of packets received per wakeup: 1, 2-3, 4-7, ... 128+ */
+#define MAX_BATCH_HIST		8
+
 struct config {
 	struct uwifi_interface	intf;
 	int			port;
+	unsigned int		server_flush;		/* ms */
+	unsigned int		server_batch;
+	int			server_compress;
+	unsigned int		server_summary;		/* ms */
+	unsigned int		server_sample_max;
+	char			server_mcast[MAX_CONF_VALUE_STRLEN + 1];
+	char			server_mcast_if[MAX_CONF_VALUE_STRLEN + 1];
 	int			quiet;
 	int			display_interval;
 	char			display_view;
 	char			dumpfile[MAX_CONF_VALUE_STRLEN + 1];
+	int			outfile_format;
+	unsigned int		outfile_snaplen;
+	unsigned int		outfile_rotate_size;	/* MB */
+	unsigned int		outfile_rotate_time;	/* sec */
+	unsigned int		outfile_queue;
+	unsigned int		outfile_flush;		/* ms */
 	int			recv_buffer_size;
+	int			capture_mode;
+	unsigned int		ring_block_size;
+	unsigned int		ring_blocks;
+	unsigned int		ring_timeout;
+	unsigned int		recv_batch;
+	unsigned int		capture_queue;
 	char			serveraddr[MAX_CONF_VALUE_STRLEN + 1];
 	char			control_pipe[MAX_CONF_VALUE_STRLEN + 1];
 	char			mac_name_file[MAX_CONF_VALUE_STRLEN + 1];
+	char			oui_file[MAX_CONF_VALUE_STRLEN + 1];
+	char			replay_file[MAX_CONF_VALUE_STRLEN + 1];
+	float			replay_speed;
+	time_t			query_from;
+	time_t			query_to;
 
 	unsigned char		filtermac[MAX_FILTERMAC][WLAN_MAC_LEN];
 	char			filtermac_enabled[MAX_FILTERMAC];
@@ -86,12 +129,17 @@ struct config {
 				debug:1,
 				mac_name_lookup:1,
 				add_monitor:1,
+				capture_thread:1,
+				node_random_bucket:1,
+				client_summary:1,
+				client_mcast:1,
 	/* this isn't exactly config, but wtf... */
 				do_macfilter:1,
 				display_initialized:1,
 				monitor_added:1;
 	int			paused;
 	unsigned int		node_timeout;
+	unsigned int		node_max;
 };
 
 extern struct config conf;
@@ -122,6 +170,43 @@ struct statistics {
 
 	unsigned long		filtered_packets;
 
+	/* kernel counters of the mmap ring */
+	unsigned long		ring_packets;
+	unsigned long		ring_drops;
+	unsigned long		ring_freezes;
+
+	/* packets per recvmmsg() call */
+	unsigned long		batch_hist[MAX_BATCH_HIST];
+
+	/* queue from capture thread to main thread */
+	unsigned long		queue_drops;
+	unsigned long		queue_max;
+
+	/* outfile */
+	unsigned long		outfile_bytes;
+	unsigned long		outfile_stalls;
+	unsigned long		outfile_queue_drops;
+	unsigned long		outfile_queue_max;
+
+	/* packet infos not sent to slow network clients */
+	unsigned long		net_drops;
+	/* batches of packet infos sent to network clients */
+	unsigned long		net_flushes;
+	unsigned long		net_flush_records;
+	/* compressed blocks sent to network clients */
+	unsigned long		net_comp_blocks;
+	unsigned long		net_comp_in;
+	unsigned long		net_comp_out;
+	unsigned long		net_comp_nsec;
+	/* multicast datagrams sent by the server / lost in client mode */
+	unsigned long		net_mcast_sent;
+	unsigned long		net_mcast_lost;
+	unsigned long		net_sampled;
+
+	/* node list limit */
+	unsigned long		node_evictions;
+	unsigned long		node_random_probes;
+
 	struct timespec		stats_time;
 };
 
@@ -148,30 +233,27 @@ struct chan_node {
 	struct channel_info*	chan;
 	struct cc_list_node	chan_list;	/* list for nodes per channel */
 	struct cc_list_node	node_list;	/* list for channels per node */
+	struct cc_list_node	expire_list;	/* timeout wheel, see nodes.c */
+	time_t			seen;		/* last_seen of node when linked */
 	int			sig;
 	struct ewma		sig_avg;
 	unsigned long		packets;
 };
 
-struct node_names_info {
-	struct node_name {
-		unsigned char	mac[WLAN_MAC_LEN];
-		char		name[MAX_NODE_NAME_STRLEN + 1];
-	} entry[MAX_NODE_NAMES];
-	int count;
-};
-
-extern struct node_names_info node_names;
-
 extern struct timespec time_mono;
 extern struct timespec time_real;
 
 extern struct cc_list_head essids;
 
+extern struct pool chan_node_pool;
+
 void free_lists(void);
 void init_spectrum(void);
 void update_spectrum_durations(void);
-void handle_packet(struct uwifi_packet* p);
+struct chan_node* spectrum_chan_node(struct channel_info* chan, struct uwifi_node* n);
+void handle_packet(struct uwifi_packet* p, unsigned char* raw, size_t raw_len,
+		   const struct timespec* ts);
+void handle_raw_packet(unsigned char* buf, size_t len, const struct timespec* ts);
 void main_pause(int pause);
 void main_reset(void);
 void dumpfile_open(const char* name);
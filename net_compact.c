@@ -0,0 +1,445 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Compact encoding of packet infos for protocol version 5.
+ *
+ * Both ends of a connection keep the same state: a direct mapped dictionary
+ * of MAC addresses and one of ESSIDs, and the last record of each
+ * transmitter (by its dictionary slot). A record is:
+ *
+ *	varint	bitmap of fields which differ from the last record of the TA
+ *	mac	TA
+ *	...	the fields in the bitmap, in the order of enum compact_field
+ *
+ * A MAC or ESSID is sent as varint (slot << 1 | new), followed by the
+ * address or length and ESSID if it was not in the slot before. Signal,
+ * sequence number and TSF are sent as zigzag varint delta, IP addresses as
+ * 4 bytes and everything else as varint.
+ *
+ * Since the state only changes in the same way on both ends, records must
+ * be decoded in the order they were encoded.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <uwifi/wlan80211.h>
+#include <uwifi/wlan_parser.h>
+
+#include "net_compact.h"
+
+#define MAC_DICT_BITS		11
+#define MAC_DICT_SIZE		(1 << MAC_DICT_BITS)
+#define ESSID_DICT_SIZE		256
+
+#define FLAG_WEP		0x01
+#define FLAG_RETRY		0x02
+#define FLAG_WPA		0x04
+#define FLAG_RSN		0x08
+#define FLAG_HT40PLUS		0x10
+#define FLAG_BAT_GW		0x20
+
+/* ordered by how often they change */
+enum compact_field {
+	CF_SIGNAL, CF_SEQNO, CF_TSF, CF_LEN, CF_TYPE, CF_PKT_TYPES, CF_RATE,
+	CF_RA, CF_NAV, CF_FLAGS, CF_BSSID, CF_RATE_IDX, CF_RATE_FLAGS,
+	CF_FREQ, CF_PHY_FLAGS, CF_QOS_CLASS, CF_ESSID, CF_BINTVAL, CF_MODE,
+	CF_CHANNEL, CF_CHAN_WIDTH, CF_TX_STREAMS, CF_RX_STREAMS, CF_IP_SRC,
+	CF_IP_DST, CF_PORT, CF_OLSR_TYPE, CF_OLSR_NEIGH, CF_OLSR_TC,
+	CF_BAT_PKT_TYPE,
+	CF_NUM
+};
+
+enum compact_kind {
+	CK_VARINT,
+	CK_DELTA,
+	CK_RAW32,
+	CK_MAC,
+	CK_ESSID,
+};
+
+static const unsigned char field_kind[CF_NUM] = {
+	[CF_SIGNAL] = CK_DELTA,
+	[CF_SEQNO] = CK_DELTA,
+	[CF_TSF] = CK_DELTA,
+	[CF_RA] = CK_MAC,
+	[CF_BSSID] = CK_MAC,
+	[CF_ESSID] = CK_ESSID,
+	[CF_IP_SRC] = CK_RAW32,
+	[CF_IP_DST] = CK_RAW32,
+};
+
+struct compact_rec {
+	uint64_t	v[CF_NUM];	/* MACs packed into 48 bit */
+	char		essid[WLAN_MAX_SSID_LEN + 1];
+};
+
+struct net_compact {
+	uint64_t		mac[MAC_DICT_SIZE];
+	char			essid[ESSID_DICT_SIZE][WLAN_MAX_SSID_LEN + 1];
+	struct compact_rec	last[MAC_DICT_SIZE];
+};
+
+struct net_compact* net_compact_new(void)
+{
+	return calloc(1, sizeof(struct net_compact));
+}
+
+void net_compact_free(struct net_compact* s)
+{
+	free(s);
+}
+
+/* forget all previous records, like a new state */
+void net_compact_reset(struct net_compact* s)
+{
+	memset(s, 0, sizeof(*s));
+}
+
+static uint64_t mac_pack(const unsigned char* mac)
+{
+	uint64_t v = 0;
+	for (int i = 0; i < WLAN_MAC_LEN; i++)
+		v = v << 8 | mac[i];
+	return v;
+}
+
+static void mac_unpack(uint64_t v, unsigned char* mac)
+{
+	for (int i = WLAN_MAC_LEN - 1; i >= 0; i--) {
+		mac[i] = v & 0xff;
+		v >>= 8;
+	}
+}
+
+static unsigned int mac_slot(uint64_t v)
+{
+	return (v * 0x9e3779b97f4a7c15ULL) >> (64 - MAC_DICT_BITS);
+}
+
+static unsigned int essid_slot(const char* essid)
+{
+	uint32_t h = 2166136261u;
+	while (*essid)
+		h = (h ^ (unsigned char)*essid++) * 16777619u;
+	return h % ESSID_DICT_SIZE;
+}
+
+static unsigned char* put_varint(unsigned char* b, uint64_t v)
+{
+	while (v >= 0x80) {
+		*b++ = v | 0x80;
+		v >>= 7;
+	}
+	*b++ = v;
+	return b;
+}
+
+static bool get_varint(const unsigned char** b, const unsigned char* end, uint64_t* v)
+{
+	unsigned int shift = 0;
+
+	*v = 0;
+	while (*b < end && shift < 64) {
+		*v |= (uint64_t)(**b & 0x7f) << shift;
+		if (!(*(*b)++ & 0x80))
+			return true;
+		shift += 7;
+	}
+	return false;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static unsigned char* put_mac(struct net_compact* s, unsigned char* b, uint64_t mac)
+{
+	unsigned int slot = mac_slot(mac);
+
+	if (s->mac[slot] == mac)
+		return put_varint(b, slot << 1);
+
+	s->mac[slot] = mac;
+	b = put_varint(b, slot << 1 | 1);
+	mac_unpack(mac, b);
+	return b + WLAN_MAC_LEN;
+}
+
+static bool get_mac(struct net_compact* s, const unsigned char** b,
+		    const unsigned char* end, uint64_t* mac)
+{
+	uint64_t ref;
+
+	if (!get_varint(b, end, &ref) || (ref >> 1) >= MAC_DICT_SIZE)
+		return false;
+
+	if (ref & 1) {
+		if (end - *b < WLAN_MAC_LEN)
+			return false;
+		s->mac[ref >> 1] = mac_pack(*b);
+		*b += WLAN_MAC_LEN;
+	}
+	*mac = s->mac[ref >> 1];
+	return true;
+}
+
+static unsigned char* put_essid(struct net_compact* s, unsigned char* b, const char* essid)
+{
+	unsigned int slot = essid_slot(essid);
+	size_t len;
+
+	if (strcmp(s->essid[slot], essid) == 0)
+		return put_varint(b, slot << 1);
+
+	strcpy(s->essid[slot], essid);
+	len = strlen(essid);
+	b = put_varint(b, slot << 1 | 1);
+	*b++ = len;
+	memcpy(b, essid, len);
+	return b + len;
+}
+
+static bool get_essid(struct net_compact* s, const unsigned char** b,
+		      const unsigned char* end, char* essid)
+{
+	uint64_t ref;
+	size_t len;
+
+	if (!get_varint(b, end, &ref) || (ref >> 1) >= ESSID_DICT_SIZE)
+		return false;
+
+	if (ref & 1) {
+		if (*b >= end)
+			return false;
+		len = *(*b)++;
+		if (len > WLAN_MAX_SSID_LEN || (size_t)(end - *b) < len)
+			return false;
+		memcpy(s->essid[ref >> 1], *b, len);
+		s->essid[ref >> 1][len] = '\0';
+		*b += len;
+	}
+	strcpy(essid, s->essid[ref >> 1]);
+	return true;
+}
+
+static void rec_from_packet(struct compact_rec* r, struct uwifi_packet* p)
+{
+	unsigned int flags = 0;
+
+	if (p->wlan_wep)
+		flags |= FLAG_WEP;
+	if (p->wlan_retry)
+		flags |= FLAG_RETRY;
+	if (p->wlan_wpa)
+		flags |= FLAG_WPA;
+	if (p->wlan_rsn)
+		flags |= FLAG_RSN;
+	if (p->wlan_ht40plus)
+		flags |= FLAG_HT40PLUS;
+	if (p->bat_gw)
+		flags |= FLAG_BAT_GW;
+
+	r->v[CF_SIGNAL] = (int64_t)p->phy_signal;
+	r->v[CF_SEQNO] = p->wlan_seqno;
+	r->v[CF_TSF] = p->wlan_tsf;
+	r->v[CF_LEN] = p->wlan_len;
+	r->v[CF_TYPE] = p->wlan_type;
+	r->v[CF_PKT_TYPES] = p->pkt_types;
+	r->v[CF_RATE] = p->phy_rate;
+	r->v[CF_RA] = mac_pack(p->wlan_ra);
+	r->v[CF_NAV] = p->wlan_nav;
+	r->v[CF_FLAGS] = flags;
+	r->v[CF_BSSID] = mac_pack(p->wlan_bssid);
+	r->v[CF_RATE_IDX] = p->phy_rate_idx;
+	r->v[CF_RATE_FLAGS] = p->phy_rate_flags;
+	r->v[CF_FREQ] = p->phy_freq;
+	r->v[CF_PHY_FLAGS] = p->phy_flags;
+	r->v[CF_QOS_CLASS] = p->wlan_qos_class;
+	r->v[CF_ESSID] = 0;
+	r->v[CF_BINTVAL] = p->wlan_bintval;
+	r->v[CF_MODE] = p->wlan_mode;
+	r->v[CF_CHANNEL] = p->wlan_channel;
+	r->v[CF_CHAN_WIDTH] = p->wlan_chan_width;
+	r->v[CF_TX_STREAMS] = p->wlan_tx_streams;
+	r->v[CF_RX_STREAMS] = p->wlan_rx_streams;
+	r->v[CF_IP_SRC] = p->ip_src;
+	r->v[CF_IP_DST] = p->ip_dst;
+	r->v[CF_PORT] = p->tcpudp_port;
+	r->v[CF_OLSR_TYPE] = p->olsr_type;
+	r->v[CF_OLSR_NEIGH] = p->olsr_neigh;
+	r->v[CF_OLSR_TC] = p->olsr_tc;
+	r->v[CF_BAT_PKT_TYPE] = p->bat_packet_type;
+
+	/* the ESSID in the packet is not always terminated */
+	memcpy(r->essid, p->wlan_essid, WLAN_MAX_SSID_LEN);
+	r->essid[WLAN_MAX_SSID_LEN] = '\0';
+}
+
+static void rec_to_packet(const struct compact_rec* r, struct uwifi_packet* p)
+{
+	unsigned int flags = r->v[CF_FLAGS];
+
+	memset(p, 0, sizeof(*p));
+	p->phy_signal = (int64_t)r->v[CF_SIGNAL];
+	p->wlan_seqno = r->v[CF_SEQNO];
+	p->wlan_tsf = r->v[CF_TSF];
+	p->wlan_len = r->v[CF_LEN];
+	p->wlan_type = r->v[CF_TYPE];
+	p->pkt_types = r->v[CF_PKT_TYPES];
+	p->phy_rate = r->v[CF_RATE];
+	mac_unpack(r->v[CF_RA], p->wlan_ra);
+	p->wlan_nav = r->v[CF_NAV];
+	mac_unpack(r->v[CF_BSSID], p->wlan_bssid);
+	p->phy_rate_idx = r->v[CF_RATE_IDX];
+	p->phy_rate_flags = r->v[CF_RATE_FLAGS];
+	p->phy_freq = r->v[CF_FREQ];
+	p->phy_flags = r->v[CF_PHY_FLAGS];
+	p->wlan_qos_class = r->v[CF_QOS_CLASS];
+	p->wlan_bintval = r->v[CF_BINTVAL];
+	p->wlan_mode = r->v[CF_MODE];
+	p->wlan_channel = r->v[CF_CHANNEL];
+	p->wlan_chan_width = r->v[CF_CHAN_WIDTH];
+	p->wlan_tx_streams = r->v[CF_TX_STREAMS];
+	p->wlan_rx_streams = r->v[CF_RX_STREAMS];
+	p->ip_src = r->v[CF_IP_SRC];
+	p->ip_dst = r->v[CF_IP_DST];
+	p->tcpudp_port = r->v[CF_PORT];
+	p->olsr_type = r->v[CF_OLSR_TYPE];
+	p->olsr_neigh = r->v[CF_OLSR_NEIGH];
+	p->olsr_tc = r->v[CF_OLSR_TC];
+	p->bat_packet_type = r->v[CF_BAT_PKT_TYPE];
+	p->wlan_wep = !!(flags & FLAG_WEP);
+	p->wlan_retry = !!(flags & FLAG_RETRY);
+	p->wlan_wpa = !!(flags & FLAG_WPA);
+	p->wlan_rsn = !!(flags & FLAG_RSN);
+	p->wlan_ht40plus = !!(flags & FLAG_HT40PLUS);
+	p->bat_gw = !!(flags & FLAG_BAT_GW);
+	memcpy(p->wlan_essid, r->essid, WLAN_MAX_SSID_LEN);
+}
+
+/* encode p into buf, which must have NET_COMPACT_MAX_LEN bytes */
+size_t net_compact_encode(struct net_compact* s, struct uwifi_packet* p, unsigned char* buf)
+{
+	struct compact_rec cur;
+	struct compact_rec* last;
+	uint64_t ta = mac_pack(p->wlan_ta);
+	uint32_t bitmap = 0;
+	unsigned char* b;
+
+	rec_from_packet(&cur, p);
+	last = &s->last[mac_slot(ta)];
+
+	for (int i = 0; i < CF_NUM; i++) {
+		if (i == CF_ESSID ? strcmp(cur.essid, last->essid) != 0
+				  : cur.v[i] != last->v[i])
+			bitmap |= 1 << i;
+	}
+
+	b = put_varint(buf, bitmap);
+	b = put_mac(s, b, ta);
+
+	for (int i = 0; i < CF_NUM; i++) {
+		if (!(bitmap & (1 << i)))
+			continue;
+
+		switch (field_kind[i]) {
+		case CK_DELTA:
+			b = put_varint(b, zigzag(cur.v[i] - last->v[i]));
+			break;
+		case CK_RAW32:
+			memcpy(b, &(uint32_t){ cur.v[i] }, 4);
+			b += 4;
+			break;
+		case CK_MAC:
+			b = put_mac(s, b, cur.v[i]);
+			break;
+		case CK_ESSID:
+			b = put_essid(s, b, cur.essid);
+			break;
+		default:
+			b = put_varint(b, cur.v[i]);
+		}
+	}
+
+	*last = cur;
+	return b - buf;
+}
+
+bool net_compact_decode(struct net_compact* s, const unsigned char* buf, size_t len,
+			struct uwifi_packet* p)
+{
+	const unsigned char* b = buf;
+	const unsigned char* end = buf + len;
+	struct compact_rec* last;
+	uint64_t bitmap, ta, v;
+	uint32_t raw;
+
+	if (!get_varint(&b, end, &bitmap) || bitmap >= (1 << CF_NUM) ||
+	    !get_mac(s, &b, end, &ta))
+		return false;
+
+	last = &s->last[mac_slot(ta)];
+
+	for (int i = 0; i < CF_NUM; i++) {
+		if (!(bitmap & (1 << i)))
+			continue;
+
+		switch (field_kind[i]) {
+		case CK_DELTA:
+			if (!get_varint(&b, end, &v))
+				return false;
+			last->v[i] += unzigzag(v);
+			break;
+		case CK_RAW32:
+			if (end - b < 4)
+				return false;
+			memcpy(&raw, b, 4);
+			last->v[i] = raw;
+			b += 4;
+			break;
+		case CK_MAC:
+			if (!get_mac(s, &b, end, &last->v[i]))
+				return false;
+			break;
+		case CK_ESSID:
+			if (!get_essid(s, &b, end, last->essid))
+				return false;
+			break;
+		default:
+			if (!get_varint(&b, end, &last->v[i]))
+				return false;
+		}
+	}
+
+	if (b != end)
+		return false;
+
+	rec_to_packet(last, p);
+	mac_unpack(ta, p->wlan_ta);
+	return true;
+}
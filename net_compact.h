@@ -0,0 +1,39 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _NET_COMPACT_H_
+#define _NET_COMPACT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* maximum length of one encoded record, fits into the one byte length */
+#define NET_COMPACT_MAX_LEN	255
+
+struct uwifi_packet;
+struct net_compact;
+
+struct net_compact* net_compact_new(void);
+void net_compact_free(struct net_compact* s);
+void net_compact_reset(struct net_compact* s);
+size_t net_compact_encode(struct net_compact* s, struct uwifi_packet* p, unsigned char* buf);
+bool net_compact_decode(struct net_compact* s, const unsigned char* buf, size_t len,
+			struct uwifi_packet* p);
+
+#endif
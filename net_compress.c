@@ -0,0 +1,192 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Block compression for the server to client stream, with zstd when built
+ * with ZSTD=1.
+ *
+ * One zstd stream is used per connection and every block is flushed, so the
+ * receiver can decode each block as soon as it arrives, but the compressor
+ * can still refer to the data of all earlier blocks in its window. This works
+ * like a dictionary which is built from the stream itself. Because of this
+ * blocks have to be decompressed in order and none may be lost.
+ */
+
+#include <stdlib.h>
+
+#include "net_compress.h"
+
+#if HAVE_ZSTD
+
+#include <zstd.h>
+
+/* limit memory use on small devices, the window is 128KB */
+#define NET_COMPRESS_WINDOW_LOG	17
+/* space for the frame header which is added to the first block */
+#define NET_COMPRESS_HEADER	32
+
+struct net_compressor {
+	ZSTD_CCtx*	cctx;
+};
+
+struct net_decompressor {
+	ZSTD_DCtx*	dctx;
+};
+
+unsigned int net_compress_methods(void)
+{
+	return NET_COMPRESS_ZSTD;
+}
+
+size_t net_compress_bound(size_t len)
+{
+	return ZSTD_compressBound(len) + NET_COMPRESS_HEADER;
+}
+
+struct net_compressor* net_compressor_new(int level)
+{
+	struct net_compressor* c = malloc(sizeof(*c));
+	if (c == NULL)
+		return NULL;
+
+	c->cctx = ZSTD_createCCtx();
+	if (c->cctx == NULL ||
+	    ZSTD_isError(ZSTD_CCtx_setParameter(c->cctx, ZSTD_c_compressionLevel, level)) ||
+	    ZSTD_isError(ZSTD_CCtx_setParameter(c->cctx, ZSTD_c_windowLog, NET_COMPRESS_WINDOW_LOG))) {
+		net_compressor_free(c);
+		return NULL;
+	}
+	return c;
+}
+
+/* returns the compressed length or 0 on error, after which the stream is broken */
+size_t net_compress_block(struct net_compressor* c, const void* in, size_t len,
+			  void* out, size_t out_len)
+{
+	ZSTD_inBuffer ib = { in, len, 0 };
+	ZSTD_outBuffer ob = { out, out_len, 0 };
+	size_t ret;
+
+	do {
+		ret = ZSTD_compressStream2(c->cctx, &ob, &ib, ZSTD_e_flush);
+		if (ZSTD_isError(ret))
+			return 0;
+	} while (ret != 0 && ob.pos < ob.size);
+
+	return ret == 0 ? ob.pos : 0;
+}
+
+void net_compressor_free(struct net_compressor* c)
+{
+	if (c == NULL)
+		return;
+	ZSTD_freeCCtx(c->cctx);
+	free(c);
+}
+
+struct net_decompressor* net_decompressor_new(void)
+{
+	struct net_decompressor* d = malloc(sizeof(*d));
+	if (d == NULL)
+		return NULL;
+
+	d->dctx = ZSTD_createDCtx();
+	if (d->dctx == NULL) {
+		free(d);
+		return NULL;
+	}
+	return d;
+}
+
+/* decompress one block which must result in exactly out_len bytes */
+bool net_decompress_block(struct net_decompressor* d, const void* in, size_t len,
+			  void* out, size_t out_len)
+{
+	ZSTD_inBuffer ib = { in, len, 0 };
+	ZSTD_outBuffer ob = { out, out_len, 0 };
+	size_t ret, last_in, last_out;
+
+	do {
+		last_in = ib.pos;
+		last_out = ob.pos;
+		ret = ZSTD_decompressStream(d->dctx, &ob, &ib);
+		if (ZSTD_isError(ret))
+			return false;
+	} while (ib.pos < ib.size && (ib.pos != last_in || ob.pos != last_out));
+
+	return ib.pos == ib.size && ob.pos == out_len;
+}
+
+void net_decompressor_free(struct net_decompressor* d)
+{
+	if (d == NULL)
+		return;
+	ZSTD_freeDCtx(d->dctx);
+	free(d);
+}
+
+#else /* no compression support */
+
+unsigned int net_compress_methods(void)
+{
+	return 0;
+}
+
+size_t net_compress_bound(__attribute__((unused)) size_t len)
+{
+	return 0;
+}
+
+struct net_compressor* net_compressor_new(__attribute__((unused)) int level)
+{
+	return NULL;
+}
+
+size_t net_compress_block(__attribute__((unused)) struct net_compressor* c,
+			  __attribute__((unused)) const void* in,
+			  __attribute__((unused)) size_t len,
+			  __attribute__((unused)) void* out,
+			  __attribute__((unused)) size_t out_len)
+{
+	return 0;
+}
+
+void net_compressor_free(__attribute__((unused)) struct net_compressor* c)
+{
+}
+
+struct net_decompressor* net_decompressor_new(void)
+{
+	return NULL;
+}
+
+bool net_decompress_block(__attribute__((unused)) struct net_decompressor* d,
+			  __attribute__((unused)) const void* in,
+			  __attribute__((unused)) size_t len,
+			  __attribute__((unused)) void* out,
+			  __attribute__((unused)) size_t out_len)
+{
+	return false;
+}
+
+void net_decompressor_free(__attribute__((unused)) struct net_decompressor* d)
+{
+}
+
+#endif
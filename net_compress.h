@@ -0,0 +1,45 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _NET_COMPRESS_H_
+#define _NET_COMPRESS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* compression methods, as bits in the hello message */
+#define NET_COMPRESS_ZSTD	0x01
+
+struct net_compressor;
+struct net_decompressor;
+
+unsigned int net_compress_methods(void);
+size_t net_compress_bound(size_t len);
+
+struct net_compressor* net_compressor_new(int level);
+size_t net_compress_block(struct net_compressor* c, const void* in, size_t len,
+			  void* out, size_t out_len);
+void net_compressor_free(struct net_compressor* c);
+
+struct net_decompressor* net_decompressor_new(void);
+bool net_decompress_block(struct net_decompressor* d, const void* in, size_t len,
+			  void* out, size_t out_len);
+void net_decompressor_free(struct net_decompressor* d);
+
+#endif
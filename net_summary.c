@@ -0,0 +1,458 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/*
+ * Aggregated summaries for the server to client link (server_summary).
+ *
+ * Instead of every packet info the server periodically sends the current
+ * state of its tables: the statistics counters, the channels and all nodes
+ * which have been seen since the last summary, together with their per
+ * channel data. Only entries which changed are sent, except for the first
+ * summary to a client, which contains everything. All values are absolute,
+ * so the client just overwrites its own tables with them.
+ *
+ * A summary is a sequence of records which start with a one byte type. The
+ * records are independent of each other, so they can be split into several
+ * messages.
+ */
+
+#include <string.h>
+#include <endian.h>
+
+#include <uwifi/node.h>
+#include <uwifi/essid.h>
+
+#include "main.h"
+#include "net_summary.h"
+#include "nodes.h"
+
+enum summary_rec_type {
+	SUMMARY_TOTALS		= 1,
+	SUMMARY_RATE		= 2,
+	SUMMARY_TYPE		= 3,
+	SUMMARY_CHAN		= 4,
+	SUMMARY_NODE		= 5,
+	SUMMARY_CHAN_NODE	= 6,
+};
+
+struct summary_totals {
+	unsigned char	type;
+	uint64_t	packets;
+	uint64_t	retries;
+	uint64_t	bytes;
+	uint64_t	duration;
+	uint64_t	filtered;
+} __attribute__ ((packed));
+
+/* per rate or per frame type counters */
+struct summary_counter {
+	unsigned char	type;
+	unsigned char	idx;
+	uint64_t	packets;
+	uint64_t	bytes;
+	uint64_t	duration;
+} __attribute__ ((packed));
+
+struct summary_chan {
+	unsigned char	type;
+	unsigned char	idx;
+	int32_t		signal;
+	uint32_t	signal_avg;
+	uint64_t	packets;
+	uint64_t	bytes;
+	uint64_t	durations;
+	uint64_t	durations_last;
+	uint32_t	durations_avg;
+} __attribute__ ((packed));
+
+#define SUMMARY_NODE_WEP	0x01
+#define SUMMARY_NODE_WPA	0x02
+#define SUMMARY_NODE_RSN	0x04
+#define SUMMARY_NODE_HT40PLUS	0x08
+#define SUMMARY_NODE_BAT_GW	0x10
+
+struct summary_node {
+	unsigned char	type;
+	unsigned char	mac[WLAN_MAC_LEN];
+	unsigned char	bssid[WLAN_MAC_LEN];
+	char		essid[WLAN_MAX_SSID_LEN];
+	uint32_t	age;		/* seconds since last seen */
+	uint32_t	pkt_types;
+	uint32_t	pkt_count;
+	int32_t		sig_last;
+	uint32_t	sig_avg;
+	uint32_t	mode;
+	unsigned char	channel;
+	unsigned char	std;
+	unsigned char	chan_width;
+	unsigned char	tx_streams;
+	unsigned char	rx_streams;
+	unsigned char	flags;
+	uint64_t	tsf;
+	uint32_t	bintval;
+	uint32_t	retries;
+	uint32_t	ip_src;
+	int32_t		olsr_neigh;
+} __attribute__ ((packed));
+
+/* signal of a node on one channel, refers to the node by its MAC */
+struct summary_chan_node {
+	unsigned char	type;
+	unsigned char	mac[WLAN_MAC_LEN];
+	unsigned char	chan;
+	int32_t		sig;
+	uint32_t	sig_avg;
+	uint64_t	packets;
+} __attribute__ ((packed));
+
+/* what was sent in the last summary, to find out what changed */
+static unsigned long sent_rate_packets[MAX_RATES];
+static unsigned long sent_type_packets[MAX_FSTYPE];
+static unsigned long sent_chan_packets[MAX_CHANNELS];
+static unsigned long sent_chan_durations[MAX_CHANNELS];
+static time_t sent_time;
+
+static void collect_counter(net_summary_cb add, int type, int idx,
+			    unsigned long packets, unsigned long bytes,
+			    unsigned long duration)
+{
+	struct summary_counter sc;
+
+	sc.type = type;
+	sc.idx = idx;
+	sc.packets = htole64(packets);
+	sc.bytes = htole64(bytes);
+	sc.duration = htole64(duration);
+	add((unsigned char*)&sc, sizeof(sc));
+}
+
+static void collect_node(net_summary_cb add, struct uwifi_node* n)
+{
+	struct summary_node sn;
+	struct summary_chan_node scn;
+	struct chan_node* cn;
+
+	memset(&sn, 0, sizeof(sn));
+	sn.type = SUMMARY_NODE;
+	memcpy(sn.mac, n->wlan_src, WLAN_MAC_LEN);
+	memcpy(sn.bssid, n->wlan_bssid, WLAN_MAC_LEN);
+	if (n->essid != NULL)
+		memcpy(sn.essid, n->essid->essid,
+		       strnlen(n->essid->essid, WLAN_MAX_SSID_LEN - 1));
+	sn.age = htole32(time_mono.tv_sec - n->last_seen);
+	sn.pkt_types = htole32(n->pkt_types);
+	sn.pkt_count = htole32(n->pkt_count);
+	sn.sig_last = htole32(n->phy_sig_last);
+	sn.sig_avg = htole32(ewma_read(&n->phy_sig_avg));
+	sn.mode = htole32(n->wlan_mode);
+	sn.channel = n->wlan_channel;
+	sn.std = n->wlan_std;
+	sn.chan_width = n->wlan_chan_width;
+	sn.tx_streams = n->wlan_tx_streams;
+	sn.rx_streams = n->wlan_rx_streams;
+	if (n->wlan_wep)
+		sn.flags |= SUMMARY_NODE_WEP;
+	if (n->wlan_wpa)
+		sn.flags |= SUMMARY_NODE_WPA;
+	if (n->wlan_rsn)
+		sn.flags |= SUMMARY_NODE_RSN;
+	if (n->wlan_ht40plus)
+		sn.flags |= SUMMARY_NODE_HT40PLUS;
+	if (n->bat_gw)
+		sn.flags |= SUMMARY_NODE_BAT_GW;
+	sn.tsf = htole64(n->wlan_tsf);
+	sn.bintval = htole32(n->wlan_bintval);
+	sn.retries = htole32(n->wlan_retries_all);
+	sn.ip_src = n->ip_src;
+	sn.olsr_neigh = htole32(n->olsr_neigh);
+	add((unsigned char*)&sn, sizeof(sn));
+
+	cc_list_for_each(&n->on_channels, cn, node_list) {
+		scn.type = SUMMARY_CHAN_NODE;
+		memcpy(scn.mac, n->wlan_src, WLAN_MAC_LEN);
+		scn.chan = cn->chan - spectrum;
+		scn.sig = htole32(cn->sig);
+		scn.sig_avg = htole32(ewma_read(&cn->sig_avg));
+		scn.packets = htole64(cn->packets);
+		add((unsigned char*)&scn, sizeof(scn));
+	}
+}
+
+/* call 'add' for every record of the summary. With 'full' everything is
+ * included, otherwise only what changed since the last net_summary_commit() */
+void net_summary_collect(bool full, net_summary_cb add)
+{
+	struct summary_totals st;
+	struct summary_chan sc;
+	struct uwifi_node* n;
+	int i;
+
+	st.type = SUMMARY_TOTALS;
+	st.packets = htole64(stats.packets);
+	st.retries = htole64(stats.retries);
+	st.bytes = htole64(stats.bytes);
+	st.duration = htole64(stats.duration);
+	st.filtered = htole64(stats.filtered_packets);
+	add((unsigned char*)&st, sizeof(st));
+
+	for (i = 1; i < MAX_RATES; i++) {
+		if (stats.packets_per_rate[i] == 0 ||
+		    (!full && stats.packets_per_rate[i] == sent_rate_packets[i]))
+			continue;
+		collect_counter(add, SUMMARY_RATE, i, stats.packets_per_rate[i],
+				stats.bytes_per_rate[i], stats.duration_per_rate[i]);
+	}
+
+	for (i = 0; i < MAX_FSTYPE; i++) {
+		if (stats.packets_per_type[i] == 0 ||
+		    (!full && stats.packets_per_type[i] == sent_type_packets[i]))
+			continue;
+		collect_counter(add, SUMMARY_TYPE, i, stats.packets_per_type[i],
+				stats.bytes_per_type[i], stats.duration_per_type[i]);
+	}
+
+	for (i = 0; i < uwifi_channel_get_num_channels(&conf.intf.channels) && i < MAX_CHANNELS; i++) {
+		struct channel_info* chan = &spectrum[i];
+		if (!full && chan->packets == sent_chan_packets[i] &&
+		    chan->durations_last == sent_chan_durations[i])
+			continue;
+		sc.type = SUMMARY_CHAN;
+		sc.idx = i;
+		sc.signal = htole32(chan->signal);
+		sc.signal_avg = htole32(ewma_read(&chan->signal_avg));
+		sc.packets = htole64(chan->packets);
+		sc.bytes = htole64(chan->bytes);
+		sc.durations = htole64(chan->durations);
+		sc.durations_last = htole64(chan->durations_last);
+		sc.durations_avg = htole32(ewma_read(&chan->durations_avg));
+		add((unsigned char*)&sc, sizeof(sc));
+	}
+
+	/* last_seen has a resolution of seconds, so nodes seen in the same
+	 * second as the last summary are sent again */
+	cc_list_for_each(&conf.intf.wlan_nodes, n, list) {
+		if (full || n->last_seen >= sent_time)
+			collect_node(add, n);
+	}
+}
+
+/* remember the state of the last summary */
+void net_summary_commit(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_RATES; i++)
+		sent_rate_packets[i] = stats.packets_per_rate[i];
+	for (i = 0; i < MAX_FSTYPE; i++)
+		sent_type_packets[i] = stats.packets_per_type[i];
+	for (i = 0; i < MAX_CHANNELS; i++) {
+		sent_chan_packets[i] = spectrum[i].packets;
+		sent_chan_durations[i] = spectrum[i].durations_last;
+	}
+	sent_time = time_mono.tv_sec;
+}
+
+/* set an average to the value it had on the server */
+static void ewma_set(struct ewma* avg, unsigned long val)
+{
+	ewma_init(avg, 1024, 8);
+	if (val > 0)
+		ewma_add(avg, val);
+}
+
+static struct uwifi_node* node_find(const unsigned char* mac)
+{
+	struct uwifi_node* n;
+
+	cc_list_for_each(&conf.intf.wlan_nodes, n, list) {
+		if (memcmp(n->wlan_src, mac, WLAN_MAC_LEN) == 0)
+			return n;
+	}
+	return NULL;
+}
+
+static void apply_counter(const struct summary_counter* sc)
+{
+	if (sc->type == SUMMARY_RATE && sc->idx < MAX_RATES) {
+		stats.packets_per_rate[sc->idx] = le64toh(sc->packets);
+		stats.bytes_per_rate[sc->idx] = le64toh(sc->bytes);
+		stats.duration_per_rate[sc->idx] = le64toh(sc->duration);
+	} else if (sc->type == SUMMARY_TYPE && sc->idx < MAX_FSTYPE) {
+		stats.packets_per_type[sc->idx] = le64toh(sc->packets);
+		stats.bytes_per_type[sc->idx] = le64toh(sc->bytes);
+		stats.duration_per_type[sc->idx] = le64toh(sc->duration);
+	}
+}
+
+static void apply_chan(const struct summary_chan* sc)
+{
+	struct channel_info* chan;
+
+	if (sc->idx >= MAX_CHANNELS)
+		return;
+
+	chan = &spectrum[sc->idx];
+	chan->signal = (int32_t)le32toh(sc->signal);
+	ewma_set(&chan->signal_avg, le32toh(sc->signal_avg));
+	chan->packets = le64toh(sc->packets);
+	chan->bytes = le64toh(sc->bytes);
+	chan->durations = le64toh(sc->durations);
+	chan->durations_last = le64toh(sc->durations_last);
+	ewma_set(&chan->durations_avg, le32toh(sc->durations_avg));
+}
+
+/*
+ * The node is created and linked to its AP and ESSID by libuwifi from a
+ * packet made up from the summary, just like it would be from a real
+ * packet, and then the aggregated values are set.
+ */
+static struct uwifi_node* apply_node(const struct summary_node* sn)
+{
+	struct uwifi_packet p;
+	struct uwifi_node* n;
+	uint32_t mode = le32toh(sn->mode);
+
+	memset(&p, 0, sizeof(p));
+	memcpy(p.wlan_ta, sn->mac, WLAN_MAC_LEN);
+	memcpy(p.wlan_bssid, sn->bssid, WLAN_MAC_LEN);
+	memcpy(p.wlan_essid, sn->essid, WLAN_MAX_SSID_LEN);
+	p.wlan_essid[WLAN_MAX_SSID_LEN - 1] = '\0';
+	p.wlan_type = (mode & (WLAN_MODE_AP | WLAN_MODE_IBSS)) ?
+			WLAN_FRAME_BEACON : WLAN_FRAME_DATA;
+	p.wlan_mode = mode;
+	p.phy_signal = (int32_t)le32toh(sn->sig_last);
+	p.pkt_types = le32toh(sn->pkt_types);
+	p.wlan_channel = sn->channel;
+	p.wlan_chan_width = sn->chan_width;
+	p.wlan_tx_streams = sn->tx_streams;
+	p.wlan_rx_streams = sn->rx_streams;
+	p.wlan_tsf = le64toh(sn->tsf);
+	p.wlan_bintval = le32toh(sn->bintval);
+	p.ip_src = sn->ip_src;
+	p.olsr_neigh = le32toh(sn->olsr_neigh);
+	p.wlan_wep = !!(sn->flags & SUMMARY_NODE_WEP);
+	p.wlan_wpa = !!(sn->flags & SUMMARY_NODE_WPA);
+	p.wlan_rsn = !!(sn->flags & SUMMARY_NODE_RSN);
+	p.wlan_ht40plus = !!(sn->flags & SUMMARY_NODE_HT40PLUS);
+	p.bat_gw = !!(sn->flags & SUMMARY_NODE_BAT_GW);
+
+	n = uwifi_node_update(&p, &conf.intf.wlan_nodes);
+	if (n == NULL)
+		return NULL;
+	uwifi_nodes_find_ap(n, &conf.intf.wlan_nodes);
+	if (p.wlan_essid[0] != '\0')
+		uwifi_essids_update(&essids, &p, n);
+
+	n->last_seen = time_mono.tv_sec - le32toh(sn->age);
+	nodes_seen(n);
+	n->pkt_types = p.pkt_types;
+	n->pkt_count = le32toh(sn->pkt_count);
+	n->phy_sig_last = p.phy_signal;
+	ewma_set(&n->phy_sig_avg, le32toh(sn->sig_avg));
+	n->wlan_mode = mode;
+	n->wlan_channel = sn->channel;
+	n->wlan_std = sn->std;
+	n->wlan_chan_width = sn->chan_width;
+	n->wlan_ht40plus = p.wlan_ht40plus;
+	n->wlan_tx_streams = sn->tx_streams;
+	n->wlan_rx_streams = sn->rx_streams;
+	n->wlan_wep = p.wlan_wep;
+	n->wlan_wpa = p.wlan_wpa;
+	n->wlan_rsn = p.wlan_rsn;
+	n->wlan_tsf = p.wlan_tsf;
+	n->wlan_bintval = p.wlan_bintval;
+	n->wlan_retries_all = le32toh(sn->retries);
+	n->ip_src = p.ip_src;
+	n->olsr_neigh = p.olsr_neigh;
+	n->bat_gw = p.bat_gw;
+	return n;
+}
+
+static void apply_chan_node(const struct summary_chan_node* scn, struct uwifi_node* n)
+{
+	struct chan_node* cn;
+
+	/* usually it is the node of the record before */
+	if (n == NULL || memcmp(n->wlan_src, scn->mac, WLAN_MAC_LEN) != 0)
+		n = node_find(scn->mac);
+	if (n == NULL || scn->chan >= MAX_CHANNELS)
+		return;
+
+	cn = spectrum_chan_node(&spectrum[scn->chan], n);
+	if (cn == NULL)
+		return;
+	cn->sig = (int32_t)le32toh(scn->sig);
+	ewma_set(&cn->sig_avg, le32toh(scn->sig_avg));
+	cn->packets = le64toh(scn->packets);
+}
+
+static size_t rec_len(unsigned char type)
+{
+	switch (type) {
+	case SUMMARY_TOTALS:	return sizeof(struct summary_totals);
+	case SUMMARY_RATE:
+	case SUMMARY_TYPE:	return sizeof(struct summary_counter);
+	case SUMMARY_CHAN:	return sizeof(struct summary_chan);
+	case SUMMARY_NODE:	return sizeof(struct summary_node);
+	case SUMMARY_CHAN_NODE:	return sizeof(struct summary_chan_node);
+	}
+	return 0;
+}
+
+/* apply summary records in buf to our tables, returns false if they were
+ * invalid */
+bool net_summary_apply(const unsigned char* buf, size_t len)
+{
+	const struct summary_totals* st;
+	struct uwifi_node* n = NULL;
+	size_t pos = 0, l;
+
+	while (pos < len) {
+		l = rec_len(buf[pos]);
+		if (l == 0 || pos + l > len)
+			return false;
+
+		switch (buf[pos]) {
+		case SUMMARY_TOTALS:
+			st = (const struct summary_totals*)(buf + pos);
+			stats.packets = le64toh(st->packets);
+			stats.retries = le64toh(st->retries);
+			stats.bytes = le64toh(st->bytes);
+			stats.duration = le64toh(st->duration);
+			stats.filtered_packets = le64toh(st->filtered);
+			break;
+		case SUMMARY_RATE:
+		case SUMMARY_TYPE:
+			apply_counter((const struct summary_counter*)(buf + pos));
+			break;
+		case SUMMARY_CHAN:
+			apply_chan((const struct summary_chan*)(buf + pos));
+			break;
+		case SUMMARY_NODE:
+			n = apply_node((const struct summary_node*)(buf + pos));
+			break;
+		case SUMMARY_CHAN_NODE:
+			apply_chan_node((const struct summary_chan_node*)(buf + pos), n);
+			break;
+		}
+		pos += l;
+	}
+	return true;
+}
@@ -0,0 +1,36 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef _NET_SUMMARY_H_
+#define _NET_SUMMARY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* maximum length of one summary record */
+#define NET_SUMMARY_MAX_REC	128
+
+typedef void (*net_summary_cb)(const unsigned char* rec, size_t len);
+
+void net_summary_collect(bool full, net_summary_cb add);
+void net_summary_commit(void);
+bool net_summary_apply(const unsigned char* buf, size_t len);
+
+#endif
@@ -24,7 +24,10 @@
 #include <endian.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 #include <errno.h>
 #include <err.h>
@@ -36,20 +39,166 @@
 #include "main.h"
 #include "network.h"
 #include "display.h"
+#include "bpf_filter.h"
+#include "event.h"
+#include "byte_ring.h"
+#include "net_compact.h"
+#include "net_compress.h"
+#include "net_summary.h"
+#include "collector.h"
 
 extern struct config conf;
 
 int srv_fd = -1;
-int cli_fd = -1;
+int mcast_fd = -1;
+int net_num_clients;
+/* sampling ratio of the packet which is being handled in client mode */
+unsigned int net_sample = 1;
 static int netmon_fd;
 
-#define PROTO_VERSION	4
+/*
+ * The server accepts up to MAX_NET_CLIENTS clients. Each client has its own
+ * send queue: we try to send directly and only queue what the socket does
+ * not take, the rest is sent when the socket becomes writable. When the
+ * queue of a slow client is full, packet infos for it are dropped
+ * (configuration messages are never dropped) and when this goes on for
+ * NET_CLIENT_STALL_SEC the client is disconnected, so a slow client can
+ * never block the main loop or other clients.
+ *
+ * Packet infos are not sent one by one but collected in a batch buffer per
+ * client, which is sent with one send() when it has server_batch bytes or
+ * when the server_flush timer expires. If compression was negotiated, the
+ * whole batch is sent as one compressed block.
+ *
+ * Before it comes to dropping, the server degrades clients which support it:
+ * when the send queue passes NET_CLIENT_HIGH_WATER, only 1 in N data and
+ * control frames is sent, management frames are always sent. N is doubled
+ * every NET_SAMPLE_INTERVAL while the queue is above the high water mark and
+ * still growing, and halved when it was below NET_CLIENT_LOW_WATER for ten
+ * intervals, so it follows the rate at which the client drains its queue,
+ * up to server_sample_max. The client is told N
+ * with PROTO_SAMPLE before the first packet info sent with it, and scales
+ * its statistics back up.
+ *
+ * With server_summary clients which ask for it get periodic summaries of
+ * the server's tables (see net_summary.c) instead of packet infos. They go
+ * through the same batch and queue, and when one is dropped the next summary
+ * for this client contains everything again.
+ */
+#define MAX_NET_CLIENTS		8
+#define NET_CLIENT_QUEUE	(256 * 1024)
+#define NET_CLIENT_STALL_SEC	10
+#define NET_CLIENT_HIGH_WATER	(NET_CLIENT_QUEUE / 2)
+#define NET_CLIENT_LOW_WATER	(NET_CLIENT_QUEUE / 16)
+#define NET_SAMPLE_INTERVAL	100	/* ms */
+
+/* stay below the usual MTU so multicast datagrams are not fragmented */
+#define NET_MCAST_MTU		1400
+
+struct net_client {
+	int		fd;
+	/* for packets from client to server */
+	struct byte_ring rx;
+	/* send queue, sent from the tail as the socket takes it */
+	struct byte_ring tx;
+	time_t		full_since;
+	/* packet infos not sent yet */
+	unsigned char	batch[NET_MAX_BATCH];
+	size_t		batch_len;
+	unsigned int	batch_records;
+	bool		hello;
+	/* sampling of data frames when the client is too slow */
+	bool		sampled;	/* client can scale sampled packets */
+	unsigned int	sample;		/* send 1 in sample */
+	unsigned int	sample_cnt;
+	unsigned int	sample_sent;	/* what the client knows, 0: unknown */
+	long		sample_time;	/* ms */
+	size_t		sample_slen;	/* queue length at sample_time */
+	unsigned int	sample_low;	/* intervals below low water */
+	/* encoder state when the client uses protocol version 5 */
+	struct net_compact* compact;
+	bool		compact_reset;	/* client does not know it was reset */
+	/* compressor and buffer when compression was negotiated */
+	struct net_compressor* zc;
+	unsigned char*	zbuf;
+	/* client gets packet infos by multicast */
+	bool		mcast;
+	/* client gets summaries instead of packet infos */
+	bool		summary;
+	bool		summary_full;
+	bool		summary_now;
+};
+
+static struct net_client clients[MAX_NET_CLIENTS] = {
+	[0 ... MAX_NET_CLIENTS - 1] = { .fd = -1 }
+};
+
+static int flush_timer = -1;
+static bool flush_timer_armed;
+static int summary_timer = -1;
+
+/* multicast datagram which is being collected, and where to send it */
+static unsigned char mcast_buf[NET_MCAST_MTU];
+static size_t mcast_len;
+static unsigned int mcast_records;
+static uint32_t mcast_seq;
+static struct sockaddr_in mcast_addr;
+
+/* client mode: multicast socket and next expected sequence number */
+static int mcast_rx_fd = -1;
+static uint32_t mcast_rx_seq;
+static bool mcast_rx_started;
+
+/* receive state of the connection to the server in client mode, the buffer
+ * has to fit the largest message, a compressed batch */
+#define NET_RECV_BUFFER_SIZE	(64 * 1024)
+static struct net_rx client_rx;
+
+/*
+ * All messages use protocol version 4, except packet infos, which are sent in
+ * the compact version 5 format (see net_compact.c) when both sides support
+ * it. The client sends PROTO_HELLO with the highest version it supports after
+ * connecting, and if the server supports it too it answers with PROTO_HELLO
+ * and sends all following packet infos in version 5. Older clients don't send
+ * PROTO_HELLO and get version 4 packet infos.
+ *
+ * Version 5 packet infos refer to the ones before, so when a batch of them is
+ * dropped the server resets its encoder and puts PROTO_COMPACT_RESET in front
+ * of the next packet info, where the client resets its decoder.
+ *
+ * The hello also contains the compression methods the client can decode.
+ * If the server has compression enabled (server_compress) it answers with
+ * the method it is going to use and then may send PROTO_COMPRESSED blocks,
+ * which contain a number of other messages.
+ *
+ * Clients which want summaries (client_summary) set NET_HELLO_SUMMARY in the
+ * hello, and if the server has server_summary enabled it sets it in the
+ * answer and sends PROTO_SUMMARY messages instead of packet infos.
+ *
+ * Clients which want to receive multicast (client_multicast) set
+ * NET_HELLO_MCAST. If the server has server_multicast enabled and does not
+ * send them summaries, it sets it in the answer and sends PROTO_MCAST_INFO
+ * with the group, and the client gets packet infos only from the group. The
+ * TCP connection is still used for the channel list and configuration.
+ *
+ * Independent of the version, clients which set NET_HELLO_SAMPLED in the
+ * hello get PROTO_SAMPLE, see above.
+ */
+#define PROTO_VERSION		4
+#define PROTO_VERSION_COMPACT	5
 
 enum pkt_type {
 	PROTO_PKT_INFO		= 0,
 	PROTO_CHAN_LIST		= 1,
 	PROTO_CONF_CHAN		= 2,
 	PROTO_CONF_FILTER	= 3,
+	PROTO_HELLO		= 4,
+	PROTO_COMPRESSED	= 5,
+	PROTO_SUMMARY		= 6,
+	PROTO_MCAST_INFO	= 7,
+	PROTO_MCAST_DATA	= 8,
+	PROTO_SAMPLE		= 9,
+	PROTO_COMPACT_RESET	= 10,
 };
 
 struct net_header {
@@ -57,6 +206,70 @@ struct net_header {
 	unsigned char type;
 } __attribute__ ((packed));
 
+struct net_hello {
+	struct net_header	proto;
+
+	unsigned char max_version;
+	unsigned char compress;		/* NET_COMPRESS_* and NET_HELLO_* */
+} __attribute__ ((packed));
+
+/* not compression methods, but what else the client can do or wants:
+ * it understands PROTO_SAMPLE, it wants PROTO_SUMMARY or multicast instead of
+ * packet infos. The server answers with the ones it agreed to */
+#define NET_HELLO_SAMPLED	0x80
+#define NET_HELLO_SUMMARY	0x40
+#define NET_HELLO_MCAST		0x20
+
+/* from now on 1 in 'ratio' data and control frames is sent */
+struct net_sample {
+	struct net_header	proto;
+
+	uint16_t ratio;
+} __attribute__ ((packed));
+
+struct net_summary {
+	struct net_header	proto;
+
+	uint16_t len;			/* including header */
+	unsigned char data[];		/* records, see net_summary.c */
+} __attribute__ ((packed));
+
+struct net_mcast_info {
+	struct net_header	proto;
+
+	uint32_t group;			/* network byte order */
+	uint16_t port;			/* network byte order */
+} __attribute__ ((packed));
+
+/*
+ * A multicast datagram is a PROTO_MCAST_DATA header followed by a number of
+ * version 4 packet infos. Packet infos are used because they can be decoded
+ * without state from earlier datagrams, which may have been lost. The
+ * sequence number increases by one for every datagram, so receivers can
+ * detect lost datagrams.
+ */
+struct net_mcast_data {
+	struct net_header	proto;
+
+	uint32_t seq;
+} __attribute__ ((packed));
+
+struct net_compressed {
+	struct net_header	proto;
+
+	uint32_t raw_len;
+	uint32_t len;
+	unsigned char data[];
+} __attribute__ ((packed));
+
+/* compact packet info: header, one byte length and the encoded record */
+struct net_compact_info {
+	struct net_header	proto;
+
+	unsigned char len;
+	unsigned char data[NET_COMPACT_MAX_LEN];
+} __attribute__ ((packed));
+
 struct net_conf_chan {
 	struct net_header	proto;
 
@@ -159,18 +372,242 @@ struct net_packet_info {
 	unsigned char		bat_pkt_type;
 } __attribute__ ((packed));
 
+static struct net_client* net_find_client(int fd)
+{
+	for (int i = 0; i < MAX_NET_CLIENTS; i++)
+		if (clients[i].fd == fd && fd != -1)
+			return &clients[i];
+	return NULL;
+}
+
+static void net_client_close(struct net_client* c, const char* reason)
+{
+	LOG_INF("Client %d closed (%s)", c->fd, reason);
+	event_del_fd(c->fd);
+	close(c->fd);
+	c->fd = -1;
+	byte_ring_free(&c->tx);
+	byte_ring_free(&c->rx);
+	c->batch_len = 0;
+	c->batch_records = 0;
+	c->hello = false;
+	c->sampled = false;
+	c->mcast = false;
+	c->summary = false;
+	net_compact_free(c->compact);
+	c->compact = NULL;
+	c->compact_reset = false;
+	net_compressor_free(c->zc);
+	c->zc = NULL;
+	free(c->zbuf);
+	c->zbuf = NULL;
+	net_num_clients--;
+}
+
+static void net_client_writable(int fd)
+{
+	struct net_client* c = net_find_client(fd);
+	ssize_t ret;
+
+	if (c == NULL)
+		return;
+
+	ret = send(fd, byte_ring_read_ptr(&c->tx), byte_ring_used(&c->tx),
+		   MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (ret < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			net_client_close(c, strerror(errno));
+		return;
+	}
+
+	byte_ring_consume(&c->tx, ret);
+	if (byte_ring_used(&c->tx) == 0) {
+		event_set_write_cb(fd, NULL);
+		c->full_since = 0;
+	}
+}
+
+static void net_client_drop(struct net_client* c, unsigned int records)
+{
+	stats.net_drops += records;
+	/* the next summary has to replace what was lost, and the sampling
+	 * ratio may have been in the dropped batch */
+	c->summary_full = true;
+	c->sample_sent = 0;
+	/* the client never sees the records the encoder remembers now */
+	if (c->compact != NULL) {
+		net_compact_reset(c->compact);
+		c->compact_reset = true;
+	}
+	if (c->full_since == 0)
+		c->full_since = time_mono.tv_sec;
+	else if (time_mono.tv_sec - c->full_since >= NET_CLIENT_STALL_SEC)
+		net_client_close(c, "too slow");
+}
+
+/* queue or send to one client, never blocks. Only whole messages are
+ * dropped: if 'records' is not 0 buf contains this number of packet infos
+ * which may be dropped */
+static void net_client_write(struct net_client* c, const unsigned char* buf,
+			     size_t len, unsigned int records)
+{
+	bool droppable = records > 0;
+	ssize_t ret;
+
+	if (byte_ring_used(&c->tx) == 0) {
+		ret = send(c->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				net_client_close(c, strerror(errno));
+				return;
+			}
+			ret = 0;
+		}
+		if ((size_t)ret == len)
+			return;
+		/* the rest of a partially sent message must be queued */
+		buf += ret;
+		len -= ret;
+		droppable = droppable && ret == 0;
+	}
+
+	if (len > byte_ring_space(&c->tx)) {
+		if (droppable)
+			net_client_drop(c, records);
+		else
+			net_client_close(c, "send queue overflow");
+		return;
+	}
+
+	if (byte_ring_used(&c->tx) == 0)
+		event_set_write_cb(c->fd, net_client_writable);
+	memcpy(byte_ring_write_ptr(&c->tx), buf, len);
+	byte_ring_produce(&c->tx, len);
+}
+
+static void net_client_write_compressed(struct net_client* c, size_t len,
+					unsigned int records)
+{
+	struct net_compressed* nz = (struct net_compressed*)c->zbuf;
+	size_t bound = net_compress_bound(len);
+	struct timespec t1, t2;
+	size_t zlen;
+
+	/* blocks refer to the previous ones, so once compressed a block must
+	 * not be dropped anymore. Drop it before if it might not fit */
+	if (byte_ring_used(&c->tx) > 0 &&
+	    sizeof(*nz) + bound > byte_ring_space(&c->tx)) {
+		net_client_drop(c, records);
+		return;
+	}
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+	zlen = net_compress_block(c->zc, c->batch, len, nz->data, bound);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t2);
+
+	if (zlen == 0) {
+		net_client_close(c, "compression failed");
+		return;
+	}
+
+	nz->proto.version = PROTO_VERSION;
+	nz->proto.type = PROTO_COMPRESSED;
+	nz->raw_len = htole32(len);
+	nz->len = htole32(zlen);
+
+	stats.net_comp_blocks++;
+	stats.net_comp_in += len;
+	stats.net_comp_out += sizeof(*nz) + zlen;
+	stats.net_comp_nsec += (t2.tv_sec - t1.tv_sec) * 1000000000L + t2.tv_nsec - t1.tv_nsec;
+
+	net_client_write(c, c->zbuf, sizeof(*nz) + zlen, 0);
+}
+
+static void net_client_flush(struct net_client* c)
+{
+	size_t len = c->batch_len;
+	unsigned int records = c->batch_records;
+
+	if (len == 0)
+		return;
+
+	stats.net_flushes++;
+	stats.net_flush_records += records;
+	c->batch_len = 0;
+	c->batch_records = 0;
+
+	if (c->zc != NULL)
+		net_client_write_compressed(c, len, records);
+	else
+		net_client_write(c, c->batch, len, records);
+}
+
+static void net_mcast_flush(void)
+{
+	struct net_mcast_data* nm = (struct net_mcast_data*)mcast_buf;
+	ssize_t ret;
+
+	if (mcast_records == 0)
+		return;
+
+	nm->proto.version = PROTO_VERSION;
+	nm->proto.type = PROTO_MCAST_DATA;
+	nm->seq = htole32(mcast_seq++);
+
+	/* never block, receivers see the gap in the sequence numbers */
+	ret = sendto(mcast_fd, mcast_buf, mcast_len, MSG_DONTWAIT,
+		     (struct sockaddr*)&mcast_addr, sizeof(mcast_addr));
+	if (ret < 0)
+		stats.net_drops += mcast_records;
+	else
+		stats.net_mcast_sent++;
+
+	mcast_len = sizeof(struct net_mcast_data);
+	mcast_records = 0;
+}
+
+static void net_mcast_add(const struct net_packet_info* np)
+{
+	if (mcast_len + sizeof(*np) > sizeof(mcast_buf))
+		net_mcast_flush();
+
+	memcpy(mcast_buf + mcast_len, np, sizeof(*np));
+	mcast_len += sizeof(*np);
+	mcast_records++;
+
+	if (conf.server_flush == 0)
+		net_mcast_flush();
+}
+
+static void net_flush_timer_handler(__attribute__((unused)) int fd)
+{
+	flush_timer_armed = false;
+	if (mcast_fd != -1)
+		net_mcast_flush();
+	for (int i = 0; i < MAX_NET_CLIENTS; i++)
+		if (clients[i].fd != -1)
+			net_client_flush(&clients[i]);
+}
+
+/* blocking write to the server in client mode, or queued write to one of
+ * our clients in server mode */
 static bool net_write(int fd, unsigned char* buf, size_t len)
 {
+	struct net_client* c = net_find_client(fd);
 	int ret;
+
+	if (c != NULL) {
+		/* keep the order of messages */
+		net_client_flush(c);
+		if (c->fd != -1)
+			net_client_write(c, buf, len, 0);
+		return true;
+	}
+
 	ret = write(fd, buf, len);
 	if (ret == -1) {
-		if (errno == EPIPE) {
-			LOG_INF("Client has closed");
-			close(fd);
-			if (fd == cli_fd)
-				cli_fd = -1;
-			net_init_server_socket(conf.port);
-		}
+		if (errno == EPIPE)
+			LOG_INF("Server has closed");
 		else
 			LOG_ERR("ERROR: in net_write");
 		return false;
@@ -178,67 +615,289 @@ static bool net_write(int fd, unsigned char* buf, size_t len)
 	return true;
 }
 
-void net_send_packet(struct uwifi_packet *p)
+static void net_fill_packet_info(struct net_packet_info* np, struct uwifi_packet* p)
 {
-	struct net_packet_info np;
-
-	np.proto.version = PROTO_VERSION;
-	np.proto.type	= PROTO_PKT_INFO;
-
-	np.version	= PKT_INFO_VERSION;
-	np.pkt_types	= htole32(p->pkt_types);
-	np.phy_signal	= htole32(p->phy_signal);
-	np.phy_rate	= htole32(p->phy_rate);
-	np.phy_rate_idx	= p->phy_rate_idx;
-	np.phy_rate_flags = p->phy_rate_flags;
-	np.phy_freq	= htole32(p->phy_freq);
-	np.phy_flags	= htole32(p->phy_flags);
-	np.wlan_len	= htole32(p->wlan_len);
-	np.wlan_type	= htole32(p->wlan_type);
-	memcpy(np.wlan_ta, p->wlan_ta, WLAN_MAC_LEN);
-	memcpy(np.wlan_ra, p->wlan_ra, WLAN_MAC_LEN);
-	memcpy(np.wlan_bssid, p->wlan_bssid, WLAN_MAC_LEN);
-	memcpy(np.wlan_essid, p->wlan_essid, WLAN_MAX_SSID_LEN);
-	np.wlan_tsf	= htole64(p->wlan_tsf);
-	np.wlan_bintval	= htole32(p->wlan_bintval);
-	np.wlan_mode	= htole32(p->wlan_mode);
-	np.wlan_channel = p->wlan_channel;
-	np.wlan_chan_width = p->wlan_chan_width;
-	np.wlan_tx_streams = p->wlan_tx_streams;
-	np.wlan_rx_streams = p->wlan_rx_streams;
-	np.wlan_qos_class = p->wlan_qos_class;
-	np.wlan_nav	= htole32(p->wlan_nav);
-	np.wlan_seqno	= htole32(p->wlan_seqno);
-	np.wlan_flags = 0;
+	np->proto.version = PROTO_VERSION;
+	np->proto.type	= PROTO_PKT_INFO;
+
+	np->version	= PKT_INFO_VERSION;
+	np->pkt_types	= htole32(p->pkt_types);
+	np->phy_signal	= htole32(p->phy_signal);
+	np->phy_rate	= htole32(p->phy_rate);
+	np->phy_rate_idx	= p->phy_rate_idx;
+	np->phy_rate_flags = p->phy_rate_flags;
+	np->phy_freq	= htole32(p->phy_freq);
+	np->phy_flags	= htole32(p->phy_flags);
+	np->wlan_len	= htole32(p->wlan_len);
+	np->wlan_type	= htole32(p->wlan_type);
+	memcpy(np->wlan_ta, p->wlan_ta, WLAN_MAC_LEN);
+	memcpy(np->wlan_ra, p->wlan_ra, WLAN_MAC_LEN);
+	memcpy(np->wlan_bssid, p->wlan_bssid, WLAN_MAC_LEN);
+	memcpy(np->wlan_essid, p->wlan_essid, WLAN_MAX_SSID_LEN);
+	np->wlan_tsf	= htole64(p->wlan_tsf);
+	np->wlan_bintval	= htole32(p->wlan_bintval);
+	np->wlan_mode	= htole32(p->wlan_mode);
+	np->wlan_channel = p->wlan_channel;
+	np->wlan_chan_width = p->wlan_chan_width;
+	np->wlan_tx_streams = p->wlan_tx_streams;
+	np->wlan_rx_streams = p->wlan_rx_streams;
+	np->wlan_qos_class = p->wlan_qos_class;
+	np->wlan_nav	= htole32(p->wlan_nav);
+	np->wlan_seqno	= htole32(p->wlan_seqno);
+	np->wlan_flags = 0;
 	if (p->wlan_wep)
-		np.wlan_flags |= PKT_WLAN_FLAG_WEP;
+		np->wlan_flags |= PKT_WLAN_FLAG_WEP;
 	if (p->wlan_retry)
-		np.wlan_flags |= PKT_WLAN_FLAG_RETRY;
+		np->wlan_flags |= PKT_WLAN_FLAG_RETRY;
 	if (p->wlan_wpa)
-		np.wlan_flags |= PKT_WLAN_FLAG_WPA;
+		np->wlan_flags |= PKT_WLAN_FLAG_WPA;
 	if (p->wlan_rsn)
-		np.wlan_flags |= PKT_WLAN_FLAG_RSN;
+		np->wlan_flags |= PKT_WLAN_FLAG_RSN;
 	if (p->wlan_ht40plus)
-		np.wlan_flags |= PKT_WLAN_FLAG_HT40PLUS;
-	np.wlan_flags	= htole32(np.wlan_flags);
-	np.ip_src	= p->ip_src;
-	np.ip_dst	= p->ip_dst;
-	np.tcpudp_port	= htole32(p->tcpudp_port);
-	np.olsr_type	= htole32(p->olsr_type);
-	np.olsr_neigh	= htole32(p->olsr_neigh);
-	np.olsr_tc	= htole32(p->olsr_tc);
-	np.bat_flags = 0;
+		np->wlan_flags |= PKT_WLAN_FLAG_HT40PLUS;
+	np->wlan_flags	= htole32(np->wlan_flags);
+	np->ip_src	= p->ip_src;
+	np->ip_dst	= p->ip_dst;
+	np->tcpudp_port	= htole32(p->tcpudp_port);
+	np->olsr_type	= htole32(p->olsr_type);
+	np->olsr_neigh	= htole32(p->olsr_neigh);
+	np->olsr_tc	= htole32(p->olsr_tc);
+	np->bat_flags = 0;
 	if (p->bat_gw)
-		np.bat_flags |= PKT_BAT_FLAG_GW;
-	np.bat_pkt_type = p->bat_packet_type;
+		np->bat_flags |= PKT_BAT_FLAG_GW;
+	np->bat_pkt_type = p->bat_packet_type;
+}
+
+static void net_client_batch(struct net_client* c, const void* buf, size_t len)
+{
+	if (c->batch_len + len > conf.server_batch)
+		net_client_flush(c);
+	if (c->fd == -1)
+		return;
+
+	memcpy(c->batch + c->batch_len, buf, len);
+	c->batch_len += len;
+	c->batch_records++;
+
+	if (conf.server_flush == 0)
+		net_client_flush(c);
+}
+
+/* adapt the sampling ratio to the send queue, every NET_SAMPLE_INTERVAL */
+static void net_client_sample_adapt(struct net_client* c)
+{
+	long now = time_mono.tv_sec * 1000 + time_mono.tv_nsec / 1000000;
+	unsigned int old = c->sample;
+	size_t queued = byte_ring_used(&c->tx);
+
+	if (now - c->sample_time < NET_SAMPLE_INTERVAL)
+		return;
+	c->sample_time = now;
+
+	if (queued < NET_CLIENT_LOW_WATER)
+		c->sample_low++;
+	else
+		c->sample_low = 0;
+
+	/* not enough if the queue is still growing, but once it shrinks
+	 * wait until it has drained before sending more again */
+	if (queued > NET_CLIENT_HIGH_WATER && queued >= c->sample_slen)
+		c->sample = MIN(c->sample * 2, conf.server_sample_max);
+	else if (c->sample_low >= 10 && c->sample > 1) {
+		c->sample /= 2;
+		c->sample_low = 0;
+	}
+	c->sample_slen = queued;
+
+	if (c->sample != old)
+		LOG_DBG("Client %d sampling 1 in %u", c->fd, c->sample);
+}
+
+/* returns false if the packet is not sent to this client */
+static bool net_client_sample(struct net_client* c, struct uwifi_packet* p)
+{
+	struct net_sample ns;
+
+	if (!c->sampled)
+		return true;
+
+	net_client_sample_adapt(c);
+
+	if (c->sample > 1 && !WLAN_FRAME_IS_MGMT(p->wlan_type) &&
+	    ++c->sample_cnt % c->sample != 0) {
+		stats.net_sampled++;
+		return false;
+	}
+
+	if (c->sample_sent != c->sample) {
+		ns.proto.version = PROTO_VERSION;
+		ns.proto.type = PROTO_SAMPLE;
+		ns.ratio = htole16(c->sample);
+		net_client_batch(c, &ns, sizeof(ns));
+		c->sample_sent = c->sample;
+	}
+	return c->fd != -1;
+}
+
+static void net_client_compact_info(struct net_client* c, struct uwifi_packet* p)
+{
+	struct net_compact_info nci;
+	struct net_header* nh;
+
+	/* the record is encoded with the current state of the encoder, which
+	 * is reset when the batch is dropped. So make room first, and send
+	 * the reset in the same batch as the record */
+	if (c->batch_len + sizeof(*nh) + sizeof(nci) > conf.server_batch)
+		net_client_flush(c);
+	if (c->fd == -1)
+		return;
+
+	if (c->compact_reset) {
+		nh = (struct net_header*)(c->batch + c->batch_len);
+		nh->version = PROTO_VERSION;
+		nh->type = PROTO_COMPACT_RESET;
+		c->batch_len += sizeof(*nh);
+		c->compact_reset = false;
+	}
+
+	nci.proto.version = PROTO_VERSION_COMPACT;
+	nci.proto.type = PROTO_PKT_INFO;
+	nci.len = net_compact_encode(c->compact, p, nci.data);
+	net_client_batch(c, &nci, offsetof(struct net_compact_info, data) + nci.len);
+}
+
+void net_send_packet(struct uwifi_packet *p)
+{
+	struct net_packet_info np;
+	bool have_np = false;
+
+	for (int i = 0; i < MAX_NET_CLIENTS; i++) {
+		struct net_client* c = &clients[i];
+		if (c->fd == -1 || c->summary || c->mcast)
+			continue;
+
+		if (!net_client_sample(c, p))
+			continue;
+
+		if (c->compact != NULL) {
+			net_client_compact_info(c, p);
+		} else {
+			/* the same for all version 4 clients */
+			if (!have_np) {
+				net_fill_packet_info(&np, p);
+				have_np = true;
+			}
+			net_client_batch(c, &np, sizeof(np));
+		}
+	}
+
+	if (mcast_fd != -1) {
+		if (!have_np)
+			net_fill_packet_info(&np, p);
+		net_mcast_add(&np);
+	}
+
+	if (conf.server_flush > 0 && !flush_timer_armed) {
+		event_timer_set(flush_timer, conf.server_flush * 1000, false);
+		flush_timer_armed = true;
+	}
+}
+
+/* summary message which is being collected */
+static unsigned char summary_buf[NET_MAX_BATCH];
+static size_t summary_len;
+
+static void net_summary_send(void)
+{
+	struct net_summary* ns = (struct net_summary*)summary_buf;
+
+	if (summary_len <= sizeof(*ns))
+		return;
+
+	ns->proto.version = PROTO_VERSION;
+	ns->proto.type = PROTO_SUMMARY;
+	ns->len = htole16(summary_len);
+
+	for (int i = 0; i < MAX_NET_CLIENTS; i++)
+		if (clients[i].fd != -1 && clients[i].summary_now)
+			net_client_batch(&clients[i], summary_buf, summary_len);
+
+	summary_len = sizeof(*ns);
+}
+
+static void net_summary_add(const unsigned char* rec, size_t len)
+{
+	/* a message has to fit into the batch */
+	if (summary_len + len > conf.server_batch)
+		net_summary_send();
 
-	net_write(cli_fd, (unsigned char *)&np, sizeof(np));
+	memcpy(summary_buf + summary_len, rec, len);
+	summary_len += len;
 }
 
-static int net_receive_packet(unsigned char *buffer, size_t len)
+static void net_summary_timer_handler(__attribute__((unused)) int fd)
 {
-	struct net_packet_info *np;
+	bool sent = false;
+	int i, full;
+
+	/* first the changes for clients which are up to date, then everything
+	 * for new clients and those which lost a summary */
+	for (full = 0; full <= 1; full++) {
+		bool any = false;
+
+		for (i = 0; i < MAX_NET_CLIENTS; i++) {
+			struct net_client* c = &clients[i];
+			c->summary_now = c->fd != -1 && c->summary && c->summary_full == full;
+			if (c->summary_now) {
+				c->summary_full = false;
+				any = true;
+			}
+		}
+		if (!any)
+			continue;
+
+		summary_len = sizeof(struct net_summary);
+		net_summary_collect(full, net_summary_add);
+		net_summary_send();
+		sent = true;
+	}
+
+	if (!sent)
+		return;
+
+	net_summary_commit();
+	for (i = 0; i < MAX_NET_CLIENTS; i++)
+		if (clients[i].fd != -1 && clients[i].summary)
+			net_client_flush(&clients[i]);
+}
+
+/* the collector threads can not log to the display, they only count errors
+ * which are shown with the sensor status */
+#define NET_RX_ERR(_rx, ...) do {						\
+	if ((_rx) != NULL && (_rx)->packet_cb != NULL)				\
+		__atomic_add_fetch(&(_rx)->errors, 1, __ATOMIC_RELAXED);	\
+	else									\
+		LOG_ERR(__VA_ARGS__);						\
+} while (0)
+
+static void net_rx_packet(struct net_rx* rx, struct uwifi_packet* p)
+{
+	if (rx != NULL && rx->packet_cb != NULL)
+		rx->packet_cb(p, rx->ctx);
+	else {
+		net_sample = rx != NULL ? rx->sample : 1;
+		handle_packet(p, NULL, 0, NULL);
+	}
+}
+
+/* the packet info is decoded directly from the receive buffer, where it may
+ * be unaligned. This is fine because all accesses go through the packed
+ * struct */
+static int net_receive_packet(struct net_rx* rx, unsigned char *buffer, size_t len)
+{
+	const struct net_packet_info *np;
 	struct uwifi_packet p;
+	uint32_t flags;
 
 	if (len < sizeof(struct net_packet_info))
 		return 0;
@@ -275,16 +934,16 @@ static int net_receive_packet(unsigned char *buffer, size_t len)
 	p.wlan_qos_class = np->wlan_qos_class;
 	p.wlan_nav	= le32toh(np->wlan_nav);
 	p.wlan_seqno	= le32toh(np->wlan_seqno);
-	np->wlan_flags	= le32toh(np->wlan_flags);
-	if (np->wlan_flags & PKT_WLAN_FLAG_WEP)
+	flags		= le32toh(np->wlan_flags);
+	if (flags & PKT_WLAN_FLAG_WEP)
 		p.wlan_wep = 1;
-	if (np->wlan_flags & PKT_WLAN_FLAG_RETRY)
+	if (flags & PKT_WLAN_FLAG_RETRY)
 		p.wlan_retry = 1;
-	if (np->wlan_flags & PKT_WLAN_FLAG_WPA)
+	if (flags & PKT_WLAN_FLAG_WPA)
 		p.wlan_wpa = 1;
-	if (np->wlan_flags & PKT_WLAN_FLAG_RSN)
+	if (flags & PKT_WLAN_FLAG_RSN)
 		p.wlan_rsn = 1;
-	if (np->wlan_flags & PKT_WLAN_FLAG_HT40PLUS)
+	if (flags & PKT_WLAN_FLAG_HT40PLUS)
 		p.wlan_ht40plus = 1;
 	p.ip_src	= np->ip_src;
 	p.ip_dst	= np->ip_dst;
@@ -296,7 +955,7 @@ static int net_receive_packet(unsigned char *buffer, size_t len)
 		p.bat_gw = 1;
 	p.bat_packet_type = np->bat_pkt_type;
 
-	handle_packet(&p);
+	net_rx_packet(rx, &p);
 
 	return sizeof(struct net_packet_info);
 }
@@ -338,16 +997,17 @@ static int net_receive_conf_chan(unsigned char *buffer, size_t len)
 	if (conf.intf.channel.freq != ch.freq ||
 	    conf.intf.channel.center_freq != ch.center_freq ||
 	    conf.intf.channel.width != ch.width) { /* something changed */
-		if (cli_fd > -1) { /* server */
+		if (conf.serveraddr[0] == '\0') { /* server */
 			if (!uwifi_channel_change(&conf.intf, &ch)) {
 				LOG_ERR("Net Channel %s is not available/allowed",
 					uwifi_channel_get_string(&ch));
-				net_send_channel_config();
 			} else {
 				/* success: update UI */
 				conf.intf.channel_set = ch;
 				update_display(NULL);
 			}
+			/* tell all clients the resulting channel */
+			net_send_channel_config();
 		} else { /* client */
 			conf.intf.channel_idx = uwifi_channel_idx_from_freq(&conf.intf.channels, ch.freq);
 			conf.intf.channel = conf.intf.channel_set = ch;
@@ -413,6 +1073,12 @@ static int net_receive_conf_filter(unsigned char *buffer, size_t len)
 	conf.filter_off = !!(nc->filter_flags & NET_FILTER_OFF);
 	conf.filter_badfcs = !!(nc->filter_flags & NET_FILTER_BADFCS);
 
+	/* server: filter changed by client, tell the other clients */
+	if (conf.serveraddr[0] == '\0') {
+		bpf_filter_update();
+		net_send_filter_config();
+	}
+
 	return sizeof(struct net_conf_filter);
 }
 
@@ -460,15 +1126,20 @@ static int net_receive_chan_list(unsigned char *buffer, size_t len)
 
 	nc = (struct net_chan_list *)buffer;
 
-	for (int i = 0; i < nc->num_bands; i++) {
-		uwifi_channel_band_add(&conf.intf.channels, nc->band[i].num_chans, nc->band[i].max_width,
-				 nc->band[i].streams_rx, nc->band[i].streams_tx);
+	for (int i = 0; i < nc->num_bands; i++)
 		num_chans += nc->band[i].num_chans;
-	}
 
 	if (len < sizeof(struct net_chan_list) + sizeof(unsigned int) * (num_chans - 1))
 		return 0;
 
+	/* the collector gets it again from every sensor and on reconnect */
+	if (uwifi_channel_get_num_channels(&conf.intf.channels) > 0)
+		return sizeof(struct net_chan_list) + sizeof(unsigned int) * (num_chans - 1);
+
+	for (int i = 0; i < nc->num_bands; i++)
+		uwifi_channel_band_add(&conf.intf.channels, nc->band[i].num_chans, nc->band[i].max_width,
+				 nc->band[i].streams_rx, nc->band[i].streams_tx);
+
 	for (int i = 0; i < num_chans; i++) {
 		uwifi_channel_list_add(&conf.intf.channels, le32toh(nc->freq[i]));
 		LOG_DBG("NET recv freq %d %d", i, le32toh(nc->freq[i]));
@@ -477,18 +1148,359 @@ static int net_receive_chan_list(unsigned char *buffer, size_t len)
 	return sizeof(struct net_chan_list) + sizeof(unsigned int) * (num_chans - 1);
 }
 
-static int try_receive_packet(unsigned char* buf, size_t len)
+static void net_fill_hello(struct net_hello* nh, int max_version, unsigned int compress)
+{
+	nh->proto.version = PROTO_VERSION;
+	nh->proto.type = PROTO_HELLO;
+	nh->max_version = max_version;
+	nh->compress = compress;
+}
+
+static void net_send_hello(int fd, int max_version, unsigned int compress)
+{
+	struct net_hello nh;
+
+	net_fill_hello(&nh, max_version, compress);
+	net_write(fd, (unsigned char *)&nh, sizeof(nh));
+}
+
+static void net_send_mcast_info(int fd)
+{
+	struct net_mcast_info nm;
+
+	nm.proto.version = PROTO_VERSION;
+	nm.proto.type = PROTO_MCAST_INFO;
+	nm.group = mcast_addr.sin_addr.s_addr;
+	nm.port = mcast_addr.sin_port;
+
+	net_write(fd, (unsigned char *)&nm, sizeof(nm));
+}
+
+static void net_mcast_receive(int fd)
+{
+	static unsigned char buf[NET_MCAST_MTU];
+	struct net_mcast_data* nm = (struct net_mcast_data*)buf;
+	size_t pos = sizeof(*nm);
+	uint32_t seq;
+	ssize_t len;
+	int n;
+
+	len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (len < (ssize_t)sizeof(*nm) || nm->proto.version != PROTO_VERSION ||
+	    nm->proto.type != PROTO_MCAST_DATA)
+		return;
+
+	seq = le32toh(nm->seq);
+	if (mcast_rx_started && (int32_t)(seq - mcast_rx_seq) > 0)
+		stats.net_mcast_lost += seq - mcast_rx_seq;
+	if (!mcast_rx_started || (int32_t)(seq - mcast_rx_seq) >= 0)
+		mcast_rx_seq = seq + 1;
+	mcast_rx_started = true;
+
+	/* only packet infos, anyone can send to the group */
+	while (pos + sizeof(struct net_header) < (size_t)len &&
+	       buf[pos] == PROTO_VERSION && buf[pos + 1] == PROTO_PKT_INFO) {
+		n = net_receive_packet(&client_rx, buf + pos, len - pos);
+		if (n == 0)
+			break;
+		pos += n;
+	}
+}
+
+/* client: join the group the server told us */
+static int net_receive_mcast_info(unsigned char *buffer, size_t len)
+{
+	struct net_mcast_info *nm;
+	struct sockaddr_in sin, local;
+	struct ip_mreq mreq;
+	socklen_t local_len = sizeof(local);
+	int reuse = 1;
+
+	if (len < sizeof(struct net_mcast_info))
+		return 0;
+
+	nm = (struct net_mcast_info *)buffer;
+	if (conf.serveraddr[0] == '\0' || mcast_rx_fd != -1)
+		return sizeof(struct net_mcast_info);
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = nm->group;
+	sin.sin_port = nm->port;
+
+	/* join on the interface we use to reach the server */
+	memset(&local, 0, sizeof(local));
+	getsockname(netmon_fd, (struct sockaddr*)&local, &local_len);
+	mreq.imr_multiaddr.s_addr = nm->group;
+	mreq.imr_interface = local.sin_addr;
+
+	mcast_rx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (mcast_rx_fd < 0 ||
+	    setsockopt(mcast_rx_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+	    bind(mcast_rx_fd, (struct sockaddr*)&sin, sizeof(sin)) < 0 ||
+	    setsockopt(mcast_rx_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+		LOG_ERR("Could not join multicast group %s (%s)",
+			inet_ntoa(sin.sin_addr), strerror(errno));
+		if (mcast_rx_fd >= 0)
+			close(mcast_rx_fd);
+		mcast_rx_fd = -1;
+		return sizeof(struct net_mcast_info);
+	}
+
+	if (conf.recv_buffer_size)
+		setsockopt(mcast_rx_fd, SOL_SOCKET, SO_RCVBUF, &conf.recv_buffer_size,
+			   sizeof(conf.recv_buffer_size));
+
+	event_add_fd(mcast_rx_fd, net_mcast_receive);
+	LOG_INF("Receiving packets from multicast group %s port %d",
+		inet_ntoa(sin.sin_addr), ntohs(sin.sin_port));
+	return sizeof(struct net_mcast_info);
+}
+
+static int net_receive_hello(int fd, struct net_rx* rx, unsigned char *buffer, size_t len)
+{
+	struct net_hello *nh;
+	struct net_client* c;
+	unsigned int compress;
+	int version;
+
+	if (len < sizeof(struct net_hello))
+		return 0;
+
+	nh = (struct net_hello *)buffer;
+	version = MIN(nh->max_version, PROTO_VERSION_COMPACT);
+	compress = nh->compress & net_compress_methods();
+
+	if (conf.serveraddr[0] != '\0') { /* client: what the server agreed to */
+		version = nh->max_version;
+		if (rx == NULL)
+			return sizeof(struct net_hello);
+		if (version >= PROTO_VERSION_COMPACT && rx->compact == NULL)
+			rx->compact = net_compact_new();
+		if (compress && rx->decomp == NULL) {
+			rx->decomp = net_decompressor_new();
+			rx->block = malloc(NET_MAX_BATCH);
+		}
+		/* the collector threads can not log to the display */
+		if (rx->packet_cb == NULL)
+			LOG_INF("Using protocol version %d%s%s%s", version,
+				compress ? " with compression" : "",
+				nh->compress & NET_HELLO_SUMMARY ? " with summaries" : "",
+				nh->compress & NET_HELLO_MCAST ? " with multicast" : "");
+		return sizeof(struct net_hello);
+	}
+
+	c = net_find_client(fd);
+	if (c == NULL || c->hello)
+		return sizeof(struct net_hello);
+	c->hello = true;
+	c->sampled = (nh->compress & NET_HELLO_SAMPLED) && conf.server_sample_max > 1;
+	c->summary = (nh->compress & NET_HELLO_SUMMARY) && conf.server_summary > 0;
+	/* a client which asks for both does not need the packet infos */
+	c->mcast = (nh->compress & NET_HELLO_MCAST) && mcast_fd != -1 && !c->summary;
+
+	if (conf.server_compress == 0)
+		compress = 0;
+
+	/* the answer is sent after all version 4 packet infos in the batch,
+	 * so all packet infos after it are version 5 */
+	net_send_hello(fd, version, compress | (c->summary ? NET_HELLO_SUMMARY : 0) |
+		       (c->mcast ? NET_HELLO_MCAST : 0));
+	if (c->fd == -1)
+		return sizeof(struct net_hello);
+
+	if (c->summary)
+		c->summary_full = true;
+	else if (c->mcast) {
+		net_send_mcast_info(fd);
+		if (c->fd == -1)
+			return sizeof(struct net_hello);
+	} else if (version >= PROTO_VERSION_COMPACT)
+		c->compact = net_compact_new();
+
+	if (compress) {
+		c->zc = net_compressor_new(conf.server_compress);
+		c->zbuf = malloc(sizeof(struct net_compressed) + net_compress_bound(NET_MAX_BATCH));
+		if (c->zc == NULL || c->zbuf == NULL) {
+			/* we just don't send compressed blocks */
+			LOG_ERR("Could not initialize compression");
+			net_compressor_free(c->zc);
+			c->zc = NULL;
+			free(c->zbuf);
+			c->zbuf = NULL;
+		}
+	}
+
+	LOG_INF("Client %d uses protocol version %d%s%s%s", fd,
+		c->compact != NULL ? PROTO_VERSION_COMPACT : PROTO_VERSION,
+		c->zc != NULL ? " with compression" : "",
+		c->summary ? " with summaries" : "",
+		c->mcast ? " with multicast" : "");
+	return sizeof(struct net_hello);
+}
+
+static int net_receive_compact_info(struct net_rx* rx, unsigned char *buffer, size_t len)
+{
+	struct net_compact_info *nci = (struct net_compact_info *)buffer;
+	struct uwifi_packet p;
+	size_t msg_len;
+
+	if (len < offsetof(struct net_compact_info, data))
+		return 0;
+
+	msg_len = offsetof(struct net_compact_info, data) + nci->len;
+	if (len < msg_len)
+		return 0;
+
+	if (rx == NULL || rx->compact == NULL ||
+	    !net_compact_decode(rx->compact, nci->data, nci->len, &p)) {
+		NET_RX_ERR(rx, "ERROR: invalid compact packet info");
+		return msg_len;
+	}
+
+	net_rx_packet(rx, &p);
+	return msg_len;
+}
+
+static int net_receive_summary(unsigned char *buffer, size_t len)
+{
+	struct net_summary *ns = (struct net_summary *)buffer;
+	size_t msg_len;
+
+	if (len < sizeof(struct net_summary))
+		return 0;
+
+	msg_len = le16toh(ns->len);
+	if (msg_len < sizeof(struct net_summary))
+		return 0;
+	if (len < msg_len)
+		return 0;
+
+	if (!net_summary_apply(ns->data, msg_len - sizeof(*ns))) {
+		LOG_ERR("ERROR: invalid summary");
+		return msg_len;
+	}
+
+	if (!conf.quiet && !conf.debug)
+		update_display(NULL);
+	return msg_len;
+}
+
+static int net_receive_sample(struct net_rx* rx, unsigned char *buffer, size_t len)
+{
+	struct net_sample *ns = (struct net_sample *)buffer;
+
+	if (len < sizeof(struct net_sample))
+		return 0;
+
+	if (rx != NULL)
+		rx->sample = MAX(le16toh(ns->ratio), 1);
+	return sizeof(struct net_sample);
+}
+
+static int net_receive_compact_reset(struct net_rx* rx, size_t len)
+{
+	if (len < sizeof(struct net_header))
+		return 0;
+
+	if (rx != NULL && rx->compact != NULL)
+		net_compact_reset(rx->compact);
+	return sizeof(struct net_header);
+}
+
+static int try_receive_packet(int fd, struct net_rx* rx, unsigned char* buf, size_t len);
+
+static int net_receive_compressed(int fd, struct net_rx* rx, unsigned char *buffer, size_t len)
+{
+	struct net_compressed *nz;
+	size_t msg_len, raw_len, pos = 0;
+	int n;
+
+	if (len < sizeof(struct net_compressed))
+		return 0;
+
+	nz = (struct net_compressed *)buffer;
+	raw_len = le32toh(nz->raw_len);
+	msg_len = sizeof(struct net_compressed) + le32toh(nz->len);
+	if (len < msg_len)
+		return 0;
+
+	if (rx == NULL || rx->in_block || raw_len > NET_MAX_BATCH ||
+	    rx->decomp == NULL || rx->block == NULL ||
+	    !net_decompress_block(rx->decomp, nz->data, msg_len - sizeof(*nz), rx->block, raw_len)) {
+		NET_RX_ERR(rx, "ERROR: could not decompress block");
+		return msg_len;
+	}
+
+	/* a block contains only complete messages */
+	rx->in_block = true;
+	while (pos < raw_len) {
+		n = try_receive_packet(fd, rx, rx->block + pos, raw_len - pos);
+		if (n == 0)
+			break;
+		pos += n;
+	}
+	rx->in_block = false;
+
+	return msg_len;
+}
+
+/* length of a configuration message, or 0 if it is incomplete */
+static size_t net_conf_message_len(struct net_rx* rx, unsigned char* buf, size_t len)
 {
 	struct net_header *nh = (struct net_header *)buf;
+	struct net_chan_list *nc;
+	size_t msg_len;
+	int num_chans = 0;
+
+	switch (nh->type) {
+	case PROTO_CHAN_LIST:
+		if (len < sizeof(struct net_chan_list))
+			return 0;
+		nc = (struct net_chan_list *)buf;
+		for (int i = 0; i < nc->num_bands; i++)
+			num_chans += nc->band[i].num_chans;
+		msg_len = sizeof(struct net_chan_list) + sizeof(unsigned int) * (num_chans - 1);
+		break;
+	case PROTO_CONF_CHAN:
+		msg_len = sizeof(struct net_conf_chan);
+		break;
+	case PROTO_CONF_FILTER:
+		msg_len = sizeof(struct net_conf_filter);
+		break;
+	default:
+		NET_RX_ERR(rx, "ERROR: unexpected net packet type %d", nh->type);
+		return 0;
+	}
+
+	return len < msg_len ? 0 : msg_len;
+}
+
+static int try_receive_packet(int fd, struct net_rx* rx, unsigned char* buf, size_t len)
+{
+	struct net_header *nh = (struct net_header *)buf;
+
+	if (nh->version == PROTO_VERSION_COMPACT && nh->type == PROTO_PKT_INFO)
+		return net_receive_compact_info(rx, buf, len);
 
 	if (nh->version != PROTO_VERSION) {
-		LOG_ERR("ERROR: protocol version %x", nh->version);
+		NET_RX_ERR(rx, "ERROR: protocol version %x", nh->version);
 		return 0;
 	}
 
+	/* the collector handles configuration messages in the main thread */
+	if (rx != NULL && rx->message_cb != NULL && nh->type != PROTO_PKT_INFO &&
+	    nh->type != PROTO_HELLO && nh->type != PROTO_COMPRESSED &&
+	    nh->type != PROTO_SAMPLE && nh->type != PROTO_COMPACT_RESET) {
+		len = net_conf_message_len(rx, buf, len);
+		if (len > 0)
+			rx->message_cb(buf, len, rx->ctx);
+		return len;
+	}
+
 	switch (nh->type) {
 	case PROTO_PKT_INFO:
-		len = net_receive_packet(buf, len);
+		len = net_receive_packet(rx, buf, len);
 		break;
 	case PROTO_CHAN_LIST:
 		len = net_receive_chan_list(buf, len);
@@ -499,56 +1511,203 @@ static int try_receive_packet(unsigned char* buf, size_t len)
 	case PROTO_CONF_FILTER:
 		len = net_receive_conf_filter(buf, len);
 		break;
+	case PROTO_HELLO:
+		len = net_receive_hello(fd, rx, buf, len);
+		break;
+	case PROTO_COMPRESSED:
+		len = net_receive_compressed(fd, rx, buf, len);
+		break;
+	case PROTO_SUMMARY:
+		len = net_receive_summary(buf, len);
+		break;
+	case PROTO_MCAST_INFO:
+		len = net_receive_mcast_info(buf, len);
+		break;
+	case PROTO_SAMPLE:
+		len = net_receive_sample(rx, buf, len);
+		break;
+	case PROTO_COMPACT_RESET:
+		len = net_receive_compact_reset(rx, len);
+		break;
 	default:
-		LOG_ERR("ERROR: unknown net packet type");
+		NET_RX_ERR(rx, "ERROR: unknown net packet type");
 		len = 0;
 	}
 
 	return len; /* the number of bytes we have consumed */
 }
 
-int net_receive(int fd, unsigned char* buffer, size_t* buflen, size_t maxlen)
+/* read as much as fits into the ring and handle all complete messages in
+ * place. A partial message stays in the ring, also when it wraps around */
+static int net_ring_receive(int fd, struct byte_ring* r, struct net_rx* rx)
 {
 	int len, consumed = 0;
 
-	len = recv(fd, buffer + *buflen, maxlen - *buflen, MSG_DONTWAIT);
+	len = recv(fd, byte_ring_write_ptr(r), byte_ring_space(r), MSG_DONTWAIT);
 
-	if (len < 0)
-		return 0;
+	if (len <= 0)
+		return -1; /* nothing more to read */
 
-	*buflen += len;
+	byte_ring_produce(r, len);
 
-	while (*buflen > sizeof(struct net_header)) {
-		len = try_receive_packet(buffer + consumed, *buflen);
+	while (byte_ring_used(r) > sizeof(struct net_header)) {
+		len = try_receive_packet(fd, rx, byte_ring_read_ptr(r), byte_ring_used(r));
 		if (len == 0)
 			break;
-		*buflen -= len;
+		byte_ring_consume(r, len);
 		consumed += len;
 	}
-	memmove(buffer, buffer + consumed, *buflen);
+
+	/* a message which can never fit would block the connection forever */
+	if (byte_ring_space(r) == 0) {
+		NET_RX_ERR(rx, "ERROR: message too large, discarding %zu bytes", byte_ring_used(r));
+		byte_ring_consume(r, byte_ring_used(r));
+	}
 
 	return consumed;
 }
 
-void net_handle_server_conn(void)
+int net_rx_receive(int fd, struct net_rx* rx)
+{
+	return net_ring_receive(fd, &rx->ring, rx);
+}
+
+int net_receive(int fd)
+{
+	return net_rx_receive(fd, &client_rx);
+}
+
+/* handle a configuration message which the collector passed on */
+void net_receive_message(unsigned char* buf, size_t len)
+{
+	try_receive_packet(-1, &client_rx, buf, len);
+}
+
+bool net_rx_init(struct net_rx* rx)
+{
+	rx->compact = NULL;
+	rx->decomp = NULL;
+	rx->block = NULL;
+	rx->in_block = false;
+	rx->sample = 1;
+	return byte_ring_init(&rx->ring, NET_RECV_BUFFER_SIZE);
+}
+
+void net_rx_free(struct net_rx* rx)
+{
+	net_compact_free(rx->compact);
+	rx->compact = NULL;
+	net_decompressor_free(rx->decomp);
+	rx->decomp = NULL;
+	free(rx->block);
+	rx->block = NULL;
+	byte_ring_free(&rx->ring);
+}
+
+static void net_client_receive(int fd)
+{
+	struct net_client* c = net_find_client(fd);
+	char dummy;
+	ssize_t ret;
+
+	if (c == NULL || net_ring_receive(fd, &c->rx, NULL) >= 0)
+		return;
+
+	/* net_receive() does not tell us if the connection was closed */
+	ret = recv(fd, &dummy, 1, MSG_DONTWAIT | MSG_PEEK);
+	if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+		net_client_close(c, "closed by peer");
+}
+
+static void net_handle_server_conn(__attribute__((unused)) int fd)
 {
 	struct sockaddr_in cin;
 	socklen_t cinlen;
+	struct net_client* c = NULL;
+	int one = 1, zero = 0;
+	int cfd;
 
 	cinlen = sizeof(cin);
 	memset(&cin, 0, sizeof(struct sockaddr_in));
-	cli_fd = accept(srv_fd, (struct sockaddr*)&cin, &cinlen);
+	cfd = accept(srv_fd, (struct sockaddr*)&cin, &cinlen);
+	if (cfd < 0) {
+		LOG_ERR("accept failed (%s)", strerror(errno));
+		return;
+	}
+
+	for (int i = 0; i < MAX_NET_CLIENTS; i++) {
+		if (clients[i].fd == -1) {
+			c = &clients[i];
+			break;
+		}
+	}
+	if (c == NULL) {
+		LOG_ERR("Too many clients, rejecting %s", inet_ntoa(cin.sin_addr));
+		close(cfd);
+		return;
+	}
+
+	if (!byte_ring_init(&c->tx, NET_CLIENT_QUEUE) ||
+	    !byte_ring_init(&c->rx, 4096) ||
+	    !event_add_fd(cfd, net_client_receive)) {
+		byte_ring_free(&c->tx);
+		byte_ring_free(&c->rx);
+		close(cfd);
+		return;
+	}
 
-	LOG_INF("Accepting client");
+	LOG_INF("Accepting client %d from %s", cfd, inet_ntoa(cin.sin_addr));
+	c->fd = cfd;
+	c->full_since = 0;
+	c->batch_len = 0;
+	c->batch_records = 0;
+	c->sample = c->sample_sent = 1;
+	c->sample_cnt = 0;
+	c->sample_time = 0;
+	c->sample_slen = 0;
+	c->sample_low = 0;
+	net_num_clients++;
+
+	/* we do our own batching, but the initial config should go out in one
+	 * segment */
+	setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(cfd, IPPROTO_TCP, TCP_CORK, &one, sizeof(one));
 
 	/* send initial config */
-	net_send_chan_list(cli_fd);
-	net_send_conf_chan(cli_fd);
-	net_send_conf_filter(cli_fd);
+	net_send_chan_list(cfd);
+	net_send_conf_chan(cfd);
+	net_send_conf_filter(cfd);
+
+	if (c->fd != -1)
+		setsockopt(cfd, IPPROTO_TCP, TCP_CORK, &zero, sizeof(zero));
+}
+
+static void net_init_mcast_socket(int rport)
+{
+	struct in_addr ifaddr = { .s_addr = htonl(INADDR_ANY) };
+	unsigned char ttl = 1;
+
+	memset(&mcast_addr, 0, sizeof(mcast_addr));
+	mcast_addr.sin_family = AF_INET;
+	mcast_addr.sin_port = htons(rport);
+	if (inet_aton(conf.server_mcast, &mcast_addr.sin_addr) == 0)
+		errx(1, "Invalid multicast group %s", conf.server_mcast);
+	if (conf.server_mcast_if[0] != '\0' && inet_aton(conf.server_mcast_if, &ifaddr) == 0)
+		errx(1, "Invalid multicast interface %s", conf.server_mcast_if);
+
+	LOG_INF("Sending packets to multicast group %s port %d", conf.server_mcast, rport);
+
+	if ((mcast_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		err(1, "Could not open multicast socket");
+
+	if (setsockopt(mcast_fd, IPPROTO_IP, IP_MULTICAST_IF, &ifaddr, sizeof(ifaddr)) < 0)
+		err(1, "setsockopt IP_MULTICAST_IF");
 
-	/* we only accept one client, so close server socket */
-	close(srv_fd);
-	srv_fd = -1;
+	/* stay in the local network */
+	setsockopt(mcast_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+
+	mcast_len = sizeof(struct net_mcast_data);
+	mcast_records = 0;
 }
 
 void net_init_server_socket(int rport)
@@ -572,21 +1731,34 @@ void net_init_server_socket(int rport)
 	if (bind(srv_fd, (struct sockaddr*)&sock_in, sizeof(sock_in)) < 0)
 		err(1, "bind");
 
-	if (listen(srv_fd, 0) < 0)
+	if (listen(srv_fd, MAX_NET_CLIENTS) < 0)
 		err(1, "listen");
+
+	event_add_fd(srv_fd, net_handle_server_conn);
+
+	if (flush_timer == -1)
+		flush_timer = event_timer_add(net_flush_timer_handler);
+
+	if (conf.server_mcast[0] != '\0')
+		net_init_mcast_socket(rport);
+
+	if (conf.server_summary > 0 && summary_timer == -1) {
+		summary_timer = event_timer_add(net_summary_timer_handler);
+		event_timer_set(summary_timer, conf.server_summary * 1000, true);
+	}
 }
 
-int net_open_client_socket(char* serveraddr, int rport)
+/* connect to a server, a timeout in seconds (or 0) limits how long it may take */
+int net_connect(const char* serveraddr, int rport, int timeout)
 {
 	struct addrinfo saddr;
 	struct addrinfo *result, *rp;
+	struct timeval tv = { .tv_sec = timeout };
 	char rport_str[20];
-	int ret;
+	int ret, fd = -1;
 
 	snprintf(rport_str, 20, "%d", rport);
 
-	LOG_INF("Connecting to server %s port %s", serveraddr, rport_str);
-
 	/* Obtain address(es) matching host/port */
 	memset(&saddr, 0, sizeof(struct addrinfo));
 	saddr.ai_family = AF_INET;
@@ -594,34 +1766,65 @@ int net_open_client_socket(char* serveraddr, int rport)
 	saddr.ai_flags = 0;
 	saddr.ai_protocol = 0;
 
+	/* no logging, this is also used in the collector threads */
 	ret = getaddrinfo(serveraddr, rport_str, &saddr, &result);
-	if (ret != 0) {
-		fprintf(stderr, "Could not resolve: %s\n", gai_strerror(ret));
-		exit(EXIT_FAILURE);
-	}
+	if (ret != 0)
+		return -1;
 
 	/* getaddrinfo() returns a list of address structures.
 	 * Try each address until we successfully connect. */
 	for (rp = result; rp != NULL; rp = rp->ai_next) {
-		netmon_fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-		if (netmon_fd == -1)
+		fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+		if (fd == -1)
 			continue;
 
-		if (connect(netmon_fd, rp->ai_addr, rp->ai_addrlen) != -1)
+		/* connect() uses the send timeout */
+		if (timeout > 0)
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		if (connect(fd, rp->ai_addr, rp->ai_addrlen) != -1)
 			break; /* Success */
 
-		close(netmon_fd);
+		close(fd);
+		fd = -1;
 	}
 
-	if (rp == NULL) {
-		/* No address succeeded */
-		freeaddrinfo(result);
-		err(1, "Could not connect");
+	freeaddrinfo(result);
+
+	if (fd != -1 && timeout > 0) {
+		tv.tv_sec = 0;
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
 	}
+	return fd;
+}
 
-	freeaddrinfo(result);
+/* the collector does not use multicast or summaries, it needs all packets.
+ * This runs on a collector thread, so it must not log like net_write() */
+bool net_send_collector_hello(int fd)
+{
+	struct net_hello nh;
+
+	net_fill_hello(&nh, PROTO_VERSION_COMPACT, net_compress_methods() | NET_HELLO_SAMPLED);
+	return write(fd, &nh, sizeof(nh)) == sizeof(nh);
+}
+
+int net_open_client_socket(char* serveraddr, int rport)
+{
+	LOG_INF("Connecting to server %s port %d", serveraddr, rport);
+
+	netmon_fd = net_connect(serveraddr, rport, 0);
+	if (netmon_fd == -1)
+		errx(1, "Could not connect to %s", serveraddr);
 
 	LOG_INF("Connected to server %s", serveraddr);
+
+	if (!net_rx_init(&client_rx))
+		exit(EXIT_FAILURE);
+
+	/* ask for multicast, summaries or the compact protocol, and compression */
+	net_send_hello(netmon_fd, PROTO_VERSION_COMPACT, net_compress_methods() | NET_HELLO_SAMPLED |
+		       (conf.client_summary ? NET_HELLO_SUMMARY : 0) |
+		       (conf.client_mcast ? NET_HELLO_MCAST : 0));
 	return netmon_fd;
 }
 
@@ -630,25 +1833,57 @@ void net_finish(void)
 	if (srv_fd != -1)
 		close(srv_fd);
 
-	if (cli_fd != -1)
-		close(cli_fd);
+	for (int i = 0; i < MAX_NET_CLIENTS; i++)
+		if (clients[i].fd != -1)
+			net_client_close(&clients[i], "exit");
 
 	if (netmon_fd)
 		close(netmon_fd);
+
+	if (mcast_fd != -1) {
+		net_mcast_flush();
+		close(mcast_fd);
+		mcast_fd = -1;
+	}
+	if (mcast_rx_fd != -1) {
+		event_del_fd(mcast_rx_fd);
+		close(mcast_rx_fd);
+		mcast_rx_fd = -1;
+	}
+
+	net_rx_free(&client_rx);
 }
 
 void net_send_channel_config(void)
 {
-	if (conf.serveraddr[0] != '\0')
+	if (collector_active()) {
+		collector_send(net_send_conf_chan);
+		return;
+	}
+
+	if (conf.serveraddr[0] != '\0') {
 		net_send_conf_chan(netmon_fd);
-	else if (conf.allow_client && cli_fd > -1)
-		net_send_conf_chan(cli_fd);
+		return;
+	}
+
+	for (int i = 0; i < MAX_NET_CLIENTS; i++)
+		if (clients[i].fd != -1)
+			net_send_conf_chan(clients[i].fd);
 }
 
 void net_send_filter_config(void)
 {
-	if (conf.serveraddr[0] != '\0')
+	if (collector_active()) {
+		collector_send(net_send_conf_filter);
+		return;
+	}
+
+	if (conf.serveraddr[0] != '\0') {
 		net_send_conf_filter(netmon_fd);
-	else if (conf.allow_client && cli_fd > -1)
-		net_send_conf_filter(cli_fd);
+		return;
+	}
+
+	for (int i = 0; i < MAX_NET_CLIENTS; i++)
+		if (clients[i].fd != -1)
+			net_send_conf_filter(clients[i].fd);
 }
@@ -20,20 +20,51 @@
 #ifndef _PROTOCOL_NETWORK_H_
 #define _PROTOCOL_NETWORK_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 
+#include "byte_ring.h"
+
+/* maximum size of a batch of packet infos (server_batch) */
+#define NET_MAX_BATCH		(32 * 1024)
+
 struct uwifi_packet;
+struct net_compact;
+struct net_decompressor;
+
+/* receive state of a connection to a server. Normally all messages are
+ * handled directly, but the collector threads get packets and configuration
+ * messages thru the callbacks */
+struct net_rx {
+	struct byte_ring	ring;
+	struct net_compact*	compact;
+	struct net_decompressor* decomp;
+	unsigned char*		block;		/* decompressed block */
+	bool			in_block;
+	unsigned int		sample;		/* sampling ratio of the server */
+	void			(*packet_cb)(struct uwifi_packet* p, void* ctx);
+	void			(*message_cb)(unsigned char* buf, size_t len, void* ctx);
+	void*			ctx;
+	unsigned long		errors;		/* only counted for packet_cb, not reset by net_rx_init() */
+};
 
 extern int srv_fd;
-extern int cli_fd;
+extern int mcast_fd;
+extern int net_num_clients;
+extern unsigned int net_sample;
 
 void net_init_server_socket(int rport);
-void net_handle_server_conn(void);
 void net_send_packet(struct uwifi_packet *pkt);
 void net_send_channel_config(void);
 void net_send_filter_config(void);
-int net_receive(int fd, unsigned char* buffer, size_t* buflen, size_t maxlen);
+int net_receive(int fd);
+void net_receive_message(unsigned char* buf, size_t len);
 int net_open_client_socket(char* server, int rport);
+int net_connect(const char* server, int rport, int timeout);
+bool net_send_collector_hello(int fd);
+bool net_rx_init(struct net_rx* rx);
+void net_rx_free(struct net_rx* rx);
+int net_rx_receive(int fd, struct net_rx* rx);
 void net_finish(void);
 
 #endif
@@ -0,0 +1,306 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/*
+ * The node list, with a limit on its size.
+ *
+ * Phones probing with a new random MAC address every few seconds can fill
+ * the node list with thousands of nodes which are only ever seen once, and
+ * everything which walks the list becomes slow. So probe requests from
+ * locally administered MAC addresses are counted for one "bucket" node
+ * instead of creating a node for each address. When such a device connects
+ * it is shown as usual, with the random address it chose for the network.
+ *
+ * In addition the number of nodes is limited to node_max. When there are
+ * more the least recently seen nodes are removed, a sixteenth of node_max at
+ * once, so the list is walked only every so often.
+ *
+ * Nodes are timed out by libuwifi, which only walks the list once every
+ * node_timeout, but it does not know about our channel nodes, which have to
+ * be freed before. They are kept in a timing wheel by the last_seen time of
+ * their node, so every second only the channel nodes of the nodes which
+ * time out are touched, not all of them.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <uwifi/node.h>
+#include <uwifi/util.h>
+#include <uwifi/log.h>
+
+#include "main.h"
+#include "nodes.h"
+
+/* a group address can never be a transmitter, so this is never a real node */
+const unsigned char nodes_random_bucket[WLAN_MAC_LEN] = { 0x03, 0, 0, 0, 0, 0 };
+
+/* up to node_max nodes, may be a little less than the real number between
+ * the recounts in nodes_timeout() */
+static unsigned int num_nodes;
+
+/* distinct random MACs per node_timeout, estimated by "linear counting" of
+ * the bits set in a bitmap of hashes */
+#define RANDOM_MAC_BITS_LOG	15
+#define RANDOM_MAC_BITS		(1 << RANDOM_MAC_BITS_LOG)
+static unsigned char random_macs[RANDOM_MAC_BITS / 8];
+static unsigned int random_macs_set;
+static unsigned int random_macs_last;
+static time_t random_macs_time;
+
+/* nodes are grouped by age in seconds when looking for the oldest */
+#define EVICT_AGES		256
+
+/* one slot per second, channel nodes of older nodes share the slots of newer
+ * ones and are skipped until they are due */
+#define EXPIRE_SLOTS		256
+static struct cc_list_head expire_wheel[EXPIRE_SLOTS];
+/* channel nodes which were due already when they were added */
+static struct cc_list_head expire_late;
+/* the slots of all seconds up to this were processed */
+static time_t expire_done;
+
+bool nodes_random_probe(const struct uwifi_packet* p)
+{
+	return conf.node_random_bucket &&
+		p->wlan_type == WLAN_FRAME_PROBE_REQ &&
+		(p->wlan_ta[0] & 0x03) == 0x02;	/* locally administered, unicast */
+}
+
+bool nodes_is_random_bucket(const unsigned char* mac)
+{
+	return memcmp(mac, nodes_random_bucket, WLAN_MAC_LEN) == 0;
+}
+
+static void random_mac_count(const unsigned char* mac)
+{
+	uint32_t h = mac[0] | (mac[1] << 8) | (mac[2] << 16) | ((uint32_t)mac[3] << 24);
+	unsigned int bit;
+
+	h = (h ^ (mac[4] | (mac[5] << 8))) * 2654435761u;
+	bit = h >> (32 - RANDOM_MAC_BITS_LOG);
+	if (!(random_macs[bit / 8] & (1 << (bit % 8)))) {
+		random_macs[bit / 8] |= 1 << (bit % 8);
+		random_macs_set++;
+	}
+}
+
+static unsigned int random_macs_estimate(unsigned int set)
+{
+	if (set >= RANDOM_MAC_BITS)
+		set = RANDOM_MAC_BITS - 1;	/* saturated */
+	return RANDOM_MAC_BITS * log((double)RANDOM_MAC_BITS / (RANDOM_MAC_BITS - set)) + 0.5;
+}
+
+/* estimate of the random MACs seen in the last node_timeout seconds */
+unsigned int nodes_random_macs(void)
+{
+	return MAX(random_macs_estimate(random_macs_set), random_macs_last);
+}
+
+static void chan_node_link(struct chan_node* cn)
+{
+	cn->seen = cn->node->last_seen;
+	if (cn->seen <= expire_done)
+		cc_list_add_tail(&expire_late, &cn->expire_list);
+	else
+		cc_list_add_tail(&expire_wheel[cn->seen % EXPIRE_SLOTS], &cn->expire_list);
+}
+
+static void chan_node_release(struct chan_node* cn)
+{
+	cc_list_del(&cn->chan_list);
+	cc_list_del(&cn->node_list);
+	cc_list_del(&cn->expire_list);
+	cn->chan->num_nodes--;
+	cn->node->num_on_channels--;
+	pool_free(&chan_node_pool, cn);
+}
+
+/* a new channel node of the node */
+void nodes_chan_node_add(struct chan_node* cn)
+{
+	chan_node_link(cn);
+}
+
+/* the last_seen time of the node changed, move its channel nodes */
+void nodes_seen(struct uwifi_node* n)
+{
+	struct chan_node* cn;
+
+	cc_list_for_each(&n->on_channels, cn, node_list) {
+		if (cn->seen != n->last_seen) {
+			cc_list_del(&cn->expire_list);
+			chan_node_link(cn);
+		}
+	}
+}
+
+/* free the channel nodes of all nodes not seen since 'since' */
+static void chan_nodes_expire(time_t since)
+{
+	struct chan_node *cn, *cn2;
+	time_t t = expire_done + 1;
+
+	/* a whole round at most, after a long time without a check */
+	if (since - t > EXPIRE_SLOTS)
+		t = since - EXPIRE_SLOTS;
+
+	for (; t < since; t++) {
+		cc_list_for_each_safe(&expire_wheel[t % EXPIRE_SLOTS], cn, cn2, expire_list) {
+			if (cn->seen < since)
+				chan_node_release(cn);
+		}
+	}
+	expire_done = MAX(expire_done, since - 1);
+
+	cc_list_for_each_safe(&expire_late, cn, cn2, expire_list) {
+		if (cn->seen < since)
+			chan_node_release(cn);
+	}
+}
+
+struct uwifi_node* nodes_update(struct uwifi_packet* p)
+{
+	unsigned char ta[WLAN_MAC_LEN];
+	struct uwifi_node* n;
+
+	if (nodes_random_probe(p)) {
+		stats.node_random_probes++;
+		random_mac_count(p->wlan_ta);
+		/* account the packet to the bucket, but leave it unchanged */
+		memcpy(ta, p->wlan_ta, WLAN_MAC_LEN);
+		memcpy(p->wlan_ta, nodes_random_bucket, WLAN_MAC_LEN);
+		n = uwifi_node_update(p, &conf.intf.wlan_nodes);
+		memcpy(p->wlan_ta, ta, WLAN_MAC_LEN);
+	} else
+		n = uwifi_node_update(p, &conf.intf.wlan_nodes);
+
+	if (n == NULL)
+		return NULL;
+
+	/* libuwifi counts the first packet when creating the node */
+	if (n->pkt_count == 1)
+		num_nodes++;
+	nodes_seen(n);
+
+	uwifi_nodes_find_ap(n, &conf.intf.wlan_nodes);
+	return n;
+}
+
+/* free the channel nodes of the nodes which time out and let libuwifi free
+ * the nodes, when it walks the node list we count them again */
+static void nodes_expire(time_t* last_timeout)
+{
+	struct uwifi_node* n;
+	time_t last = *last_timeout;
+
+	chan_nodes_expire(time_mono.tv_sec - (time_t)conf.node_timeout);
+
+	uwifi_nodes_timeout(&conf.intf.wlan_nodes, conf.node_timeout, last_timeout);
+
+	if (*last_timeout != last) {
+		num_nodes = 0;
+		cc_list_for_each(&conf.intf.wlan_nodes, n, list)
+			num_nodes++;
+	}
+}
+
+void nodes_timeout(void)
+{
+	nodes_expire(&conf.intf.last_nodetimeout);
+
+	if (time_mono.tv_sec - random_macs_time >= (time_t)conf.node_timeout) {
+		random_macs_last = random_macs_estimate(random_macs_set);
+		random_macs_set = 0;
+		random_macs_time = time_mono.tv_sec;
+		memset(random_macs, 0, sizeof(random_macs));
+	}
+}
+
+/*
+ * Remove the least recently seen nodes, when there are more than node_max.
+ * Called after the packet is handled, as the node of the packet may be
+ * removed too.
+ */
+void nodes_limit(void)
+{
+	unsigned int ages[EVICT_AGES] = { 0 };
+	unsigned int need, cnt = 0;
+	struct uwifi_node* n;
+	struct chan_node *cn, *cn2;
+	time_t age, last = 0;
+	int a;
+
+	if (conf.node_max == 0 || num_nodes <= conf.node_max)
+		return;
+
+	need = num_nodes - conf.node_max + conf.node_max / 16;
+
+	cc_list_for_each(&conf.intf.wlan_nodes, n, list) {
+		age = time_mono.tv_sec - n->last_seen;
+		ages[MAX(0, MIN(age, EVICT_AGES - 1))]++;
+	}
+
+	/* all nodes older than 'a' go, and 'need - cnt' of age 'a' */
+	for (a = EVICT_AGES - 1; a > 0 && cnt + ages[a] < need; a--)
+		cnt += ages[a];
+
+	/* mark them as not seen for very long */
+	cc_list_for_each(&conf.intf.wlan_nodes, n, list) {
+		age = MAX(0, MIN(time_mono.tv_sec - n->last_seen, EVICT_AGES - 1));
+		if (age > a || (age == a && cnt < need)) {
+			if (age == a)
+				cnt++;
+			cc_list_for_each_safe(&n->on_channels, cn, cn2, node_list)
+				chan_node_release(cn);
+			n->last_seen = 0;
+			stats.node_evictions++;
+		}
+	}
+
+	/* run libuwifi's timeout now, but leave the timer of the usual one */
+	nodes_expire(&last);
+	LOG_DBG("NODES evicted, %u left", num_nodes);
+}
+
+void nodes_init(void)
+{
+	for (int i = 0; i < EXPIRE_SLOTS; i++)
+		cc_list_head_init(&expire_wheel[i]);
+	cc_list_head_init(&expire_late);
+	expire_done = 0;
+}
+
+/* the channel nodes are freed by free_lists() */
+void nodes_free(void)
+{
+	nodes_init();
+	uwifi_nodes_free(&conf.intf.wlan_nodes);
+	num_nodes = 0;
+	random_macs_set = random_macs_last = 0;
+	memset(random_macs, 0, sizeof(random_macs));
+}
+
+unsigned int nodes_count(void)
+{
+	return num_nodes;
+}
@@ -0,0 +1,44 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef _NODES_H_
+#define _NODES_H_
+
+#include <stdbool.h>
+
+struct uwifi_packet;
+struct uwifi_node;
+struct chan_node;
+
+extern const unsigned char nodes_random_bucket[];
+
+bool nodes_random_probe(const struct uwifi_packet* p);
+bool nodes_is_random_bucket(const unsigned char* mac);
+struct uwifi_node* nodes_update(struct uwifi_packet* p);
+void nodes_seen(struct uwifi_node* n);
+void nodes_chan_node_add(struct chan_node* cn);
+void nodes_limit(void);
+void nodes_timeout(void);
+void nodes_init(void);
+void nodes_free(void);
+unsigned int nodes_count(void);
+unsigned int nodes_random_macs(void);
+
+#endif
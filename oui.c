@@ -0,0 +1,291 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/*
+ * Vendor names for the OUI (the first three bytes) of MAC addresses.
+ *
+ * The IEEE registry (oui.txt) is converted once to a binary table with
+ * "horst -O oui.txt > oui.bin". The table is mapped into memory and used
+ * as it is, so nothing has to be parsed at startup and only the few pages
+ * touched by lookups are read into memory.
+ *
+ * The table is a header, the entries sorted by OUI, which are searched
+ * with a binary search, and the vendor names, each only once and
+ * terminated by a zero byte. All numbers are little endian.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <uwifi/log.h>
+
+#include "oui.h"
+
+#define OUI_MAGIC		"HOUI"
+#define OUI_VERSION		1
+
+struct oui_header {
+	char		magic[4];
+	uint32_t	version;
+	uint32_t	count;
+	uint32_t	names_len;
+};
+
+struct oui_entry {
+	uint32_t	oui;
+	uint32_t	name;	/* offset in the names */
+};
+
+static void* map;
+static size_t map_len;
+static const struct oui_entry* entries;
+static uint32_t num_entries;
+static const char* names;
+static uint32_t names_len;
+
+bool oui_open(const char* filename)
+{
+	const struct oui_header* h;
+	struct stat st;
+	int fd;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		LOG_ERR("Could not open OUI file '%s' (%s)", filename, strerror(errno));
+		return false;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*h)) {
+		LOG_ERR("OUI file '%s' is too short", filename);
+		close(fd);
+		return false;
+	}
+
+	map_len = st.st_size;
+	map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		LOG_ERR("Could not map OUI file '%s' (%s)", filename, strerror(errno));
+		map = NULL;
+		return false;
+	}
+	/* lookups touch a few pages all over the file, don't read ahead */
+	madvise(map, map_len, MADV_RANDOM);
+
+	h = map;
+	num_entries = le32toh(h->count);
+	if (memcmp(h->magic, OUI_MAGIC, 4) != 0 || le32toh(h->version) != OUI_VERSION ||
+	    (map_len - sizeof(*h)) / sizeof(struct oui_entry) < num_entries ||
+	    map_len - sizeof(*h) - num_entries * sizeof(struct oui_entry) != le32toh(h->names_len) ||
+	    (h->names_len > 0 && ((const char*)map)[map_len - 1] != '\0')) {
+		LOG_ERR("OUI file '%s' is not valid, build it with 'horst -O oui.txt'", filename);
+		oui_close();
+		return false;
+	}
+
+	entries = (const struct oui_entry*)(h + 1);
+	names = (const char*)(entries + num_entries);
+	names_len = le32toh(h->names_len);
+	LOG_INF("Using %u OUIs from '%s'", num_entries, filename);
+	return true;
+}
+
+void oui_close(void)
+{
+	if (map != NULL)
+		munmap(map, map_len);
+	map = NULL;
+	entries = NULL;
+	num_entries = 0;
+}
+
+const char* oui_vendor(const unsigned char* mac)
+{
+	uint32_t oui, lo = 0, hi = num_entries, mid, e;
+
+	/* locally administered addresses have no vendor */
+	if (entries == NULL || (mac[0] & 0x02))
+		return NULL;
+
+	oui = (mac[0] << 16) | (mac[1] << 8) | mac[2];
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		e = le32toh(entries[mid].oui);
+		if (e == oui)
+			return le32toh(entries[mid].name) < names_len ?
+				names + le32toh(entries[mid].name) : NULL;
+		else if (e < oui)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+/*** building the table from the IEEE registry ***/
+
+struct oui_rec {
+	uint32_t	oui;
+	uint32_t	name_off;
+	char*		name;
+};
+
+static int oui_rec_cmp_name(const void* a, const void* b)
+{
+	return strcmp(((const struct oui_rec*)a)->name, ((const struct oui_rec*)b)->name);
+}
+
+static int oui_rec_cmp_oui(const void* a, const void* b)
+{
+	uint32_t x = ((const struct oui_rec*)a)->oui;
+	uint32_t y = ((const struct oui_rec*)b)->oui;
+
+	return x < y ? -1 : x > y;
+}
+
+/* parse a line like "0050C2     (base 16)		IEEE REGISTRATION AUTHORITY" */
+static bool oui_parse_line(char* line, uint32_t* oui, char** name)
+{
+	char* end;
+	int pos = 0;
+
+	if (sscanf(line, "%6x (base 16)%n", oui, &pos) != 1 || pos == 0)
+		return false;
+
+	line += pos;
+	while (isspace((unsigned char)*line))
+		line++;
+	end = line + strlen(line);
+	while (end > line && isspace((unsigned char)end[-1]))
+		*--end = '\0';
+	if (*line == '\0')
+		return false;
+	*name = line;
+	return true;
+}
+
+/* convert the registry to the binary table on stdout, returns the exit code */
+int oui_build(const char* registry)
+{
+	struct oui_header h;
+	struct oui_entry e;
+	struct oui_rec* recs = NULL;
+	struct oui_rec* r;
+	unsigned int num = 0, alloc = 0, i, n;
+	uint32_t names_len = 0, oui;
+	char line[512];
+	char* name;
+	FILE* fp;
+
+	if (isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Redirect the output to a file: horst -O %s > oui.bin\n", registry);
+		return 1;
+	}
+
+	fp = fopen(registry, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Could not open '%s' (%s)\n", registry, strerror(errno));
+		return 1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (!oui_parse_line(line, &oui, &name))
+			continue;
+		if (num == alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+			r = realloc(recs, alloc * sizeof(*recs));
+			if (r == NULL)
+				goto nomem;
+			recs = r;
+		}
+		recs[num].oui = oui;
+		recs[num].name = strdup(name);
+		if (recs[num].name == NULL)
+			goto nomem;
+		num++;
+	}
+	fclose(fp);
+	fp = NULL;
+
+	/* store each name only once, many vendors have more than one OUI */
+	qsort(recs, num, sizeof(*recs), oui_rec_cmp_name);
+	for (i = 0; i < num; i++) {
+		if (i > 0 && strcmp(recs[i].name, recs[i - 1].name) == 0)
+			recs[i].name_off = recs[i - 1].name_off;
+		else {
+			recs[i].name_off = names_len;
+			names_len += strlen(recs[i].name) + 1;
+		}
+	}
+
+	/* sort by OUI, duplicates are left out */
+	qsort(recs, num, sizeof(*recs), oui_rec_cmp_oui);
+	for (i = 0, n = 0; i < num; i++)
+		if (i == 0 || recs[i].oui != recs[i - 1].oui)
+			n++;
+
+	memcpy(h.magic, OUI_MAGIC, 4);
+	h.version = htole32(OUI_VERSION);
+	h.count = htole32(n);
+	h.names_len = htole32(names_len);
+	fwrite(&h, sizeof(h), 1, stdout);
+
+	for (i = 0; i < num; i++) {
+		if (i > 0 && recs[i].oui == recs[i - 1].oui)
+			continue;
+		e.oui = htole32(recs[i].oui);
+		e.name = htole32(recs[i].name_off);
+		fwrite(&e, sizeof(e), 1, stdout);
+	}
+
+	/* names in the order of their offsets */
+	qsort(recs, num, sizeof(*recs), oui_rec_cmp_name);
+	for (i = 0; i < num; i++)
+		if (i == 0 || strcmp(recs[i].name, recs[i - 1].name) != 0)
+			fwrite(recs[i].name, strlen(recs[i].name) + 1, 1, stdout);
+
+	for (i = 0; i < num; i++)
+		free(recs[i].name);
+	free(recs);
+
+	if (fflush(stdout) != 0) {
+		fprintf(stderr, "Could not write OUI table (%s)\n", strerror(errno));
+		return 1;
+	}
+	fprintf(stderr, "%u OUIs, %u bytes of names\n", n, names_len);
+	return 0;
+
+nomem:
+	fprintf(stderr, "Out of memory\n");
+	if (fp != NULL)
+		fclose(fp);
+	for (i = 0; i < num; i++)
+		free(recs[i].name);
+	free(recs);
+	return 1;
+}
@@ -0,0 +1,220 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Binary outfile in pcap format with radiotap link type.
+ *
+ * Records are collected in a large buffer which is written when it is full
+ * and once per second (pcapfile_flush() is called from the main loop), so
+ * there is only one write() for many packets. A write which takes longer
+ * than PCAPFILE_STALL_USEC or fails is counted as stall.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include <uwifi/log.h>
+
+#include "main.h"
+#include "pcapfile.h"
+
+#define PCAPFILE_BUF_SIZE	(1024 * 1024)
+#define PCAPFILE_STALL_USEC	10000
+#define PCAP_MAGIC		0xa1b2c3d4
+#define LINKTYPE_IEEE802_11_RADIOTAP	127
+
+struct pcap_file_header {
+	uint32_t	magic;
+	uint16_t	version_major;
+	uint16_t	version_minor;
+	int32_t		thiszone;
+	uint32_t	sigfigs;
+	uint32_t	snaplen;
+	uint32_t	linktype;
+};
+
+struct pcap_rec_header {
+	uint32_t	ts_sec;
+	uint32_t	ts_usec;
+	uint32_t	incl_len;
+	uint32_t	orig_len;
+};
+
+static int pcap_fd = -1;
+static unsigned char pcap_buf[PCAPFILE_BUF_SIZE];
+static size_t pcap_buflen;
+
+static char pcap_name[MAX_CONF_VALUE_STRLEN + 1];
+static unsigned int pcap_file_idx;
+static unsigned long pcap_file_bytes;
+static time_t pcap_file_start;
+static bool pcap_file_started;
+
+static void pcapfile_write_buf(const unsigned char* buf, size_t len)
+{
+	struct timespec t1, t2;
+	ssize_t ret;
+	long usec;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	while (len > 0) {
+		ret = write(pcap_fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			LOG_ERR("Could not write outfile (%s)", strerror(errno));
+			stats.outfile_stalls++;
+			return;
+		}
+		buf += ret;
+		len -= ret;
+		stats.outfile_bytes += ret;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	usec = (t2.tv_sec - t1.tv_sec) * 1000000 + (t2.tv_nsec - t1.tv_nsec) / 1000;
+	if (usec > PCAPFILE_STALL_USEC)
+		stats.outfile_stalls++;
+}
+
+void pcapfile_flush(void)
+{
+	if (pcap_fd < 0 || pcap_buflen == 0)
+		return;
+
+	pcapfile_write_buf(pcap_buf, pcap_buflen);
+	pcap_buflen = 0;
+}
+
+static bool pcapfile_open_idx(void)
+{
+	char name[MAX_CONF_VALUE_STRLEN + 12];
+	struct pcap_file_header fh;
+
+	/* first file has the configured name, rotated ones get a number */
+	if (pcap_file_idx == 0)
+		snprintf(name, sizeof(name), "%s", pcap_name);
+	else
+		snprintf(name, sizeof(name), "%s.%u", pcap_name, pcap_file_idx);
+
+	pcap_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (pcap_fd < 0) {
+		LOG_ERR("Couldn't open pcap outfile '%s' (%s)", name, strerror(errno));
+		return false;
+	}
+
+	fh.magic = PCAP_MAGIC;
+	fh.version_major = 2;
+	fh.version_minor = 4;
+	fh.thiszone = 0;
+	fh.sigfigs = 0;
+	fh.snaplen = conf.outfile_snaplen ? conf.outfile_snaplen : 65535;
+	fh.linktype = LINKTYPE_IEEE802_11_RADIOTAP;
+
+	memcpy(pcap_buf, &fh, sizeof(fh));
+	pcap_buflen = sizeof(fh);
+	pcap_file_bytes = sizeof(fh);
+	/* the first file is opened while parsing the config, before the clocks
+	 * are initialized, so the rotation time starts with the first record */
+	pcap_file_started = false;
+
+	LOG_INF("- Writing pcap to outfile %s", name);
+	return true;
+}
+
+static void pcapfile_rotate(void)
+{
+	pcapfile_flush();
+	close(pcap_fd);
+	pcap_fd = -1;
+
+	pcap_file_idx++;
+	pcapfile_open_idx();
+	pcap_file_start = time_mono.tv_sec;
+	pcap_file_started = true;
+}
+
+bool pcapfile_open(const char* name)
+{
+	pcapfile_close();
+
+	strncpy(pcap_name, name, MAX_CONF_VALUE_STRLEN);
+	pcap_name[MAX_CONF_VALUE_STRLEN] = '\0';
+	pcap_file_idx = 0;
+
+	return pcapfile_open_idx();
+}
+
+void pcapfile_write(const unsigned char* buf, size_t len, const struct timespec* ts)
+{
+	struct pcap_rec_header rh;
+	size_t caplen = len;
+
+	if (pcap_fd < 0 || buf == NULL)
+		return;
+
+	if (conf.outfile_snaplen && caplen > conf.outfile_snaplen)
+		caplen = conf.outfile_snaplen;
+
+	if (!pcap_file_started) {
+		pcap_file_start = time_mono.tv_sec;
+		pcap_file_started = true;
+	}
+
+	if ((conf.outfile_rotate_size &&
+	     pcap_file_bytes + sizeof(rh) + caplen > conf.outfile_rotate_size * 1024UL * 1024UL) ||
+	    (conf.outfile_rotate_time &&
+	     time_mono.tv_sec - pcap_file_start >= (time_t)conf.outfile_rotate_time)) {
+		pcapfile_rotate();
+		if (pcap_fd < 0)
+			return;
+	}
+
+	if (pcap_buflen + sizeof(rh) + caplen > sizeof(pcap_buf))
+		pcapfile_flush();
+
+	if (ts == NULL)
+		ts = &time_real;
+
+	rh.ts_sec = ts->tv_sec;
+	rh.ts_usec = ts->tv_nsec / 1000;
+	rh.incl_len = caplen;
+	rh.orig_len = len;
+
+	memcpy(pcap_buf + pcap_buflen, &rh, sizeof(rh));
+	memcpy(pcap_buf + pcap_buflen + sizeof(rh), buf, caplen);
+	pcap_buflen += sizeof(rh) + caplen;
+	pcap_file_bytes += sizeof(rh) + caplen;
+}
+
+void pcapfile_close(void)
+{
+	if (pcap_fd < 0)
+		return;
+
+	pcapfile_flush();
+	close(pcap_fd);
+	pcap_fd = -1;
+}
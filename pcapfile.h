@@ -0,0 +1,32 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _PCAPFILE_H_
+#define _PCAPFILE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+bool pcapfile_open(const char* name);
+void pcapfile_write(const unsigned char* buf, size_t len, const struct timespec* ts);
+void pcapfile_flush(void);
+void pcapfile_close(void);
+
+#endif
@@ -0,0 +1,121 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include <stdlib.h>
+
+#include "pool.h"
+
+/* the strictest alignment of the members of the records we keep */
+union pool_align {
+	void*		p;
+	long		l;
+	double		d;
+};
+
+struct pool_chunk {
+	struct pool_chunk*	next;
+	union pool_align	data[];
+};
+
+void pool_init(struct pool* p, const char* name, size_t elem_size, unsigned int chunk_elems)
+{
+	p->name = name;
+	/* a free element holds the free list pointer */
+	if (elem_size < sizeof(void*))
+		elem_size = sizeof(void*);
+	p->elem_size = (elem_size + sizeof(union pool_align) - 1) & ~(sizeof(union pool_align) - 1);
+	p->chunk_elems = chunk_elems > 0 ? chunk_elems : 1;
+	p->chunks = NULL;
+	p->cur = NULL;
+	p->cur_used = 0;
+	p->free_list = NULL;
+	p->used = 0;
+	p->num_chunks = 0;
+}
+
+void* pool_alloc(struct pool* p)
+{
+	struct pool_chunk* c;
+	void* e;
+
+	if (p->free_list != NULL) {
+		e = p->free_list;
+		p->free_list = *(void**)e;
+		p->used++;
+		return e;
+	}
+
+	/* current chunk is full: use the next one left from before a reset,
+	 * or a new one */
+	if (p->cur == NULL || p->cur_used == p->chunk_elems) {
+		if (p->cur != NULL && p->cur->next != NULL)
+			c = p->cur->next;
+		else if (p->cur == NULL && p->chunks != NULL)
+			c = p->chunks;
+		else {
+			c = malloc(sizeof(*c) + p->elem_size * p->chunk_elems);
+			if (c == NULL)
+				return NULL;
+			/* append, so the order is kept for reuse after a reset */
+			c->next = NULL;
+			if (p->cur != NULL)
+				p->cur->next = c;
+			else
+				p->chunks = c;
+			p->num_chunks++;
+		}
+		p->cur = c;
+		p->cur_used = 0;
+	}
+
+	e = (unsigned char*)p->cur->data + p->elem_size * p->cur_used++;
+	p->used++;
+	return e;
+}
+
+void pool_free(struct pool* p, void* e)
+{
+	if (e == NULL)
+		return;
+	*(void**)e = p->free_list;
+	p->free_list = e;
+	p->used--;
+}
+
+void pool_reset(struct pool* p)
+{
+	p->cur = NULL;
+	p->cur_used = 0;
+	p->free_list = NULL;
+	p->used = 0;
+}
+
+void pool_destroy(struct pool* p)
+{
+	struct pool_chunk *c, *next;
+
+	for (c = p->chunks; c != NULL; c = next) {
+		next = c->next;
+		free(c);
+	}
+	pool_reset(p);
+	p->chunks = NULL;
+	p->num_chunks = 0;
+}
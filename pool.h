@@ -0,0 +1,59 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stddef.h>
+
+/*
+ * Allocator for many elements of the same size, like the per node records.
+ *
+ * Memory is allocated in chunks of elements and never returned to the
+ * system until pool_destroy(). Freed elements are kept in a free list and
+ * reused first. pool_reset() frees all elements at once in O(1), the chunks
+ * are kept and used again from the beginning.
+ */
+struct pool_chunk;
+
+struct pool {
+	const char*		name;
+	size_t			elem_size;
+	unsigned int		chunk_elems;
+	struct pool_chunk*	chunks;		/* all chunks */
+	struct pool_chunk*	cur;		/* chunk we take new elements from */
+	unsigned int		cur_used;	/* elements taken from cur */
+	void*			free_list;
+	unsigned int		used;		/* elements in use */
+	unsigned int		num_chunks;
+};
+
+void pool_init(struct pool* p, const char* name, size_t elem_size, unsigned int chunk_elems);
+void* pool_alloc(struct pool* p);
+void pool_free(struct pool* p, void* e);
+void pool_reset(struct pool* p);
+void pool_destroy(struct pool* p);
+
+static inline size_t pool_size(const struct pool* p)
+{
+	return (size_t)p->num_chunks * p->chunk_elems;
+}
+
+#endif
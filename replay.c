@@ -0,0 +1,458 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Replay of radiotap capture files (pcap and pcapng).
+ *
+ * The file is mapped into memory and frames are passed from there directly to
+ * the normal packet handling. While replaying, time_mono and time_real follow
+ * the capture timestamps, so node timeouts and rates are calculated as they
+ * were at capture time.
+ *
+ * Speed: 0 is as fast as possible, 1 real time, other values a multiplier.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <byteswap.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <net/if_arp.h>
+
+#include <uwifi/util.h>
+#include <uwifi/log.h>
+
+#include "main.h"
+#include "event.h"
+#include "replay.h"
+#include "nodes.h"
+
+#define LINKTYPE_IEEE802_11_RADIOTAP	127
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+
+#define PCAPNG_SHB		0x0a0d0d0a
+#define PCAPNG_IDB		0x00000001
+#define PCAPNG_SPB		0x00000003
+#define PCAPNG_EPB		0x00000006
+#define PCAPNG_BYTE_ORDER	0x1a2b3c4d
+#define PCAPNG_OPT_TSRESOL	9
+
+#define MAX_REPLAY_IF		8
+
+/* packets handled before we return to the event loop */
+#define REPLAY_BATCH		256
+
+struct replay_if {
+	uint16_t	linktype;
+	uint32_t	snaplen;
+	unsigned char	tsresol;	/* if_tsresol option */
+};
+
+static unsigned char* map = MAP_FAILED;
+static size_t map_len;
+static size_t pos;
+
+static bool pcapng;
+static bool swapped;
+static bool pcap_nsec;
+
+static struct replay_if ifs[MAX_REPLAY_IF];
+static int num_ifs;
+
+static int replay_timer = -1;
+
+/* next frame, kept when it is not due yet */
+static unsigned char* pkt_data;
+static size_t pkt_len;
+static struct timespec pkt_ts;
+static bool pkt_pending;
+
+static struct timespec last_ts;
+static struct timespec first_ts;
+static struct timespec start_mono;
+static bool started;
+static unsigned long replay_packets;
+
+static inline uint16_t rd16(const unsigned char* p)
+{
+	uint16_t v;
+	memcpy(&v, p, sizeof(v));
+	return swapped ? bswap_16(v) : v;
+}
+
+static inline uint32_t rd32(const unsigned char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return swapped ? bswap_32(v) : v;
+}
+
+static long long ts_diff_ns(const struct timespec* a, const struct timespec* b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+/*** pcap ***/
+
+static bool pcap_open(void)
+{
+	uint32_t magic;
+
+	if (map_len < 24)
+		return false;
+
+	memcpy(&magic, map, sizeof(magic));
+	if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC)
+		swapped = false;
+	else if (bswap_32(magic) == PCAP_MAGIC || bswap_32(magic) == PCAP_MAGIC_NSEC)
+		swapped = true;
+	else
+		return false;
+
+	pcap_nsec = rd32(map) == PCAP_MAGIC_NSEC;
+
+	if (rd32(map + 20) != LINKTYPE_IEEE802_11_RADIOTAP) {
+		LOG_ERR("Replay file is not radiotap (link type %u)", rd32(map + 20));
+		return false;
+	}
+
+	pos = 24;
+	return true;
+}
+
+static bool pcap_next(void)
+{
+	uint32_t caplen;
+
+	if (map_len - pos < 16)
+		return false;
+
+	caplen = rd32(map + pos + 8);
+	if (caplen > map_len - pos - 16) {
+		LOG_ERR("Replay file truncated");
+		return false;
+	}
+
+	pkt_ts.tv_sec = rd32(map + pos);
+	pkt_ts.tv_nsec = rd32(map + pos + 4);
+	if (!pcap_nsec)
+		pkt_ts.tv_nsec *= 1000;
+	pkt_data = map + pos + 16;
+	pkt_len = caplen;
+
+	pos += 16 + caplen;
+	return true;
+}
+
+/*** pcapng ***/
+
+static void pcapng_idb(const unsigned char* body, size_t len)
+{
+	struct replay_if* ifc;
+	size_t o = 8;
+
+	if (len < 8 || num_ifs >= MAX_REPLAY_IF) {
+		num_ifs++; /* keep interface ids in sync, frames will be ignored */
+		return;
+	}
+
+	ifc = &ifs[num_ifs++];
+	ifc->linktype = rd16(body);
+	ifc->snaplen = rd32(body + 4);
+	ifc->tsresol = 6;
+
+	/* options */
+	while (len - o >= 4) {
+		uint16_t code = rd16(body + o);
+		uint16_t olen = rd16(body + o + 2);
+		o += 4;
+		if (code == 0 || olen > len - o)
+			break;
+		if (code == PCAPNG_OPT_TSRESOL && olen >= 1)
+			ifc->tsresol = body[o];
+		o += (olen + 3) & ~3;
+	}
+}
+
+static void pcapng_ts(const struct replay_if* ifc, uint64_t ts)
+{
+	unsigned char res = ifc->tsresol & 0x7f;
+	uint64_t units;
+
+	if (ifc->tsresol & 0x80) {
+		/* power of 2 */
+		units = res < 64 ? 1ULL << res : 0;
+		pkt_ts.tv_sec = res < 64 ? ts >> res : 0;
+		pkt_ts.tv_nsec = units ? (long)((double)(ts & (units - 1)) * 1e9 / units) : 0;
+		return;
+	}
+
+	units = 1;
+	for (int i = 0; i < res && i < 19; i++)
+		units *= 10;
+	pkt_ts.tv_sec = ts / units;
+	ts %= units;
+	for (int i = res; i < 9; i++)
+		ts *= 10;
+	for (int i = 9; i < res; i++)
+		ts /= 10;
+	pkt_ts.tv_nsec = ts;
+}
+
+static bool pcapng_open(void)
+{
+	uint32_t bom;
+
+	if (map_len < 28)
+		return false;
+
+	memcpy(&bom, map, sizeof(bom));
+	if (bom != PCAPNG_SHB)
+		return false;
+
+	pcapng = true;
+	pos = 0;
+	return true;
+}
+
+static bool pcapng_next(void)
+{
+	uint32_t type, total, bom, caplen, if_id;
+	const unsigned char* body;
+	size_t blen;
+
+	while (map_len - pos >= 12) {
+		memcpy(&type, map + pos, sizeof(type));
+		if (type == PCAPNG_SHB) {
+			/* a new section can change the byte order */
+			memcpy(&bom, map + pos + 8, sizeof(bom));
+			if (bom == PCAPNG_BYTE_ORDER)
+				swapped = false;
+			else if (bswap_32(bom) == PCAPNG_BYTE_ORDER)
+				swapped = true;
+			else {
+				LOG_ERR("Replay file has bad pcapng byte order");
+				return false;
+			}
+			num_ifs = 0;
+		} else
+			type = rd32(map + pos);
+
+		total = rd32(map + pos + 4);
+		if (total < 12 || total % 4 || total > map_len - pos) {
+			LOG_ERR("Replay file truncated or corrupt");
+			return false;
+		}
+
+		body = map + pos + 8;
+		blen = total - 12;
+		pos += total;
+
+		switch (type) {
+		case PCAPNG_IDB:
+			pcapng_idb(body, blen);
+			break;
+
+		case PCAPNG_EPB:
+			if (blen < 20)
+				break;
+			if_id = rd32(body);
+			caplen = rd32(body + 12);
+			if (if_id >= (uint32_t)num_ifs || if_id >= MAX_REPLAY_IF ||
+			    ifs[if_id].linktype != LINKTYPE_IEEE802_11_RADIOTAP ||
+			    caplen > blen - 20)
+				break;
+			pcapng_ts(&ifs[if_id], (uint64_t)rd32(body + 4) << 32 | rd32(body + 8));
+			pkt_data = (unsigned char*)body + 20;
+			pkt_len = caplen;
+			return true;
+
+		case PCAPNG_SPB:
+			/* no timestamp, use the one of the previous frame */
+			if (blen < 4 || num_ifs == 0 ||
+			    ifs[0].linktype != LINKTYPE_IEEE802_11_RADIOTAP)
+				break;
+			caplen = rd32(body);
+			if (ifs[0].snaplen && caplen > ifs[0].snaplen)
+				caplen = ifs[0].snaplen;
+			if (caplen > blen - 4)
+				caplen = blen - 4;
+			pkt_ts = last_ts;
+			pkt_data = (unsigned char*)body + 4;
+			pkt_len = caplen;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*** replay ***/
+
+static void replay_packet(void)
+{
+	static time_t last_sec;
+	long long off;
+
+	if (!started) {
+		first_ts = pkt_ts;
+		started = true;
+	}
+	last_ts = pkt_ts;
+
+	/* follow the capture clock */
+	off = ts_diff_ns(&pkt_ts, &first_ts);
+	time_real = pkt_ts;
+	time_mono.tv_sec = start_mono.tv_sec + off / 1000000000LL;
+	time_mono.tv_nsec = start_mono.tv_nsec + off % 1000000000LL;
+	if (time_mono.tv_nsec >= 1000000000) {
+		time_mono.tv_sec++;
+		time_mono.tv_nsec -= 1000000000;
+	} else if (time_mono.tv_nsec < 0) {
+		time_mono.tv_sec--;
+		time_mono.tv_nsec += 1000000000;
+	}
+
+	/* the node timer runs on wall clock, so check timeouts here */
+	if (time_mono.tv_sec != last_sec) {
+		last_sec = time_mono.tv_sec;
+		nodes_timeout();
+	}
+
+	replay_packets++;
+	handle_raw_packet(pkt_data, pkt_len, &pkt_ts);
+}
+
+static void replay_done(void)
+{
+	struct timespec now;
+	double secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = ts_diff_ns(&now, &start_mono) / 1e9;
+
+	LOG_INF("Replay finished: %lu packets in %.3f sec (%.0f packets/sec), "
+		"%lu parsed, %u nodes",
+		replay_packets, secs, secs > 0 ? replay_packets / secs : 0,
+		stats.packets, nodes_count());
+
+	event_del_fd(replay_timer);
+	close(replay_timer);
+	replay_timer = -1;
+
+	/* without UI there is nothing left to do */
+	if (conf.quiet || conf.debug)
+		exit(0);
+}
+
+static void replay_timer_handler(int fd)
+{
+	struct timespec now;
+	long long due;
+
+	if (conf.replay_speed > 0)
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (int i = 0; i < REPLAY_BATCH; i++) {
+		if (!pkt_pending) {
+			if (!(pcapng ? pcapng_next() : pcap_next())) {
+				replay_done();
+				return;
+			}
+			pkt_pending = true;
+		}
+
+		if (conf.replay_speed > 0 && started) {
+			due = ts_diff_ns(&pkt_ts, &first_ts) / conf.replay_speed -
+			      ts_diff_ns(&now, &start_mono);
+			if (due > 1000) {
+				event_timer_set(fd, MIN(due / 1000, 1000000), false);
+				return;
+			}
+		}
+
+		replay_packet();
+		pkt_pending = false;
+	}
+
+	/* more frames are ready, continue after other events were handled */
+	event_timer_set(fd, 1, false);
+}
+
+bool replay_init(const char* filename)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		LOG_ERR("Could not open replay file '%s' (%s)", filename, strerror(errno));
+		return false;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		LOG_ERR("Replay file '%s' is empty", filename);
+		close(fd);
+		return false;
+	}
+
+	map_len = st.st_size;
+	/* private writable mapping, the parser gets a non-const buffer */
+	map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		LOG_ERR("Could not mmap replay file (%s)", strerror(errno));
+		return false;
+	}
+	madvise(map, map_len, MADV_SEQUENTIAL);
+
+	if (!pcap_open() && !pcapng_open()) {
+		LOG_ERR("Replay file '%s' is not a radiotap pcap or pcapng file", filename);
+		replay_finish();
+		return false;
+	}
+
+	/* there is no interface to tell the parser what kind of header the
+	 * frames have, but we only accept radiotap */
+	conf.intf.arphdr = ARPHRD_IEEE80211_RADIOTAP;
+
+	LOG_INF("Replaying %s file '%s'", pcapng ? "pcapng" : "pcap", filename);
+	return true;
+}
+
+void replay_start(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &start_mono);
+	time_mono = start_mono;
+
+	replay_timer = event_timer_add(replay_timer_handler);
+	event_timer_set(replay_timer, 1, false);
+}
+
+void replay_finish(void)
+{
+	if (map != MAP_FAILED) {
+		munmap(map, map_len);
+		map = MAP_FAILED;
+	}
+}
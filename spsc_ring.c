@@ -0,0 +1,47 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+
+#include "spsc_ring.h"
+
+bool spsc_ring_init(struct spsc_ring* r, unsigned int size, size_t elem_size)
+{
+	unsigned int n = 1;
+
+	/* round up to power of 2 */
+	while (n < size)
+		n <<= 1;
+
+	r->buf = calloc(n, elem_size);
+	if (r->buf == NULL)
+		return false;
+
+	r->elem_size = elem_size;
+	r->mask = n - 1;
+	r->head = 0;
+	r->tail = 0;
+	return true;
+}
+
+void spsc_ring_free(struct spsc_ring* r)
+{
+	free(r->buf);
+	r->buf = NULL;
+}
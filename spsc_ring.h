@@ -0,0 +1,88 @@
+/* horst - Highly Optimized Radio Scanning Tool
+ *
+ * Copyright (C) 2017 Bruno Randolf (br1@einfach.org)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Bounded lock-free ring of fixed size elements for exactly one producer
+ * thread and one consumer thread.
+ *
+ * The producer gets a free slot with spsc_ring_write_slot(), fills it and
+ * publishes it with spsc_ring_write_done(). The consumer gets the oldest
+ * element with spsc_ring_read_slot() and frees it with spsc_ring_read_done().
+ * Elements are used in place, there is no copying.
+ */
+struct spsc_ring {
+	unsigned char*	buf;
+	size_t		elem_size;
+	unsigned int	mask;		/* size - 1, size is a power of 2 */
+	/* keep producer and consumer index in separate cache lines */
+	unsigned int	head __attribute__((aligned(64)));	/* producer */
+	unsigned int	tail __attribute__((aligned(64)));	/* consumer */
+};
+
+bool spsc_ring_init(struct spsc_ring* r, unsigned int size, size_t elem_size);
+void spsc_ring_free(struct spsc_ring* r);
+
+static inline unsigned int spsc_ring_size(const struct spsc_ring* r)
+{
+	return r->mask + 1;
+}
+
+static inline unsigned int spsc_ring_count(const struct spsc_ring* r)
+{
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+/* producer: return free slot or NULL if the ring is full */
+static inline void* spsc_ring_write_slot(struct spsc_ring* r)
+{
+	unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+	if (r->head - tail > r->mask)
+		return NULL;
+	return r->buf + (size_t)(r->head & r->mask) * r->elem_size;
+}
+
+static inline void spsc_ring_write_done(struct spsc_ring* r)
+{
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+/* consumer: return oldest element or NULL if the ring is empty */
+static inline void* spsc_ring_read_slot(struct spsc_ring* r)
+{
+	unsigned int head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+	if (head == r->tail)
+		return NULL;
+	return r->buf + (size_t)(r->tail & r->mask) * r->elem_size;
+}
+
+static inline void spsc_ring_read_done(struct spsc_ring* r)
+{
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+#endif